@@ -0,0 +1,190 @@
+#ifndef __BPT_H__
+#define __BPT_H__
+
+// Uncomment the line below if you are compiling on Windows.
+// #define WINDOWS
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef WINDOWS
+#define bool char
+#define false 0
+#define true 1
+#endif
+
+// Default order is 4.
+#define DEFAULT_ORDER 4
+
+// Minimum order is necessarily 3.  We set the maximum
+// order arbitrarily.  You may change the maximum order.
+#define MIN_ORDER 3
+#define MAX_ORDER 20
+
+// Constants for printing part or all of the GPL license.
+#define LICENSE_FILE "LICENSE.txt"
+#define LICENSE_WARRANTEE 0
+#define LICENSE_WARRANTEE_START 592
+#define LICENSE_WARRANTEE_END 624
+#define LICENSE_CONDITIONS 1
+#define LICENSE_CONDITIONS_START 70
+#define LICENSE_CONDITIONS_END 625
+
+// TYPES.
+
+/* Type representing the record
+ * to which a given key refers.
+ * In a real B+ tree system, the
+ * record would hold data (in a database)
+ * or a file (in an operating system)
+ * or some other information.
+ * Users can rewrite this part of the code
+ * to change the type and content
+ * of the value field.
+ */
+typedef struct record {
+    int value;
+} record;
+
+/* Type representing a node in the B+ tree.
+ * This type is general enough to serve for both
+ * the leaf and the internal node.
+ * The heart of the node is the array
+ * of keys and the array of corresponding
+ * pointers.  The relation between keys
+ * and pointers differs between leaves and
+ * internal nodes.  In a leaf, the index
+ * of each key equals the index of its corresponding
+ * pointer, with a maximum of order - 1 key-pointer
+ * pairs.  The last pointer points to the
+ * leaf to the right (or NULL in the case
+ * of the rightmost leaf).
+ * In an internal node, the first pointer
+ * refers to lower nodes with keys less than
+ * the smallest key in the keys array.  Then,
+ * with indices i starting at 0, the pointer
+ * at i + 1 points to the subtree with keys
+ * greater than or equal to the key in this
+ * node at index i.
+ * The num_keys field is used to keep
+ * track of the number of valid keys.
+ * In an internal node, the number of valid
+ * pointers is always num_keys + 1.
+ * In a leaf, the number of valid pointers
+ * to data is always num_keys.  The
+ * last leaf pointer points to the next leaf.
+ */
+typedef struct node {
+    void ** pointers;
+    int * keys;
+    struct node * parent;
+    bool is_leaf;
+    int num_keys;
+    struct node * next; // Used for queue.
+} node;
+
+/* On-disk tree.
+ * Which storage and I/O path open_db sets up is chosen
+ * through the globals below, before open_db is called.
+ */
+enum storage_mode { STORAGE_BUFFERED, STORAGE_MMAP };
+enum io_backend_type { IO_PREAD, IO_URING };
+
+// 열린 cursor, last_version.c 안에서만 들여다본다
+typedef struct cursor cursor;
+
+// bulk_load에 정렬된 레코드를 하나씩 건넨다, 0이 아니면 끝
+typedef int (*sorted_iterator)(int64_t * key, char * value, void * arg);
+
+// GLOBALS.
+
+extern int order;
+extern node * queue;
+extern bool verbose_output;
+
+extern int fd, freepage_num, leaf_order, internal_order;
+
+extern int buffer_frames;
+extern int storage_mode;
+extern int64_t mmap_reserve;
+extern int io_backend_type;
+extern int io_queue_depth;
+extern int leaf_compression;
+extern int optimistic_latching;
+extern int checkpoint_interval;
+extern int64_t checkpoint_log_bytes;
+extern int scan_prefetch_depth;
+
+// FUNCTION PROTOTYPES.
+
+// Output and utility.
+
+void license_notice( void );
+void print_license( int license_part );
+void usage_1( void );
+void usage_2( void );
+void usage_3( void );
+void enqueue( node * new_node );
+node * dequeue( void );
+void print_leaves( node * root );
+int height( node * root );
+int path_to_root( node * root, node * child );
+void print_tree( node * root );
+int cut( int length );
+
+// Opening and closing.
+
+int open_db(char * pathname);
+int close_db();
+
+// Search.
+
+char * find(int64_t key);
+char * find_value(int64_t key, int64_t * length);
+int find_batch(int64_t keys[], int n, char * out[]);
+cursor * open_cursor(int64_t start_key);
+int cursor_next(cursor * c, int64_t * key, char * value);
+void close_cursor(cursor * c);
+int scan(int64_t start, int64_t end, int (*callback)(int64_t key, char * value, void * arg), void * arg);
+
+// Insertion.
+
+int insert(int64_t key, char * value);
+int insert_value(int64_t key, const char * value, int64_t length);
+int insert_batch(int64_t keys[], char * values[], int n);
+int bulk_load(sorted_iterator next, void * arg, double fill_factor);
+
+// Deletion.
+
+int delete(int64_t key);
+
+// Pages of the disk tree.
+
+int64_t find_leaf(int64_t key);
+int64_t make_node(int64_t near);
+int64_t make_leaf(int64_t near);
+int64_t takefreepage(int64_t hint);
+void return_freepage(int64_t N_offset);
+int64_t start_new_tree(int64_t key, char * value);
+int insert_into_leaf(int64_t L_O, int64_t key, char* value);
+int insert_into_leaf_after_splitting(int64_t L_O, int64_t key, char * value);
+int insert_into_node(int64_t P_O, int64_t N_key, int64_t N_L_O);
+int insert_into_node_after_splitting(int64_t P_O, int64_t N_key, int64_t N_L_O);
+int insert_into_parent(int64_t L_O, int64_t N_L_O, int64_t N_key);
+int64_t remove_entry_from_node(int64_t key, int64_t N_offset);
+int adjust_root(int64_t leaf_offset);
+int get_neighbor_index(int64_t leaf_offset);
+int64_t get_neighbor_offset(int64_t leaf_offset);
+int coalesce_nodes(int64_t neighbor_offset, int64_t N_offset, int neighbor_index, int64_t k_prime);
+int delete_entry(int64_t key, int64_t N_offset);
+
+// Transactions.
+
+int begin_tx();
+int commit_tx();
+int abort_tx();
+
+#endif
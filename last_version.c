@@ -52,7 +52,17 @@
  *
  */
 
+#define _GNU_SOURCE // fallocate
 #include "bpt.h"
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // GLOBALS.
 
@@ -1322,963 +1332,6273 @@ char * find(int64_t key, char * value){
 
 
 //LDH
-//extern int freepage_num, leaf_oder, internal_order;
+int fd, freepage_num, leaf_order, internal_order; // leaf_order(SLOTTED_LEAF_LAYOUT 말고), internal_order는 open_db 전에 정할 수 있다
+
+/* On-disk page layouts.
+ * Every page is PAGE_SIZE bytes and is read and written
+ * as a whole.  Leaf and internal pages share a 128-byte
+ * page header: parent page offset, is_leaf, number of keys,
+ * and at +120 one more page offset, which is the right
+ * sibling of a leaf (0 for the rightmost leaf) or the
+ * leftmost child of an internal page.
+ */
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+#ifdef SLOTTED_LEAF_LAYOUT
+#define LEAF_ORDER 331 // 빈 값도 슬롯 12바이트는 쓴다
+#else
+#define LEAF_ORDER 32
+#endif
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+#define INTERNAL_ORDER 441 // 키가 1바이트로 줄면 (4096-128)/(8+1)개
+#else
+#define INTERNAL_ORDER 249
+#endif
+#define VALUE_SIZE 120
+
+typedef struct header_page {
+	int64_t reserved_offset; // 예전 free list의 머리, 이제는 비트맵이 대신한다
+	int64_t root_page_offset;
+	int64_t num_pages; // 헤더 페이지를 뺀 페이지 수
+	int64_t page_layout; // 이 파일을 만든 빌드의 PAGE_LAYOUT
+	char reserved[PAGE_SIZE - 32];
+} __attribute__((packed)) header_page;
+
+/* Free pages are tracked in bitmap pages, one for every
+ * BITMAP_GROUP pages of the file (see the free space map).
+ */
+#define BITMAP_GROUP ((PAGE_SIZE - 64) * 8)
+
+typedef struct bitmap_page {
+	int64_t num_free; // 이 그룹의 빈 페이지 수
+	char reserved[56];
+	uint64_t bits[(PAGE_SIZE - 64) / 8]; // 쓰는 페이지와 파일 끝 너머는 1
+} __attribute__((packed)) bitmap_page;
+
+typedef struct leaf_record {
+	int64_t key;
+	char value[VALUE_SIZE];
+} __attribute__((packed)) leaf_record;
+
+/* Values that do not fit in a record (longer than
+ * VALUE_SIZE, or containing a NUL) are stored by
+ * insert_value as an overflow stub: the first
+ * OVERFLOW_PREFIX bytes inline, then the total length,
+ * the first page of a chain of overflow pages holding
+ * the rest (0 if there is no rest) and a magic number.
+ * A string record can never look like a stub: its bytes
+ * after the first NUL are all zero, while a stub has the
+ * zero low byte of a page offset before a nonzero magic.
+ */
+#define OVERFLOW_PREFIX (VALUE_SIZE - 24)
+#define OVERFLOW_MAGIC 0x776f6c667265766fLL // "overflow"
+#define OVERFLOW_DATA (PAGE_SIZE - 8)
+
+typedef struct overflow_stub {
+	char prefix[OVERFLOW_PREFIX];
+	int64_t length;
+	int64_t first_page_offset;
+	int64_t magic;
+} __attribute__((packed)) overflow_stub;
+
+typedef struct overflow_page {
+	int64_t next_overflow_offset; // 0 이면 마지막 페이지
+	char data[OVERFLOW_DATA];
+} __attribute__((packed)) overflow_page;
+
+// value는 VALUE_SIZE 바이트 레코드
+int is_overflow(const char * value){
+	const overflow_stub * stub = (const overflow_stub*)value;
+
+	return stub->magic == OVERFLOW_MAGIC && (stub->first_page_offset & 0xff) == 0;
+}
+
+// 레코드에서 실제로 저장해야 하는 바이트 수
+int record_length(const char * value){
+	return is_overflow(value) ? VALUE_SIZE : strnlen(value, VALUE_SIZE);
+}
+
+// 문자열을 VALUE_SIZE 바이트 레코드로, 뒤는 0으로 채운다
+void record_from_string(char * record, const char * value){
+	size_t n = strnlen(value, VALUE_SIZE);
+
+	memcpy(record, value, n);
+	memset(record + n, 0, VALUE_SIZE - n);
+}
+
+/* An internal entry holds a key and the child
+ * that covers keys greater than or equal to it.
+ */
+typedef struct internal_entry {
+	int64_t key;
+	int64_t page_offset;
+} __attribute__((packed)) internal_entry;
+
+/* The tree is a B-link tree: every node links to the node
+ * on its right on the same level (a leaf through its
+ * right sibling offset, an internal node through its own
+ * field), and a node with a right link has a high key, the
+ * separator between the two in their parent.  A node that
+ * splits keeps its lower half and links to the new node,
+ * so a descent that read a parent before the split can
+ * still find its key by moving right.
+ */
+typedef struct node_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	char reserved[96];
+	int64_t high_key; // 오른쪽 링크가 있을 때만, 이 노드의 키는 모두 이보다 작다
+	int64_t one_more_page_offset;
+	char body[PAGE_SIZE - 128];
+} __attribute__((packed)) node_page;
+
+/* Leaves come in three layouts, chosen at build time.
+ * By default a leaf holds interleaved [key | value]
+ * records.  With -DSPLIT_LEAF_LAYOUT the 31 keys sit
+ * together right after the header and the values fill
+ * the rest of the page, so a search touches only the key
+ * lines.  The value of keys[i] lives in values[slots[i]];
+ * the slots in use are always 0..num_keys-1, so an insert
+ * or a delete shifts keys and one-byte slots and moves
+ * at most one value.
+ *
+ * With -DSLOTTED_LEAF_LAYOUT a leaf is a slotted page:
+ * a directory of [key | offset | length] slots grows
+ * up from the header and the values, stored with their
+ * own length (the string up to its NUL, at most
+ * VALUE_SIZE bytes), grow down from the end of the page.
+ * A leaf is full when the next record does not fit,
+ * not after a fixed number of keys, so small values pack
+ * many more records per page.  Space freed by a delete
+ * is reused after an in-page compaction.
+ *
+ * Records are accessed only through LEAF_KEY and the
+ * leaf_* helpers below, and the tree code sizes leaves
+ * in bytes (leaf_has_room, leaf_underfull) so it works
+ * the same for all three.
+ */
+#define LAYOUT_SPLIT_LEAF 2
+#define LAYOUT_SLOTTED_LEAF 4
+#define LEAF_SPACE (PAGE_SIZE - 128) // 헤더를 뺀 리프 공간
+
+#if defined(SPLIT_LEAF_LAYOUT) && defined(SLOTTED_LEAF_LAYOUT)
+#error "SPLIT_LEAF_LAYOUT and SLOTTED_LEAF_LAYOUT are exclusive"
+#endif
+
+#ifdef SPLIT_LEAF_LAYOUT
+typedef struct leaf_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	unsigned char slots[LEAF_ORDER - 1];
+	char reserved[96 - (LEAF_ORDER - 1)];
+	int64_t high_key;
+	int64_t right_sibling_offset;
+	int64_t keys[LEAF_ORDER - 1];
+	char values[LEAF_ORDER - 1][VALUE_SIZE];
+} __attribute__((packed)) leaf_page;
+
+#define LEAF_KEY(leaf, i) ((leaf)->keys[i])
+#define LEAF_VALUE(leaf, i) ((leaf)->values[(leaf)->slots[i]])
+#define LEAF_LAYOUT LAYOUT_SPLIT_LEAF
+#elif defined(SLOTTED_LEAF_LAYOUT)
+typedef struct leaf_slot {
+	int64_t key;
+	uint16_t offset; // 페이지 안에서 값의 위치
+	uint16_t length;
+} __attribute__((packed)) leaf_slot;
+
+typedef struct leaf_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	uint16_t heap_bytes; // 페이지 끝에서부터 값 영역이 쓴 바이트
+	uint16_t used_bytes; // 살아있는 슬롯과 값의 바이트
+	char reserved[92];
+	int64_t high_key;
+	int64_t right_sibling_offset;
+	leaf_slot slots[LEAF_ORDER - 1];
+	char heap[LEAF_SPACE - (LEAF_ORDER - 1) * sizeof(leaf_slot)];
+} __attribute__((packed)) leaf_page;
+
+#define LEAF_KEY(leaf, i) ((leaf)->slots[i].key)
+#define LEAF_LAYOUT LAYOUT_SLOTTED_LEAF
+#else
+typedef struct leaf_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	char reserved[96];
+	int64_t high_key;
+	int64_t right_sibling_offset;
+	leaf_record records[LEAF_ORDER - 1];
+} __attribute__((packed)) leaf_page;
+
+#define LEAF_KEY(leaf, i) ((leaf)->records[i].key)
+#define LEAF_VALUE(leaf, i) ((leaf)->records[i].value)
+#define LEAF_LAYOUT 0
+#endif
+
+// 레코드 value를 넣는 데 필요한 리프 공간
+int leaf_record_size(const char * value){
+#ifdef SLOTTED_LEAF_LAYOUT
+	return sizeof(leaf_slot) + record_length(value);
+#else
+	(void)value;
+	return sizeof(leaf_record);
+#endif
+}
+
+int leaf_used(const leaf_page * leaf){
+#ifdef SLOTTED_LEAF_LAYOUT
+	return leaf->used_bytes;
+#else
+	return leaf->num_keys * sizeof(leaf_record);
+#endif
+}
+
+#ifdef SLOTTED_LEAF_LAYOUT
+/* Packs the values against the end of the page in slot
+ * order, so that all the free space lies between the slot
+ * directory and the values.
+ */
+void leaf_compact(leaf_page * leaf){
+	int i;
+	char copy[PAGE_SIZE];
+
+	memcpy(copy, leaf, PAGE_SIZE);
+	leaf->heap_bytes = 0;
+	for(i = 0; i < leaf->num_keys; i++){
+		leaf->heap_bytes += leaf->slots[i].length;
+		memcpy((char*)leaf + PAGE_SIZE - leaf->heap_bytes, copy + leaf->slots[i].offset, leaf->slots[i].length);
+		leaf->slots[i].offset = PAGE_SIZE - leaf->heap_bytes;
+	}
+}
+#endif
+
+/* Inserts key -> value at position i.  value is a
+ * VALUE_SIZE record, zero-padded after its string or an
+ * overflow stub.  The caller has checked that the leaf
+ * has room (leaf_has_room).
+ */
+void leaf_insert(leaf_page * leaf, int i, int64_t key, const char * value){
+	int n = leaf->num_keys;
+#ifdef SPLIT_LEAF_LAYOUT
+	memmove(&leaf->keys[i + 1], &leaf->keys[i], sizeof(int64_t) * (n - i));
+	memmove(&leaf->slots[i + 1], &leaf->slots[i], n - i);
+	leaf->keys[i] = key;
+	leaf->slots[i] = n; // 비어있는 첫 슬롯
+	memcpy(leaf->values[n], value, VALUE_SIZE);
+#elif defined(SLOTTED_LEAF_LAYOUT)
+	int length = record_length(value);
+
+	// 슬롯 디렉터리와 값 영역 사이가 모자라면 지워진 값들의 자리를 모은다
+	if(128 + (n + 1) * (int)sizeof(leaf_slot) > PAGE_SIZE - leaf->heap_bytes - length)
+		leaf_compact(leaf);
+	leaf->heap_bytes += length;
+	memcpy((char*)leaf + PAGE_SIZE - leaf->heap_bytes, value, length);
+	memmove(&leaf->slots[i + 1], &leaf->slots[i], sizeof(leaf_slot) * (n - i));
+	leaf->slots[i].key = key;
+	leaf->slots[i].offset = PAGE_SIZE - leaf->heap_bytes;
+	leaf->slots[i].length = length;
+	leaf->used_bytes += sizeof(leaf_slot) + length;
+#else
+	memmove(&leaf->records[i + 1], &leaf->records[i], sizeof(leaf_record) * (n - i));
+	leaf->records[i].key = key;
+	memcpy(leaf->records[i].value, value, VALUE_SIZE);
+#endif
+	leaf->num_keys++;
+}
+
+void leaf_remove_at(leaf_page * leaf, int i){
+	int n = --leaf->num_keys;
+#ifdef SPLIT_LEAF_LAYOUT
+	int j, freed = leaf->slots[i];
+
+	if(freed != n){ // 마지막 슬롯의 값을 빈 슬롯으로 옮긴다
+		for(j = 0; leaf->slots[j] != n; j++);
+		memcpy(leaf->values[freed], leaf->values[n], VALUE_SIZE);
+		leaf->slots[j] = freed;
+	}
+	memmove(&leaf->keys[i], &leaf->keys[i + 1], sizeof(int64_t) * (n - i));
+	memmove(&leaf->slots[i], &leaf->slots[i + 1], n - i);
+#elif defined(SLOTTED_LEAF_LAYOUT)
+	leaf->used_bytes -= sizeof(leaf_slot) + leaf->slots[i].length;
+	if(leaf->slots[i].offset == PAGE_SIZE - leaf->heap_bytes) // 맨 앞 값이면 바로 돌려받는다
+		leaf->heap_bytes -= leaf->slots[i].length;
+	memmove(&leaf->slots[i], &leaf->slots[i + 1], sizeof(leaf_slot) * (n - i));
+	if(n == 0)
+		leaf->heap_bytes = 0;
+#else
+	memmove(&leaf->records[i], &leaf->records[i + 1], sizeof(leaf_record) * (n - i));
+#endif
+}
+
+// i번째 값을 VALUE_SIZE 바이트로 (뒤는 0으로 채워서) 복사한다
+void leaf_value(const leaf_page * leaf, int i, char * value){
+#ifdef SLOTTED_LEAF_LAYOUT
+	memcpy(value, (const char*)leaf + leaf->slots[i].offset, leaf->slots[i].length);
+	memset(value + leaf->slots[i].length, 0, VALUE_SIZE - leaf->slots[i].length);
+#else
+	memcpy(value, LEAF_VALUE(leaf, i), VALUE_SIZE);
+#endif
+}
+
+void leaf_load(const leaf_page * leaf, int i, leaf_record * record){
+	record->key = LEAF_KEY(leaf, i);
+	leaf_value(leaf, i, record->value);
+}
+
+// records[0..n)로 리프 내용을 통째로 바꾼다
+void leaf_store(leaf_page * leaf, const leaf_record * records, int n){
+	int i;
+
+	leaf->num_keys = 0;
+#ifdef SLOTTED_LEAF_LAYOUT
+	leaf->heap_bytes = leaf->used_bytes = 0;
+#endif
+	for(i = 0; i < n; i++)
+		leaf_insert(leaf, i, records[i].key, records[i].value);
+}
+
+// src의 src_i번째 레코드를 dst의 dst_i 자리에 넣는다
+void leaf_move(leaf_page * dst, int dst_i, const leaf_page * src, int src_i){
+	leaf_record record;
+
+	leaf_load(src, src_i, &record);
+	leaf_insert(dst, dst_i, record.key, record.value);
+}
+
+// n개의 레코드를 더 넣을 수 있는지, bytes는 그 크기의 합
+int leaf_has_room(const leaf_page * leaf, int n, int bytes){
+	return leaf->num_keys + n <= leaf_order - 1 && leaf_used(leaf) + bytes <= LEAF_SPACE;
+}
+
+/* A leaf underflows when it is below half of both its
+ * key count and its space; for the fixed-size layouts
+ * this is the usual num_keys < cut(leaf_order - 1).
+ */
+int leaf_underfull(const leaf_page * leaf){
+	return leaf->num_keys < cut(leaf_order - 1) && leaf_used(leaf) < LEAF_SPACE / 2;
+}
+
+/* Cuts records[0..n) into the fewest leaves that hold
+ * them, filled about equally by count and by bytes.
+ * ends[k] is one past the last record of leaf k; ends
+ * has room for n entries.  Returns the number of leaves.
+ */
+int leaf_partition(const leaf_record * records, int n, int * ends){
+	int i, k, leaves, count, bytes, done, total, count_target, byte_target, fits;
+
+	for(i = 0, total = 0; i < n; i++)
+		total += leaf_record_size(records[i].value);
+	leaves = (n + leaf_order - 2) / (leaf_order - 1);
+	if(leaves < (total + LEAF_SPACE - 1) / LEAF_SPACE)
+		leaves = (total + LEAF_SPACE - 1) / LEAF_SPACE;
+
+	for(;; leaves++){ // leaves == n 이면 반드시 들어간다
+		fits = 1;
+		for(k = 0, i = 0, done = 0; i < n; k++){
+			// 남은 레코드를 남은 leaf에 고르게
+			count_target = (n - i + leaves - k - 1) / (leaves - k);
+			byte_target = (total - done + leaves - k - 1) / (leaves - k);
+			count = bytes = 0;
+			while(i < n && (k == leaves - 1 || (count < count_target && bytes < byte_target))){
+				bytes += leaf_record_size(records[i].value);
+				count++;
+				i++;
+			}
+			if(count > leaf_order - 1 || bytes > LEAF_SPACE){
+				fits = 0;
+				break;
+			}
+			done += bytes;
+			ends[k] = i;
+		}
+		if(fits)
+			return k;
+	}
+}
+
+/* Internal pages come in three layouts, chosen at build
+ * time.  By default the entries are interleaved
+ * [key | child] pairs.  With -DSPLIT_INTERNAL_LAYOUT all
+ * the keys come first and the children after them, so
+ * that a search reads the keys as one contiguous array
+ * (and with SIMD, see below).
+ *
+ * With -DCOMPRESSED_INTERNAL_LAYOUT the keys are stored
+ * compressed.  The high bytes that all keys of the page
+ * share (key_base) and the low bytes that are zero in all
+ * of them (key_shift) are kept once in the header, and
+ * each key keeps only the key_bytes bytes in between.
+ * The children stay full offsets at the front of the page
+ * and the packed keys grow down from its end, so how many
+ * entries fit depends on the keys: a page is full when
+ * they no longer fit (internal_fits), at up to 440 keys
+ * instead of 248.  Separators picked by leaf_separator
+ * end in zero bytes, which is what key_shift drops.
+ *
+ * The layout is recorded in the header page; open_db
+ * refuses a file of another layout.  Entries are read
+ * through ENTRY_KEY and ENTRY_OFFSET and changed only
+ * through the internal_* helpers below.
+ */
+#define LAYOUT_SPLIT_INTERNAL 1
+#define LAYOUT_COMPRESSED_INTERNAL 8
+#define INTERNAL_SPACE (PAGE_SIZE - 128) // 헤더를 뺀 internal 공간
+
+#if defined(SPLIT_INTERNAL_LAYOUT) && defined(COMPRESSED_INTERNAL_LAYOUT)
+#error "SPLIT_INTERNAL_LAYOUT and COMPRESSED_INTERNAL_LAYOUT are exclusive"
+#endif
+
+#ifdef SPLIT_INTERNAL_LAYOUT
+typedef struct internal_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	char reserved[88];
+	int64_t right_sibling_offset;
+	int64_t high_key;
+	int64_t leftmost_offset;
+	int64_t keys[INTERNAL_ORDER - 1];
+	int64_t offsets[INTERNAL_ORDER - 1];
+} __attribute__((packed)) internal_page;
+
+#define ENTRY_KEY(page, i) ((page)->keys[i])
+#define ENTRY_OFFSET(page, i) ((page)->offsets[i])
+#define INTERNAL_LAYOUT LAYOUT_SPLIT_INTERNAL
+#elif defined(COMPRESSED_INTERNAL_LAYOUT)
+typedef struct internal_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	int64_t key_base; // 모든 키가 공유하는 상위 바이트, 나머지는 0 (KEY_BIAS를 뒤집은 값)
+	unsigned char key_bytes; // 키마다 저장하는 바이트 수
+	unsigned char key_shift; // 모든 키에서 0이라 버린 하위 바이트 수
+	char reserved[78];
+	int64_t right_sibling_offset;
+	int64_t high_key;
+	int64_t leftmost_offset;
+	int64_t offsets[INTERNAL_SPACE / sizeof(int64_t)]; // 자식은 앞에서부터, 키는 끝에서부터
+} __attribute__((packed)) internal_page;
+
+int64_t internal_key(const internal_page * page, int i);
+
+#define ENTRY_KEY(page, i) internal_key(page, i)
+#define ENTRY_OFFSET(page, i) ((page)->offsets[i])
+#define INTERNAL_LAYOUT LAYOUT_COMPRESSED_INTERNAL
+#else
+typedef struct internal_page {
+	int64_t parent_page_offset;
+	int is_leaf;
+	int num_keys;
+	char reserved[88];
+	int64_t right_sibling_offset;
+	int64_t high_key;
+	int64_t leftmost_offset;
+	internal_entry entries[INTERNAL_ORDER - 1];
+} __attribute__((packed)) internal_page;
+
+#define ENTRY_KEY(page, i) ((page)->entries[i].key)
+#define ENTRY_OFFSET(page, i) ((page)->entries[i].page_offset)
+#define INTERNAL_LAYOUT 0
+#endif
+
+#define LAYOUT_FREE_BITMAP 16 // free list 대신 비트맵, 모든 빌드에서
+#define LAYOUT_BLINK 32 // 모든 노드에 오른쪽 링크와 high key
+#define PAGE_LAYOUT (INTERNAL_LAYOUT | LEAF_LAYOUT | LAYOUT_FREE_BITMAP | LAYOUT_BLINK)
+
+int64_t node_right(const node_page * node){
+	return node->is_leaf ? ((const leaf_page*)node)->right_sibling_offset : ((const internal_page*)node)->right_sibling_offset;
+}
+
+// 오른쪽 링크와 high key를 함께 바꾼다
+void node_link(node_page * node, int64_t right, int64_t high_key){
+	if(node->is_leaf)
+		((leaf_page*)node)->right_sibling_offset = right;
+	else
+		((internal_page*)node)->right_sibling_offset = right;
+	node->high_key = right ? high_key : 0;
+}
+
+// key가 node에서 오른쪽으로 옮겨 갔다 (node를 읽은 뒤에 쪼개졌다)
+int node_moved_right(const node_page * node, int64_t key){
+	return node_right(node) != 0 && key >= node->high_key;
+}
+
+/* Keys are compressed with the sign bit flipped, so that
+ * they compare as unsigned numbers in the same order.
+ */
+#define KEY_BIAS (1ULL << 63)
+
+/* How a sorted run of n keys is compressed: *bytes kept
+ * per key and *shift low zero bytes dropped.  Returns the
+ * shared high bytes (the base, biased).
+ */
+int64_t key_encoding(const int64_t * keys, int n, int * bytes, int * shift){
+	int i, high;
+	uint64_t diff, mask, low = 0;
+
+	*bytes = *shift = 0;
+	if(n == 0)
+		return 0;
+	diff = (uint64_t)keys[0] ^ (uint64_t)keys[n-1]; // 정렬되어 있으니 양 끝만 보면 된다
+	high = diff ? 8 - __builtin_clzll(diff) / 8 : 0; // 키마다 다른 하위 바이트 수
+	mask = high == 8 ? ~0ULL : (1ULL << (8 * high)) - 1;
+	for(i=0; i < n; i++)
+		low |= ((uint64_t)keys[i] ^ KEY_BIAS) & mask;
+	*shift = low ? __builtin_ctzll(low) / 8 : high;
+	*bytes = high - *shift;
+	return (int64_t)(((uint64_t)keys[0] ^ KEY_BIAS) & ~mask);
+}
+
+/* Whether n sorted entries fit in one internal page. */
+int internal_fits(const int64_t * keys, int n){
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	int bytes, shift;
+
+	if(n > internal_order - 1)
+		return 0;
+	key_encoding(keys, n, &bytes, &shift);
+	return n * (int)(sizeof(int64_t) + bytes) <= INTERNAL_SPACE;
+#else
+	(void)keys;
+	return n <= internal_order - 1;
+#endif
+}
+
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+/* The packed key i is the key_bytes bytes ending
+ * i * key_bytes before the end of the page.  It is read
+ * as the top of the 8 bytes ending there, which always
+ * lie inside the page.
+ */
+#define PACKED_AT(page, i) ((const char*)(page) + PAGE_SIZE - 8 - (size_t)(i) * (page)->key_bytes)
+
+uint64_t packed_key(const internal_page * page, int i){
+	uint64_t v;
+
+	memcpy(&v, PACKED_AT(page, i), sizeof(v));
+	return v >> (64 - 8 * page->key_bytes);
+}
+
+int64_t internal_key(const internal_page * page, int i){
+	if(page->key_bytes == 0) // 키가 하나뿐이다
+		return (int64_t)((uint64_t)page->key_base ^ KEY_BIAS);
+	return (int64_t)(((uint64_t)page->key_base | packed_key(page, i) << (8 * page->key_shift)) ^ KEY_BIAS);
+}
+#else
+/* Copies n entries from src starting at src_i to dst
+ * starting at dst_i; the ranges may overlap.
+ */
+void internal_move(internal_page * dst, int dst_i, const internal_page * src, int src_i, int n){
+	if(n <= 0)
+		return;
+#ifdef SPLIT_INTERNAL_LAYOUT
+	memmove(&dst->keys[dst_i], &src->keys[src_i], sizeof(int64_t) * n);
+	memmove(&dst->offsets[dst_i], &src->offsets[src_i], sizeof(int64_t) * n);
+#else
+	memmove(&dst->entries[dst_i], &src->entries[src_i], sizeof(internal_entry) * n);
+#endif
+}
+#endif
+
+/* Copies the entries of page out to keys and offsets
+ * (the leftmost child stays in the page) and returns
+ * their number.
+ */
+int internal_load(const internal_page * page, int64_t * keys, int64_t * offsets){
+	int i;
+
+	for(i=0; i < page->num_keys; i++){
+		keys[i] = ENTRY_KEY(page, i);
+		offsets[i] = ENTRY_OFFSET(page, i);
+	}
+	return page->num_keys;
+}
+
+/* Replaces the entries of page with n sorted entries;
+ * they must fit (internal_fits).
+ */
+void internal_store(internal_page * page, const int64_t * keys, const int64_t * offsets, int n){
+	int i;
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	int bytes, shift;
+	uint64_t v, mask;
+
+	page->key_base = key_encoding(keys, n, &bytes, &shift);
+	page->key_bytes = bytes;
+	page->key_shift = shift;
+	mask = bytes + shift == 8 ? ~0ULL : (1ULL << (8 * (bytes + shift))) - 1;
+	for(i=0; i < n; i++){
+		ENTRY_OFFSET(page, i) = offsets[i];
+		v = (((uint64_t)keys[i] ^ KEY_BIAS) & mask) >> (8 * shift);
+		memcpy((char*)page + PAGE_SIZE - (size_t)(i + 1) * bytes, &v, bytes);
+	}
+#else
+	for(i=0; i < n; i++){
+		ENTRY_KEY(page, i) = keys[i];
+		ENTRY_OFFSET(page, i) = offsets[i];
+	}
+#endif
+	page->num_keys = n;
+}
+
+/* Inserts an entry at index i.  Returns -1, leaving the
+ * page as it was, if the page has no room for it.
+ */
+int internal_insert(internal_page * page, int i, int64_t key, int64_t offset){
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	int n;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+
+	n = internal_load(page, keys, offsets);
+	memmove(&keys[i + 1], &keys[i], sizeof(int64_t) * (n - i));
+	memmove(&offsets[i + 1], &offsets[i], sizeof(int64_t) * (n - i));
+	keys[i] = key;
+	offsets[i] = offset;
+	if(!internal_fits(keys, n + 1))
+		return -1;
+	internal_store(page, keys, offsets, n + 1);
+#else
+	if(page->num_keys >= internal_order - 1)
+		return -1;
+	internal_move(page, i + 1, page, i, page->num_keys - i);
+	ENTRY_KEY(page, i) = key;
+	ENTRY_OFFSET(page, i) = offset;
+	page->num_keys++;
+#endif
+	return 0;
+}
+
+/* Removes entry i; this never makes the keys longer. */
+void internal_remove_at(internal_page * page, int i){
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	int n;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+
+	n = internal_load(page, keys, offsets);
+	memmove(&keys[i], &keys[i + 1], sizeof(int64_t) * (n - i - 1));
+	memmove(&offsets[i], &offsets[i + 1], sizeof(int64_t) * (n - i - 1));
+	internal_store(page, keys, offsets, n - 1);
+#else
+	internal_move(page, i, page, i + 1, page->num_keys - i - 1);
+	page->num_keys--;
+#endif
+}
+
+/* Replaces key i.  A compressed page can overflow when
+ * the new key is longer than the others; then -1 is
+ * returned and the page is left as it was.
+ */
+int internal_set_key(internal_page * page, int i, int64_t key){
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	int n;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+
+	n = internal_load(page, keys, offsets);
+	keys[i] = key;
+	if(!internal_fits(keys, n))
+		return -1;
+	internal_store(page, keys, offsets, n);
+#else
+	ENTRY_KEY(page, i) = key;
+#endif
+	return 0;
+}
+
+/* An internal page is underfull below half its keys, or,
+ * compressed, below half its keys and half its space.
+ * An underfull page always has room for one more entry.
+ */
+int internal_underfull(const internal_page * page){
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	return page->num_keys < cut(internal_order) - 1 &&
+		page->num_keys * (int)(sizeof(int64_t) + page->key_bytes) < INTERNAL_SPACE / 2;
+#else
+	return page->num_keys < cut(internal_order) - 1;
+#endif
+}
+
+/* Suffix truncation.  The separator between two leaves
+ * can be any key above the largest of the left one and
+ * up to the smallest of the right one; the one with the
+ * most low zero bits is picked.  Such separators share
+ * zero low bytes, which compressed internal pages drop.
+ */
+int64_t leaf_separator(int64_t left, int64_t right){
+	uint64_t low = (uint64_t)left + 1, high = (uint64_t)right;
+
+	if(left < 0 && right >= 0) // 0이 사이에 있다
+		return 0;
+	if(low == high)
+		return right;
+	return (int64_t)(high & ~((1ULL << (63 - __builtin_clzll(low ^ high))) - 1));
+}
+
+_Static_assert(sizeof(header_page) == PAGE_SIZE, "header_page size");
+_Static_assert(sizeof(node_page) == PAGE_SIZE, "node_page size");
+_Static_assert(sizeof(leaf_page) == PAGE_SIZE, "leaf_page size");
+_Static_assert(sizeof(internal_page) == PAGE_SIZE, "internal_page size");
+
+/* Searching a page.
+ * The keys of a node are sorted, so they are located by
+ * binary search: the lower bound is the index of the
+ * first key >= key, the upper bound that of the first
+ * key > key.  The loop halves the range without a
+ * data-dependent branch (the select compiles to a
+ * conditional move), so a probe costs log2(order)
+ * comparisons and no mispredictions.  Keys are read with
+ * a stride, since they sit inside records and entries,
+ * and with memcpy, since a 12-byte slot leaves them
+ * unaligned.
+ * Building with -DLINEAR_PAGE_SEARCH restores the linear
+ * scans.
+ */
+int64_t key_at(const char * keys, int stride, int i){
+	int64_t key;
+
+	memcpy(&key, keys + (size_t)i * stride, sizeof(key));
+	return key;
+}
+
+int key_lower_bound(const char * keys, int stride, int n, int64_t key){
+#ifdef LINEAR_PAGE_SEARCH
+	int i = 0;
+	while(i < n && key_at(keys, stride, i) < key)
+		i++;
+	return i;
+#else
+	int base = 0, half;
+
+	if(n == 0)
+		return 0;
+	while(n > 1){
+		half = n / 2;
+		base = key_at(keys, stride, base + half) < key ? base + half : base;
+		n -= half;
+	}
+	return base + (key_at(keys, stride, base) < key);
+#endif
+}
+
+int key_upper_bound(const char * keys, int stride, int n, int64_t key){
+#ifdef LINEAR_PAGE_SEARCH
+	int i = 0;
+	while(i < n && key_at(keys, stride, i) <= key)
+		i++;
+	return i;
+#else
+	int base = 0, half;
+
+	if(n == 0)
+		return 0;
+	while(n > 1){
+		half = n / 2;
+		base = key_at(keys, stride, base + half) <= key ? base + half : base;
+		n -= half;
+	}
+	return base + (key_at(keys, stride, base) <= key);
+#endif
+}
+
+/* SIMD search of a contiguous key array.
+ * The range is first halved down to at most 16 keys, and
+ * the keys of that window that are smaller than the probe
+ * are counted four (AVX2) or two (SSE4.2) per compare:
+ * movemask turns the compare into bits and popcount
+ * gives the position.  The kernel is picked once at
+ * run time (search_init) from what the CPU supports,
+ * with the scalar binary search as the fallback.
+ * A window may read up to 16 keys past keys[n-1], which
+ * stays inside the page for every array it is used on.
+ */
+#define SIMD_WINDOW 16
+
+int lower_bound_scalar(const int64_t * keys, int n, int64_t key){
+	return key_lower_bound((const char*)keys, sizeof(int64_t), n, key);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2,popcnt")))
+int lower_bound_avx2(const int64_t * keys, int n, int64_t key){
+	int i, base = 0, half;
+	unsigned int mask = 0;
+	__m256i probe, v;
+
+	while(n > SIMD_WINDOW){
+		half = n / 2;
+		base = keys[base + half] < key ? base + half : base;
+		n -= half;
+	}
+	probe = _mm256_set1_epi64x(key);
+	for(i = 0; i < n; i += 4){
+		v = _mm256_loadu_si256((const __m256i*)(keys + base + i));
+		mask |= (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(probe, v))) << i;
+	}
+	return base + __builtin_popcount(mask & ((1u << n) - 1));
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int lower_bound_sse42(const int64_t * keys, int n, int64_t key){
+	int i, base = 0, half;
+	unsigned int mask = 0;
+	__m128i probe, v;
+
+	while(n > SIMD_WINDOW){
+		half = n / 2;
+		base = keys[base + half] < key ? base + half : base;
+		n -= half;
+	}
+	probe = _mm_set1_epi64x(key);
+	for(i = 0; i < n; i += 2){
+		v = _mm_loadu_si128((const __m128i*)(keys + base + i));
+		mask |= (unsigned int)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(probe, v))) << i;
+	}
+	return base + __builtin_popcount(mask & ((1u << n) - 1));
+}
+#endif
+
+int (*lower_bound_kernel)(const int64_t * keys, int n, int64_t key) = lower_bound_scalar;
+
+/* The keys array of a split page as a plain pointer.  It
+ * starts right after the header, so it is aligned as well
+ * as the page itself.
+ */
+#define PAGE_KEYS(page, type) ((const int64_t*)((const char*)(page) + offsetof(type, keys)))
+
+void search_init(){
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(LINEAR_PAGE_SEARCH)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		lower_bound_kernel = lower_bound_avx2;
+	else if(__builtin_cpu_supports("sse4.2"))
+		lower_bound_kernel = lower_bound_sse42;
+#endif
+}
+
+int leaf_lower_bound(const leaf_page * leaf, int64_t key){
+#ifdef SPLIT_LEAF_LAYOUT
+	return lower_bound_kernel(PAGE_KEYS(leaf, leaf_page), leaf->num_keys, key);
+#elif defined(SLOTTED_LEAF_LAYOUT)
+	return key_lower_bound((const char*)&leaf->slots[0].key, sizeof(leaf_slot), leaf->num_keys, key);
+#else
+	return key_lower_bound((const char*)&leaf->records[0].key, sizeof(leaf_record), leaf->num_keys, key);
+#endif
+}
+
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+/* Lower bound in a compressed page.  key is brought into
+ * the packed form of the page, rounded up over the dropped
+ * low bytes, and compared with the packed keys as they are.
+ */
+int packed_lower_bound(const internal_page * page, int64_t key){
+	int n = page->num_keys, base = 0, half, width = 8 * (page->key_bytes + page->key_shift);
+	uint64_t rel, target;
+
+	if(n == 0 || ((uint64_t)key ^ KEY_BIAS) <= (uint64_t)page->key_base)
+		return 0;
+	rel = ((uint64_t)key ^ KEY_BIAS) - (uint64_t)page->key_base;
+	if(page->key_bytes == 0 || (width < 64 && rel >> width != 0)) // 페이지의 모든 키보다 크다
+		return n;
+	target = (rel >> (8 * page->key_shift)) + ((rel & ((1ULL << (8 * page->key_shift)) - 1)) != 0);
+	while(n > 1){
+		half = n / 2;
+		base = packed_key(page, base + half) < target ? base + half : base;
+		n -= half;
+	}
+	return base + (packed_key(page, base) < target);
+}
+#endif
+
+int internal_lower_bound(const internal_page * page, int64_t key){
+#ifdef SPLIT_INTERNAL_LAYOUT
+	return lower_bound_kernel(PAGE_KEYS(page, internal_page), page->num_keys, key);
+#elif defined(COMPRESSED_INTERNAL_LAYOUT)
+	return packed_lower_bound(page, key);
+#else
+	return key_lower_bound((const char*)&ENTRY_KEY(page, 0), sizeof(internal_entry), page->num_keys, key);
+#endif
+}
+
+/* The child to follow for key: 0 is the leftmost child,
+ * i > 0 the child of entries[i-1].
+ */
+int internal_child_index(const internal_page * page, int64_t key){
+#ifdef SPLIT_INTERNAL_LAYOUT
+	if(key == INT64_MAX)
+		return page->num_keys;
+	return lower_bound_kernel(PAGE_KEYS(page, internal_page), page->num_keys, key + 1); // key보다 작거나 같은 키의 수
+#elif defined(COMPRESSED_INTERNAL_LAYOUT)
+	if(key == INT64_MAX)
+		return page->num_keys;
+	return packed_lower_bound(page, key + 1);
+#else
+	return key_upper_bound((const char*)&ENTRY_KEY(page, 0), sizeof(internal_entry), page->num_keys, key);
+#endif
+}
+
+/* Write-ahead log.
+ * A tree operation (one insert or delete) is logged as
+ * physical page updates: for every page it dirties, the
+ * changed byte range with its before (undo) and after (redo)
+ * image.  Records are identified by their log sequence number
+ * (LSN), the byte offset of the record in the log file.
+ * A dirty page may reach the data file only after the log is
+ * durable up to the page's LSN, so the data file itself is
+ * written lazily and without O_SYNC.
+ *
+ * Records are appended to an in-memory buffer.  A single
+ * flusher thread writes the buffer out and fsyncs it; every
+ * operation that committed while the previous fsync was
+ * running is made durable by the next one (group commit).
+ *
+ * Operations that change a single leaf log side by side.
+ * Each keeps its leaf latched until its COMMIT is in the
+ * buffer, so the pages of unfinished operations never
+ * overlap and recovery can undo them one record at a time,
+ * newest first, whatever operation it belongs to.
+ *
+ * A transaction (see Transactions) spans many operations,
+ * so it cannot be undone page by page.  It logs TX_UNDO,
+ * the before image of each record it writes, ahead of the
+ * operation, chained through prev_lsn like the records of
+ * an operation, and TX_END when it is over.
+ */
+#define WAL_HEADER_SIZE 512
+#define WAL_BUFFER_SIZE (1024 * 1024)
+#define WAL_MAGIC 0x4c41574250544c44LL
+
+enum wal_record_type { WAL_BEGIN = 1, WAL_UPDATE, WAL_COMMIT,
+	WAL_CHECKPOINT_BEGIN, WAL_CHECKPOINT_END, WAL_TX_UNDO, WAL_TX_END };
+
+typedef struct wal_record {
+	int64_t lsn;
+	int64_t prev_lsn; // 같은 operation의 이전 레코드, 없으면 0
+	int64_t op_id; // 트랜잭션의 레코드라면 트랜잭션 id
+	int type;
+	int size; // 레코드 전체 크기
+	unsigned int checksum; // lsn과 checksum을 뺀 나머지의 체크섬
+} __attribute__((packed)) wal_record;
+
+/* WAL_UPDATE is followed by length bytes of before image
+ * and length bytes of after image.
+ */
+typedef struct wal_update {
+	wal_record rec;
+	int64_t page_offset;
+	int offset; // 페이지 안에서의 위치
+	int length;
+} __attribute__((packed)) wal_update;
+
+/* WAL_TX_UNDO is followed by the length bytes of the
+ * value key had before the transaction wrote it.
+ */
+typedef struct wal_tx_undo {
+	wal_record rec;
+	int64_t key;
+	int64_t length; // -1이면 키가 없었다
+} __attribute__((packed)) wal_tx_undo;
+
+/* Entries of the dirty page table and of the active
+ * operation and transaction tables, as saved by a
+ * checkpoint.
+ */
+typedef struct wal_dirty_page {
+	int64_t page_offset;
+	int64_t rec_lsn; // 이 페이지를 처음 더럽힌 레코드
+} __attribute__((packed)) wal_dirty_page;
+
+typedef struct wal_active_op {
+	int64_t op_id;
+	int64_t first_lsn;
+	int64_t last_lsn;
+} __attribute__((packed)) wal_active_op;
+
+/* WAL_CHECKPOINT_END is followed by num_dirty_pages
+ * wal_dirty_page, num_active_ops wal_active_op and
+ * num_active_txs wal_active_op (op_id is the transaction).
+ */
+typedef struct wal_checkpoint {
+	wal_record rec;
+	int num_dirty_pages;
+	int num_active_ops;
+	int num_active_txs;
+} __attribute__((packed)) wal_checkpoint;
+
+/* The master record: where recovery starts reading. */
+typedef struct wal_file_header {
+	int64_t magic;
+	int64_t checkpoint_lsn; // 마지막으로 완료된 체크포인트의 BEGIN, 없으면 0
+	char reserved[WAL_HEADER_SIZE - 16];
+} __attribute__((packed)) wal_file_header;
+
+/* Image of a page as of its last logged update, kept
+ * for every page the current operation has touched.
+ */
+typedef struct wal_snapshot {
+	int64_t page_offset;
+	char image[PAGE_SIZE];
+} wal_snapshot;
+
+/* State of the operation a thread is running.  Writers that
+ * change a single leaf run side by side (see tree_lock), so
+ * every thread has its own, and the ones in progress are
+ * linked for the checkpoint.  first/last LSN are read by the
+ * checkpoint and so change under wal_mutex.
+ */
+typedef struct wal_op {
+	int64_t op_id; // 0이면 operation 밖
+	int64_t first_lsn;
+	int64_t last_lsn;
+	wal_snapshot * snapshots;
+	int num_snapshots;
+	int max_snapshots;
+	struct wal_op * prev, * next; // 진행 중인 operation 목록
+} wal_op;
+
+/* State of the transaction a thread is running, kept the
+ * same way as its wal_op.  first/last LSN of the TX_UNDO
+ * chain change under wal_mutex.  undo holds the before
+ * images again for abort_tx, which does not read the log.
+ */
+typedef struct tx_undo {
+	int64_t key;
+	int64_t length; // -1이면 키가 없었다
+	char * image;
+} tx_undo;
+
+typedef struct transaction {
+	int64_t tx_id; // 0이면 트랜잭션 밖
+	int64_t age; // wait-die에서의 나이, 0이면 기다리기만 한다
+	int64_t restart_age; // 양보하고 되돌려진 트랜잭션의 나이, 다음 트랜잭션이 물려받는다
+	int64_t first_lsn;
+	int64_t last_lsn;
+	int aborted; // 락을 양보하느라 이미 되돌려졌다
+	struct record_lock * locks; // 쥐고 있는 레코드 락
+	tx_undo * undo;
+	int num_undo;
+	int max_undo;
+	struct transaction * prev, * next; // 진행 중인 트랜잭션 목록
+} transaction;
+
+int log_fd = -1;
+pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wal_flush_cond = PTHREAD_COND_INITIALIZER; // 플러셔를 깨운다
+pthread_cond_t wal_done_cond = PTHREAD_COND_INITIALIZER; // 플러시 완료를 알린다
+pthread_t wal_flusher;
+int wal_running = 0;
+
+char * wal_active = NULL; // 레코드가 쌓이는 버퍼
+char * wal_flushing = NULL; // 플러셔가 쓰고 있는 버퍼
+int wal_active_len = 0;
+int64_t wal_active_lsn; // wal_active 첫 바이트의 LSN
+int64_t wal_next_lsn; // 다음 레코드의 LSN
+int64_t wal_flushed_lsn; // 여기까지는 디스크에 있다
+int64_t wal_flush_request = 0;
+
+int64_t wal_next_op_id = 1; // wal_mutex
+wal_op * wal_ops = NULL; // 진행 중인 operation들 (wal_mutex)
+pthread_key_t wal_op_key; // 스레드마다의 wal_op, 스레드가 끝나면 풀어준다
+pthread_once_t wal_op_once = PTHREAD_ONCE_INIT;
+transaction * wal_txs = NULL; // 진행 중인 트랜잭션들 (wal_mutex)
+pthread_key_t tx_key;
+pthread_once_t tx_once = PTHREAD_ONCE_INIT;
+
+/* Checkpoints are taken every checkpoint_interval seconds,
+ * or earlier once checkpoint_log_bytes of log were written
+ * since the last one.  Both can be changed before open_db.
+ */
+int checkpoint_interval = 30;
+int64_t checkpoint_log_bytes = 64 * 1024 * 1024;
+pthread_cond_t wal_checkpoint_cond = PTHREAD_COND_INITIALIZER;
+pthread_t wal_checkpointer;
+int64_t wal_checkpoint_lsn = 0; // 마지막 체크포인트의 BEGIN
+int64_t wal_discarded_lsn = WAL_HEADER_SIZE; // 이 앞의 로그는 지워졌다
+
+unsigned int wal_checksum(const wal_record * rec){
+	const unsigned char * p = (const unsigned char*)&rec->prev_lsn;
+	int i, n = rec->size - 8;
+	unsigned int h = 2166136261u; // FNV-1a
+	unsigned int saved = ((wal_record*)rec)->checksum;
+
+	((wal_record*)rec)->checksum = 0;
+	for(i=0; i<n; i++)
+		h = (h ^ p[i]) * 16777619u;
+	((wal_record*)rec)->checksum = saved;
+	return h;
+}
+
+void * wal_flusher_main(void * arg){
+	char * buf;
+	int len;
+	int64_t lsn;
+
+	(void)arg;
+	pthread_mutex_lock(&wal_mutex);
+	while(1){
+		while(wal_running && (wal_flush_request <= wal_flushed_lsn || wal_active_len == 0))
+			pthread_cond_wait(&wal_flush_cond, &wal_mutex);
+		if(wal_active_len == 0 && !wal_running)
+			break;
+
+		// 버퍼를 바꿔치기하고, 쓰는 동안에도 다른 레코드가 쌓이게 한다
+		buf = wal_active;
+		len = wal_active_len;
+		lsn = wal_active_lsn;
+		wal_active = wal_flushing;
+		wal_flushing = buf;
+		wal_active_len = 0;
+		wal_active_lsn = lsn + len;
+		pthread_cond_broadcast(&wal_done_cond);
+		pthread_mutex_unlock(&wal_mutex);
+
+		if(pwrite(log_fd, buf, len, lsn) != len || fdatasync(log_fd) != 0){
+			perror("Log flush.");
+			exit(EXIT_FAILURE);
+		}
+
+		pthread_mutex_lock(&wal_mutex);
+		wal_flushed_lsn = lsn + len;
+		pthread_cond_broadcast(&wal_done_cond);
+	}
+	pthread_mutex_unlock(&wal_mutex);
+	return NULL;
+}
+
+/* Blocks until the log is durable up to lsn. */
+void wal_flush(int64_t lsn){
+	pthread_mutex_lock(&wal_mutex);
+	if(lsn > wal_flush_request)
+		wal_flush_request = lsn;
+	while(wal_flushed_lsn < lsn){
+		pthread_cond_signal(&wal_flush_cond);
+		pthread_cond_wait(&wal_done_cond, &wal_mutex);
+	}
+	pthread_mutex_unlock(&wal_mutex);
+}
+
+int64_t wal_tail_lsn(){
+	int64_t lsn;
+	pthread_mutex_lock(&wal_mutex);
+	lsn = wal_next_lsn;
+	pthread_mutex_unlock(&wal_mutex);
+	return lsn;
+}
+
+/* Appends rec (rec->size bytes, checksum already set)
+ * and returns its LSN.  If last_lsn is given, it is set
+ * to the new LSN while the log is still locked.
+ */
+int64_t wal_append(wal_record * rec, int64_t * last_lsn){
+	int64_t lsn;
+
+	pthread_mutex_lock(&wal_mutex);
+	while(wal_active_len + rec->size > WAL_BUFFER_SIZE){ // 버퍼가 찼으면 플러셔가 비워줄 때까지
+		if(wal_flush_request < wal_next_lsn)
+			wal_flush_request = wal_next_lsn;
+		pthread_cond_signal(&wal_flush_cond);
+		pthread_cond_wait(&wal_done_cond, &wal_mutex);
+	}
+	lsn = wal_next_lsn;
+	rec->lsn = lsn;
+	memcpy(wal_active + wal_active_len, rec, rec->size);
+	wal_active_len += rec->size;
+	wal_next_lsn += rec->size;
+	if(last_lsn != NULL)
+		*last_lsn = lsn;
+	if(wal_next_lsn - wal_checkpoint_lsn > checkpoint_log_bytes)
+		pthread_cond_signal(&wal_checkpoint_cond);
+	pthread_mutex_unlock(&wal_mutex);
+
+	return lsn;
+}
+
+void wal_op_free(void * arg){
+	wal_op * op = (wal_op*)arg;
+
+	free(op->snapshots);
+	free(op);
+}
+
+void wal_op_key_create(){
+	pthread_key_create(&wal_op_key, wal_op_free);
+}
+
+// 이 스레드의 operation 상태
+wal_op * wal_current(){
+	wal_op * op;
+
+	pthread_once(&wal_op_once, wal_op_key_create);
+	op = (wal_op*)pthread_getspecific(wal_op_key);
+	if(op == NULL){
+		op = (wal_op*)calloc(1, sizeof(wal_op));
+		if(op == NULL || pthread_setspecific(wal_op_key, op) != 0){
+			perror("Log operation state.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return op;
+}
+
+void tx_free(void * arg){
+	transaction * tx = (transaction*)arg;
+
+	free(tx->undo);
+	free(tx);
+}
+
+void tx_key_create(){
+	pthread_key_create(&tx_key, tx_free);
+}
+
+// 이 스레드의 트랜잭션 상태
+transaction * tx_current(){
+	transaction * tx;
+
+	pthread_once(&tx_once, tx_key_create);
+	tx = (transaction*)pthread_getspecific(tx_key);
+	if(tx == NULL){
+		tx = (transaction*)calloc(1, sizeof(transaction));
+		if(tx == NULL || pthread_setspecific(tx_key, tx) != 0){
+			perror("Transaction state.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return tx;
+}
+
+/* Appends a record of the current transaction.  first_lsn
+ * is set before the first record goes in, to a bound that
+ * a checkpoint taken meanwhile will not discard.
+ */
+int64_t wal_append_tx(wal_record * rec, int type, int size){
+	transaction * tx = tx_current();
+
+	if(tx->first_lsn == 0){
+		pthread_mutex_lock(&wal_mutex);
+		tx->first_lsn = wal_next_lsn;
+		pthread_mutex_unlock(&wal_mutex);
+	}
+	rec->prev_lsn = tx->last_lsn;
+	rec->op_id = tx->tx_id;
+	rec->type = type;
+	rec->size = size;
+	rec->checksum = wal_checksum(rec);
+	return wal_append(rec, &tx->last_lsn);
+}
+
+/* Appends a record of the current operation. */
+int64_t wal_append_op(wal_record * rec, int type, int size){
+	wal_op * op = wal_current();
+
+	rec->prev_lsn = op->last_lsn;
+	rec->op_id = op->op_id;
+	rec->type = type;
+	rec->size = size;
+	rec->checksum = wal_checksum(rec);
+	return wal_append(rec, &op->last_lsn);
+}
+
+/* Starts a logged operation.  BEGIN itself is written with
+ * the first update, so an operation that changes nothing
+ * leaves no trace in the log.
+ */
+void wal_begin(){
+	wal_op * op = wal_current();
+
+	op->first_lsn = 0;
+	op->last_lsn = 0;
+	op->num_snapshots = 0;
+	pthread_mutex_lock(&wal_mutex);
+	op->op_id = wal_next_op_id++;
+	op->prev = NULL;
+	op->next = wal_ops;
+	if(wal_ops != NULL)
+		wal_ops->prev = op;
+	wal_ops = op;
+	pthread_mutex_unlock(&wal_mutex);
+}
+
+/* Ends the current operation and returns the LSN the caller
+ * must wait for (see wal_flush) before reporting success,
+ * or 0 if nothing was logged.
+ */
+int64_t wal_commit(){
+	wal_record rec;
+	wal_op * op = wal_current();
+	int64_t lsn = 0;
+
+	if(op->last_lsn != 0){
+		wal_append_op(&rec, WAL_COMMIT, sizeof(wal_record));
+		lsn = rec.lsn + rec.size;
+	}
+	pthread_mutex_lock(&wal_mutex);
+	if(op->prev != NULL)
+		op->prev->next = op->next;
+	else
+		wal_ops = op->next;
+	if(op->next != NULL)
+		op->next->prev = op->prev;
+	op->op_id = 0;
+	op->first_lsn = op->last_lsn = 0;
+	pthread_mutex_unlock(&wal_mutex);
+	op->num_snapshots = 0;
+	return lsn;
+}
+
+wal_snapshot * wal_find_snapshot(wal_op * op, int64_t page_offset){
+	int i;
+	for(i=0; i < op->num_snapshots; i++)
+		if(op->snapshots[i].page_offset == page_offset)
+			return &op->snapshots[i];
+	return NULL;
+}
+
+/* Remembers the image of a page the first time the
+ * current operation pins it.
+ */
+void wal_snapshot_page(int64_t page_offset, const char * page){
+	wal_op * op = wal_current();
+
+	if(wal_find_snapshot(op, page_offset) != NULL)
+		return;
+	if(op->num_snapshots == op->max_snapshots){
+		op->max_snapshots = op->max_snapshots ? op->max_snapshots * 2 : 16;
+		op->snapshots = (wal_snapshot*)realloc(op->snapshots, sizeof(wal_snapshot) * op->max_snapshots);
+		if(op->snapshots == NULL){
+			perror("Log snapshot array.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	op->snapshots[op->num_snapshots].page_offset = page_offset;
+	memcpy(op->snapshots[op->num_snapshots].image, page, PAGE_SIZE);
+	op->num_snapshots++;
+}
+
+/* Logs what changed in a page since its snapshot and
+ * returns the LSN just past the update, which the log must
+ * reach before the page may be written, or 0 if nothing
+ * changed.
+ */
+int64_t wal_log_page(int64_t page_offset, const char * page){
+	int first, last, length;
+	wal_record begin;
+	wal_update * rec;
+	char buf[sizeof(wal_update) + 2*PAGE_SIZE];
+	wal_op * op = wal_current();
+	wal_snapshot * s = wal_find_snapshot(op, page_offset);
+
+	for(first = 0; first < PAGE_SIZE && s->image[first] == page[first]; first++) ;
+	if(first == PAGE_SIZE)
+		return 0;
+	for(last = PAGE_SIZE - 1; s->image[last] == page[last]; last--) ;
+	length = last - first + 1;
+
+	if(op->last_lsn == 0){
+		wal_append_op(&begin, WAL_BEGIN, sizeof(wal_record));
+		pthread_mutex_lock(&wal_mutex);
+		op->first_lsn = begin.lsn;
+		pthread_mutex_unlock(&wal_mutex);
+	}
+
+	rec = (wal_update*)buf;
+	rec->page_offset = page_offset;
+	rec->offset = first;
+	rec->length = length;
+	memcpy(buf + sizeof(wal_update), s->image + first, length);
+	memcpy(buf + sizeof(wal_update) + length, page + first, length);
+	wal_append_op(&rec->rec, WAL_UPDATE, sizeof(wal_update) + 2*length);
+
+	memcpy(s->image + first, page + first, length);
+	return rec->rec.lsn + rec->rec.size;
+}
+
+/* Writes the master record and makes it durable. */
+int wal_write_master(int64_t checkpoint_lsn){
+	wal_file_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = WAL_MAGIC;
+	header.checkpoint_lsn = checkpoint_lsn;
+	if(pwrite(log_fd, &header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE || fdatasync(log_fd) != 0)
+		return -1;
+	return 0;
+}
+
+int wal_open(char * pathname){
+	char log_path[1024];
+
+	snprintf(log_path, sizeof(log_path), "%s.wal", pathname);
+	if((log_fd = open(log_path, O_RDWR | O_CREAT, 0777)) < 0)
+		return -1;
+	return 0;
+}
+
+/* Empties the log and starts the flusher.  Called once the
+ * data file holds everything the old log described.
+ */
+int wal_reset(){
+	if(ftruncate(log_fd, 0) != 0 || wal_write_master(0) != 0)
+		return -1;
+
+	wal_active = (char*)malloc(WAL_BUFFER_SIZE);
+	wal_flushing = (char*)malloc(WAL_BUFFER_SIZE);
+	if(wal_active == NULL || wal_flushing == NULL){
+		perror("Log buffer creation.");
+		exit(EXIT_FAILURE);
+	}
+	wal_active_len = 0;
+	wal_active_lsn = wal_next_lsn = wal_flushed_lsn = WAL_HEADER_SIZE;
+	wal_flush_request = 0;
+	wal_checkpoint_lsn = 0;
+	wal_discarded_lsn = WAL_HEADER_SIZE;
+	wal_running = 1;
+	pthread_create(&wal_flusher, NULL, wal_flusher_main, NULL);
+	return 0;
+}
+
+/* Stops the flusher after it has written everything.
+ * The caller must have stopped the checkpointer, written
+ * back every dirty page and synced the data file;
+ * the log is then emptied.
+ */
+void wal_close(){
+	pthread_mutex_lock(&wal_mutex);
+	wal_running = 0;
+	wal_flush_request = wal_next_lsn;
+	pthread_cond_signal(&wal_flush_cond);
+	pthread_mutex_unlock(&wal_mutex);
+	pthread_join(wal_flusher, NULL);
+
+	if(ftruncate(log_fd, 0) != 0 || wal_write_master(0) != 0)
+		perror("Log truncation.");
+	close(log_fd);
+	log_fd = -1;
+	free(wal_active);
+	free(wal_flushing);
+	wal_active = wal_flushing = NULL;
+}
+
+
+/* Page I/O.
+ * The buffer pool reads and writes the data file through
+ * an I/O backend, chosen with io_backend_type before
+ * open_db.  IO_PREAD blocks in one pread or pwrite per
+ * page.  IO_URING puts a whole batch of requests on an
+ * io_uring and waits for all of them with a single
+ * io_uring_enter, so that a batch of misses (or the
+ * checkpointer's write back) costs one round trip to the
+ * device instead of one per page.  Every thread gets its
+ * own ring the first time it does I/O, so threads never
+ * wait for each other's batches.  The rings are driven
+ * through the raw system calls; if the kernel refuses to
+ * set one up, open_db falls back to IO_PREAD.
+ */
+#define DEFAULT_IO_QUEUE_DEPTH 64
+
+enum io_opcode { IO_READ, IO_WRITE };
+
+typedef struct io_request {
+	int opcode;
+	int64_t offset;
+	char * buf;
+	int length;
+	int result; // 처리된 바이트 수, 실패하면 -errno
+} io_request;
+
+typedef struct io_backend {
+	const char * name;
+	int (*init)(int queue_depth);
+	void (*submit)(io_request * reqs, int n); // n개가 모두 끝나야 돌아온다
+	void (*close)();
+} io_backend;
+
+int io_pread_init(int queue_depth){
+	(void)queue_depth;
+	return 0;
+}
+
+void io_pread_submit(io_request * reqs, int n){
+	int i;
+	for(i=0; i<n; i++){
+		if(reqs[i].opcode == IO_READ)
+			reqs[i].result = pread(fd, reqs[i].buf, reqs[i].length, reqs[i].offset);
+		else
+			reqs[i].result = pwrite(fd, reqs[i].buf, reqs[i].length, reqs[i].offset);
+		if(reqs[i].result < 0)
+			reqs[i].result = -errno;
+	}
+}
+
+void io_pread_close(){
+}
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+/* 링은 스레드마다 하나씩이라 제출과 회수에 잠금이 없다.
+ * io_mutex는 닫을 때 모두 찾을 수 있게 모아둔 목록만 지킨다. */
+typedef struct io_ring {
+	int fd; // -1이면 닫혀 있다, 다음 제출 때 다시 연다
+	unsigned int entries;
+	char * sq_ring, * cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe * sqes;
+	unsigned int * sq_head, * sq_tail, * sq_mask, * sq_array;
+	unsigned int * cq_head, * cq_tail, * cq_mask;
+	struct io_uring_cqe * cqes;
+	struct io_ring * next;
+} io_ring;
+
+pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+io_ring * io_rings = NULL;
+int io_ring_depth;
+pthread_key_t io_ring_key;
+pthread_once_t io_ring_once = PTHREAD_ONCE_INIT;
+
+int io_ring_setup(io_ring * r, int queue_depth){
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = (int)syscall(__NR_io_uring_setup, queue_depth, &p);
+	if(r->fd < 0){
+		r->fd = -1;
+		return -1;
+	}
+	r->entries = p.sq_entries;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP){ // SQ와 CQ가 한 매핑을 나눠쓴다
+		if(r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+	r->cq_ring = NULL;
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_ring == MAP_FAILED)
+		goto fail;
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else{
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED)
+		goto fail;
+
+	r->sq_head = (unsigned int*)(r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned int*)(r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int*)(r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int*)(r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int*)(r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int*)(r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int*)(r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(r->cq_ring + p.cq_off.cqes);
+	return 0;
+
+fail:
+	if(r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if(r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	r->fd = -1;
+	return -1;
+}
+
+void io_ring_unmap(io_ring * r){
+	munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if(r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	r->fd = -1;
+}
+
+// 스레드가 끝나면 그 링을 닫고 목록에서 뺀다
+void io_ring_free(void * arg){
+	io_ring * r = (io_ring*)arg, ** p;
+
+	pthread_mutex_lock(&io_mutex);
+	for(p = &io_rings; *p != r; p = &(*p)->next) ;
+	*p = r->next;
+	if(r->fd != -1)
+		io_ring_unmap(r);
+	pthread_mutex_unlock(&io_mutex);
+	free(r);
+}
+
+void io_ring_key_create(){
+	pthread_key_create(&io_ring_key, io_ring_free);
+}
+
+// 이 스레드의 링, 만들 수 없으면 NULL
+io_ring * io_ring_current(){
+	io_ring * r;
+
+	pthread_once(&io_ring_once, io_ring_key_create);
+	r = (io_ring*)pthread_getspecific(io_ring_key);
+	if(r == NULL){
+		r = (io_ring*)calloc(1, sizeof(io_ring));
+		if(r == NULL || pthread_setspecific(io_ring_key, r) != 0){
+			perror("I/O ring.");
+			exit(EXIT_FAILURE);
+		}
+		r->fd = -1;
+		pthread_mutex_lock(&io_mutex);
+		r->next = io_rings;
+		io_rings = r;
+		pthread_mutex_unlock(&io_mutex);
+	}
+	if(r->fd == -1 && io_ring_setup(r, io_ring_depth) != 0)
+		return NULL;
+	return r;
+}
+
+// open_db를 부른 스레드의 링을 만들어 io_uring을 쓸 수 있는지 본다
+int io_ring_init(int queue_depth){
+	io_ring_depth = queue_depth;
+	return io_ring_current() == NULL ? -1 : 0;
+}
+
+void io_ring_submit(io_request * reqs, int n){
+	int i, done, batch, ret;
+	unsigned int tail, head, idx;
+	struct io_uring_sqe * sqe;
+	struct io_uring_cqe * cqe;
+	io_ring * r = io_ring_current();
+
+	if(r == NULL){ // 이 스레드에는 링을 만들 수 없었다
+		io_pread_submit(reqs, n);
+		return;
+	}
+	for(done = 0; done < n; done += batch){
+		batch = n - done < (int)r->entries ? n - done : (int)r->entries;
+
+		tail = *r->sq_tail;
+		for(i=0; i<batch; i++){
+			idx = tail & *r->sq_mask;
+			sqe = &r->sqes[idx];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = reqs[done+i].opcode == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+			sqe->fd = fd;
+			sqe->off = reqs[done+i].offset;
+			sqe->addr = (unsigned long)reqs[done+i].buf;
+			sqe->len = reqs[done+i].length;
+			sqe->user_data = done + i;
+			r->sq_array[idx] = idx;
+			tail++;
+		}
+		__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+		do
+			ret = (int)syscall(__NR_io_uring_enter, r->fd, batch, batch, IORING_ENTER_GETEVENTS, NULL, 0);
+		while(ret < 0 && errno == EINTR);
+		if(ret < 0){
+			perror("io_uring_enter.");
+			exit(EXIT_FAILURE);
+		}
+
+		// 제출한 만큼 완료될 때까지 회수한다
+		for(i=0; i<batch; ){
+			head = *r->cq_head;
+			if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)){
+				syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+				continue;
+			}
+			cqe = &r->cqes[head & *r->cq_mask];
+			reqs[cqe->user_data].result = cqe->res;
+			__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+			i++;
+		}
+	}
+}
+
+// 모든 스레드의 링을 닫는다, 구조체는 스레드가 끝날 때까지 남는다
+void io_ring_close(){
+	io_ring * r;
+
+	pthread_mutex_lock(&io_mutex);
+	for(r = io_rings; r != NULL; r = r->next)
+		if(r->fd != -1)
+			io_ring_unmap(r);
+	pthread_mutex_unlock(&io_mutex);
+}
+#else
+int io_ring_init(int queue_depth){
+	return -1;
+}
+void io_ring_submit(io_request * reqs, int n){
+}
+void io_ring_close(){
+}
+#endif
+
+io_backend io_backends[] = {
+	{ "pread", io_pread_init, io_pread_submit, io_pread_close },
+	{ "io_uring", io_ring_init, io_ring_submit, io_ring_close },
+};
+
+int io_backend_type = IO_PREAD; // open_db 전에 고른다
+int io_queue_depth = DEFAULT_IO_QUEUE_DEPTH;
+io_backend * io = NULL;
+
+void io_open(){
+	io = &io_backends[io_backend_type];
+	if(io->init(io_queue_depth) != 0){
+		fprintf(stderr, "I/O backend %s is not available, using pread.\n", io->name);
+		io = &io_backends[IO_PREAD];
+		io->init(io_queue_depth);
+	}
+}
+
+void io_close(){
+	io->close();
+	io = NULL;
+}
+
+/* Runs n requests and stops the program if one fails.
+ * A short read is finished with pread; only what lies past
+ * the end of the file is filled with zeros.
+ */
+void io_run(io_request * reqs, int n){
+	int i, done;
+	ssize_t ret;
+
+	io->submit(reqs, n);
+	for(i=0; i<n; i++){
+		if(reqs[i].result < 0 || (reqs[i].opcode == IO_WRITE && reqs[i].result != reqs[i].length)){
+			errno = reqs[i].result < 0 ? -reqs[i].result : EIO;
+			perror(reqs[i].opcode == IO_READ ? "Page read." : "Page write.");
+			exit(EXIT_FAILURE);
+		}
+		for(done = reqs[i].result; done < reqs[i].length; done += ret){
+			ret = pread(fd, reqs[i].buf + done, reqs[i].length - done, reqs[i].offset + done);
+			if(ret < 0 && errno == EINTR)
+				ret = 0;
+			else if(ret < 0){
+				perror("Page read.");
+				exit(EXIT_FAILURE);
+			}
+			else if(ret == 0){ // 파일 끝
+				memset(reqs[i].buf + done, 0, reqs[i].length - done);
+				break;
+			}
+		}
+	}
+}
+
+void io_page(int opcode, int64_t offset, char * page){
+	io_request req;
+
+	req.opcode = opcode;
+	req.offset = offset;
+	req.buf = page;
+	req.length = PAGE_SIZE;
+	io_run(&req, 1);
+}
+
+/* Buffer pool.
+ * Pages of the data file are cached in fixed 4096-byte
+ * frames.  A frame is found through the page table
+ * (a chained hash on the page offset), pinned while it
+ * is in use, and marked dirty when it was modified.
+ * Dirty frames are written back only when they are
+ * evicted (clock replacement), by the checkpointer or
+ * on buf_flush_all, so a hot root-to-leaf path costs
+ * no system call.
+ *
+ * The pool is split into buf_num_partitions partitions by
+ * page number.  Frame i only ever holds pages of partition
+ * i % buf_num_partitions and every chain of the page table
+ * lies in one partition, so a partition's mutex protects
+ * its chains and the headers of its frames, and each runs
+ * its own clock.  Threads that touch different pages
+ * rarely meet on a mutex.  The page image belongs to
+ * whoever has it pinned.  A pin is taken under the
+ * partition's mutex, so a frame seen unpinned there stays
+ * unpinned, but pin_count is atomic and put_page lets go
+ * of a pin without the mutex: the frame of a pinned page
+ * cannot move, so buf_pinned_frame finds it by walking the
+ * chain without a lock.
+ *
+ * No file I/O happens under a partition's mutex.
+ * A miss enters its frame in the page table pinned and
+ * marked busy and reads the page after letting go of the
+ * mutex.  A victim that has to be written first (dirty,
+ * or a leaf going to the cold file) is marked busy the
+ * same way and stays in the page table until the log is
+ * flushed and the page is written or compressed, so that
+ * nobody reads its old image from the file meanwhile.
+ * Threads that want a busy page wait on the partition's
+ * busy_cond; everybody else goes on.
+ *
+ * With storage_mode = STORAGE_MMAP the frames are not a
+ * cache but the pages of a private mapping of the whole
+ * file: a frame is found by its page number, nothing is
+ * ever evicted, and a miss is a page fault instead of a
+ * read.  The mapping reserves mmap_reserve bytes of
+ * address space up front, so growing the file (ftruncate,
+ * MMAP_CHUNK at a time) never moves a page, and reads
+ * (get_page_read) use the mapping directly, without a pin.
+ * The frame headers are kept in a reserved anonymous
+ * mapping of their own, so they do not move either.
+ * Changes stay in the process (copy on write) until they
+ * are written back with pwrite like any dirty frame,
+ * after the log; a shared mapping would let the kernel
+ * write a page before its log record.
+ */
+#define DEFAULT_BUFFER_FRAMES 1024
+#define MMAP_CHUNK (16 * 1024 * 1024)
+#define DEFAULT_MMAP_RESERVE (64LL * 1024 * 1024 * 1024)
+#define BUF_PARTITIONS 16
+#define BUF_PARTITION_FRAMES 32 // 파티션 하나의 최소 프레임 수
+
+typedef struct buffer_frame {
+	char * page;
+	int64_t offset; // 캐시된 페이지의 오프셋, -1이면 비어있는 프레임
+	int pin_count; // 파티션 mutex 아래에서만 늘고, 줄이는 것은 atomic
+	int is_dirty;
+	int ref_bit; // clock 교체 정책용
+	int busy; // 파일과 오가는 중, 다른 스레드는 끝날 때까지 기다린다
+	int64_t page_lsn; // 이 페이지를 마지막으로 바꾼 로그 레코드의 끝, 핀을 놓을 때 atomic으로 올린다
+	int64_t rec_lsn; // 깨끗한 상태에서 처음 더럽혀진 시점의 로그 끝
+	struct buffer_frame * next; // page table 체인
+} buffer_frame;
+
+typedef struct buf_partition {
+	pthread_mutex_t mutex; // 락 순서: 파티션 mutex -> wal_mutex, cold_mutex
+	pthread_cond_t busy_cond; // 읽기나 내보내기가 끝난 프레임이 있다
+	int clock_hand; // 이 파티션 프레임들 사이의 순번
+} __attribute__((aligned(64))) buf_partition; // 한 캐시 라인씩
+
+int buffer_frames = DEFAULT_BUFFER_FRAMES; // open_db 전에 바꾸면 pool 크기 조절 가능
+int storage_mode = STORAGE_BUFFERED; // open_db 전에 고른다
+int64_t mmap_reserve = DEFAULT_MMAP_RESERVE;
+buffer_frame * frames = NULL;
+int frame_count = 0; // 사용 중인 프레임 수, STORAGE_MMAP에서는 늘어난다
+char * frame_pages = NULL; // STORAGE_BUFFERED: 프레임 이미지들, STORAGE_MMAP: 매핑
+int64_t mapped_size = 0; // STORAGE_MMAP: 지금 파일 크기
+buffer_frame ** page_table = NULL;
+int page_table_size = 0; // buf_num_partitions의 배수
+buf_partition buf_partitions[BUF_PARTITIONS] = { [0 ... BUF_PARTITIONS - 1] = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 } };
+int buf_num_partitions = 1;
+pthread_mutex_t mmap_grow_mutex = PTHREAD_MUTEX_INITIALIZER; // STORAGE_MMAP: 파일을 늘리는 스레드는 하나씩
+
+/* Compressed leaves.
+ * With leaf_compression set before open_db, a leaf that
+ * leaves the pool unchanged since it was last written
+ * (a cold one: a leaf that is still being written leaves
+ * dirty) is compressed and appended to <db>.cold, and
+ * its slot in the data file is given back.  The bulk
+ * loader writes its leaves there directly.
+ * The codec is a small LZ77 with LZ4's sequence format
+ * (a token of literal and match length nibbles, the
+ * literals, a 2-byte distance), which squeezes the free
+ * space and the repeated key and value bytes of a leaf.
+ * The page keeps its offset, so nothing in the tree
+ * changes: cold_map says which pages have their current
+ * image in the cold file and where, and a miss on such a
+ * page reads just the compressed bytes and expands them
+ * into the frame.  A cold page that changes again is
+ * written back in place as before and leaves the map.
+ *
+ * The map becomes durable in cold_checkpoint, which every
+ * checkpoint runs before it writes its master record: the
+ * cold file is synced and <db>.cmap replaced.  Only then
+ * are the slots of the pages it lists punched out of the
+ * data file, and the images nobody refers to any more out
+ * of the cold file, so after a crash the last map still
+ * leads to images that exist and the log redoes the rest.
+ * STORAGE_MMAP maps the slots themselves, so a file with
+ * cold pages cannot be opened that way.
+ */
+#define COLD_MAGIC 0x444c4f4342505444LL
+#define COLD_HEADER_SIZE 16 // cold 파일 맨 앞, 그래서 오프셋 0은 "제자리"
+#define COLD_MIN_SAVING (PAGE_SIZE / 8) // 이만큼 줄지 않으면 제자리에 쓴다
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+typedef struct cold_image { // cold 파일의 압축 이미지 머리
+	int64_t page_offset;
+	int32_t length; // 뒤따르는 압축 바이트
+	uint32_t checksum;
+} cold_image;
+
+typedef struct cold_entry {
+	int64_t offset; // cold 파일 안의 이미지, 0이면 제자리에 있다
+	int32_t length; // 머리를 포함한 이미지 크기
+	char punched; // 데이터 파일의 자리를 뚫었다
+	char writing; // 제자리 쓰기가 진행 중, 끝나면 map에서 빠진다
+	char reserved[2];
+} cold_entry;
+
+typedef struct cold_map_header { // <db>.cmap
+	int64_t magic;
+	int64_t num_entries;
+	int64_t cold_end;
+	uint32_t checksum; // 뒤따르는 항목들의
+	uint32_t reserved;
+} cold_map_header;
+
+typedef struct cold_map_record {
+	int64_t page_offset;
+	int64_t offset;
+	int64_t length;
+} cold_map_record;
+
+int leaf_compression = 0; // open_db 전에 켜면 내보내는 leaf를 압축한다
+int cold_active = 0; // leaf_compression이고 STORAGE_BUFFERED
+int cold_fd = -1;
+char cold_path[1024];
+char cold_map_path[1024];
+cold_entry * cold_map = NULL; // 페이지 번호로 찾는다
+int64_t cold_map_size = 0;
+int64_t cold_pages = 0; // cold 파일에 이미지가 있는 페이지 수
+int64_t cold_end = COLD_HEADER_SIZE; // 다음 이미지를 붙일 곳
+int cold_changed = 0; // 마지막 cmap 뒤로 map이 바뀌었다
+int64_t * cold_dead = NULL; // 버려진 이미지들 (오프셋, 길이), 다음 cmap 뒤에 뚫는다
+int cold_num_dead = 0;
+int cold_max_dead = 0;
+pthread_mutex_t cold_mutex = PTHREAD_MUTEX_INITIALIZER; // 락 순서: 파티션 mutex -> cold_mutex
+pthread_mutex_t cold_sync_mutex = PTHREAD_MUTEX_INITIALIZER; // cold_checkpoint 하나씩
+
+unsigned int lz_hash(const unsigned char * p){
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// 15 이상인 길이는 나머지를 255씩 끊어 덧붙인다
+unsigned char * lz_put_length(unsigned char * op, int length){
+	for(; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = length;
+	return op;
+}
+
+/* Compresses n bytes into out and returns the compressed
+ * length, or -1 if it would take more than limit bytes.
+ */
+int lz_compress(const unsigned char * in, int n, unsigned char * out, int limit){
+	int table[1 << LZ_HASH_BITS];
+	int i = 0, anchor = 0, match, length, literals;
+	unsigned char * op = out, * token;
+	unsigned int h;
+
+	for(h = 0; h < (1 << LZ_HASH_BITS); h++)
+		table[h] = -1;
+	while(i + LZ_MIN_MATCH <= n){
+		h = lz_hash(in + i);
+		match = table[h];
+		table[h] = i;
+		if(match < 0 || i - match > 0xFFFF || memcmp(in + match, in + i, LZ_MIN_MATCH) != 0){
+			i++;
+			continue;
+		}
+		length = LZ_MIN_MATCH;
+		while(i + length < n && in[match + length] == in[i + length])
+			length++;
+		literals = i - anchor;
+		if((op - out) + 1 + literals/255 + 1 + literals + 2 + (length - LZ_MIN_MATCH)/255 + 1 > limit)
+			return -1;
+		token = op++;
+		*token = (literals < 15 ? literals : 15) << 4;
+		if(literals >= 15)
+			op = lz_put_length(op, literals - 15);
+		memcpy(op, in + anchor, literals);
+		op += literals;
+		*op++ = (i - match) & 0xFF;
+		*op++ = (i - match) >> 8;
+		*token |= length - LZ_MIN_MATCH < 15 ? length - LZ_MIN_MATCH : 15;
+		if(length - LZ_MIN_MATCH >= 15)
+			op = lz_put_length(op, length - LZ_MIN_MATCH - 15);
+		i += length;
+		anchor = i;
+	}
+	// 마지막 시퀀스는 literal뿐
+	literals = n - anchor;
+	if((op - out) + 1 + literals/255 + 1 + literals > limit)
+		return -1;
+	token = op++;
+	*token = (literals < 15 ? literals : 15) << 4;
+	if(literals >= 15)
+		op = lz_put_length(op, literals - 15);
+	memcpy(op, in + anchor, literals);
+	op += literals;
+	return op - out;
+}
+
+/* Expands n compressed bytes into at most size bytes of
+ * out and returns the expanded length, or -1 if the input
+ * is malformed.
+ */
+int lz_expand(const unsigned char * in, int n, unsigned char * out, int size){
+	const unsigned char * ip = in, * end = in + n;
+	unsigned char * op = out;
+	int token, literals, length, distance;
+
+	while(ip < end){
+		token = *ip++;
+		literals = token >> 4;
+		if(literals == 15)
+			do{
+				if(ip == end) return -1;
+				literals += *ip;
+			}while(*ip++ == 255);
+		if(literals > end - ip || literals > size - (op - out))
+			return -1;
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if(ip == end)
+			break;
+		if(end - ip < 2)
+			return -1;
+		distance = ip[0] | ip[1] << 8;
+		ip += 2;
+		length = token & 15;
+		if(length == 15)
+			do{
+				if(ip == end) return -1;
+				length += *ip;
+			}while(*ip++ == 255);
+		length += LZ_MIN_MATCH;
+		if(distance == 0 || distance > op - out || length > size - (op - out))
+			return -1;
+		if(distance >= length)
+			memcpy(op, op - distance, length);
+		else // 겹치면 앞에서부터 한 바이트씩
+			for(; length > 0; length--, op++)
+				*op = op[-distance];
+		op += length;
+	}
+	return op - out;
+}
+
+// FNV-1a, 8바이트씩
+uint32_t cold_checksum(const char * data, int64_t n, int64_t seed){
+	uint64_t h = 14695981039346656037ULL ^ (uint64_t)seed, w;
+	int64_t i;
+
+	for(i=0; i + 8 <= n; i += 8){
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 1099511628211ULL;
+	}
+	for(; i<n; i++)
+		h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+// cold_mutex를 쥐고 부른다
+cold_entry * cold_lookup(int64_t offset){
+	int64_t n = offset / PAGE_SIZE;
+	return n < cold_map_size && cold_map[n].offset != 0 ? &cold_map[n] : NULL;
+}
+
+// cold_mutex를 쥐고 부른다
+cold_entry * cold_entry_at(int64_t offset){
+	int64_t n = offset / PAGE_SIZE, size = cold_map_size;
+
+	if(n >= size){
+		while(size <= n)
+			size = size ? size * 2 : 1024;
+		cold_map = (cold_entry*)realloc(cold_map, sizeof(cold_entry) * size);
+		if(cold_map == NULL){
+			perror("Cold page map.");
+			exit(EXIT_FAILURE);
+		}
+		memset(cold_map + cold_map_size, 0, sizeof(cold_entry) * (size - cold_map_size));
+		cold_map_size = size;
+	}
+	return &cold_map[n];
+}
+
+// 이미지를 버린다. cold_mutex를 쥐고 부른다
+void cold_discard(int64_t offset, int64_t length){
+	if(cold_num_dead == cold_max_dead){
+		cold_max_dead = cold_max_dead ? cold_max_dead * 2 : 64;
+		cold_dead = (int64_t*)realloc(cold_dead, sizeof(int64_t) * 2 * cold_max_dead);
+		if(cold_dead == NULL){
+			perror("Cold page map.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	cold_dead[2*cold_num_dead] = offset;
+	cold_dead[2*cold_num_dead + 1] = length;
+	cold_num_dead++;
+	cold_changed = 1;
+}
+
+int cold_contains(int64_t offset){
+	int ret;
+
+	pthread_mutex_lock(&cold_mutex);
+	ret = cold_lookup(offset) != NULL;
+	pthread_mutex_unlock(&cold_mutex);
+	return ret;
+}
+
+/* Compresses the page at offset into the cold file.
+ * Returns 0 if its image is there now, -1 if it is not a
+ * leaf or does not shrink enough and has to be written in
+ * place.
+ */
+int cold_write(int64_t offset, const char * page){
+	char buf[PAGE_SIZE];
+	cold_image * image = (cold_image*)buf;
+	cold_entry * e;
+	int length;
+	int64_t at;
+
+	if(!cold_active || offset == 0 || ((const node_page*)page)->is_leaf != 1)
+		return -1;
+	length = lz_compress((const unsigned char*)page, PAGE_SIZE, (unsigned char*)(image + 1),
+			PAGE_SIZE - COLD_MIN_SAVING - sizeof(cold_image));
+	if(length < 0)
+		return -1;
+	image->page_offset = offset;
+	image->length = length;
+	image->checksum = cold_checksum((char*)(image + 1), length, offset);
+	length += sizeof(cold_image);
+
+	pthread_mutex_lock(&cold_mutex);
+	at = cold_end;
+	cold_end += length;
+	pthread_mutex_unlock(&cold_mutex);
+	if(pwrite(cold_fd, buf, length, at) != length){
+		perror("Cold page write.");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&cold_mutex);
+	e = cold_entry_at(offset);
+	if(e->offset != 0)
+		cold_discard(e->offset, e->length);
+	else{
+		cold_pages++;
+		e->punched = 0;
+	}
+	e->offset = at;
+	e->length = length;
+	e->writing = 0;
+	cold_changed = 1;
+	pthread_mutex_unlock(&cold_mutex);
+	return 0;
+}
+
+/* Reads the page at offset from the cold file into page.
+ * Returns -1 if its image is in place in the data file.
+ */
+int cold_read(int64_t offset, char * page){
+	char buf[PAGE_SIZE];
+	cold_image * image = (cold_image*)buf;
+	cold_entry * e;
+	int length = 0;
+	int64_t at = 0;
+
+	pthread_mutex_lock(&cold_mutex);
+	if((e = cold_lookup(offset)) != NULL){
+		at = e->offset;
+		length = e->length;
+	}
+	pthread_mutex_unlock(&cold_mutex);
+	if(at == 0)
+		return -1;
+	if(pread(cold_fd, buf, length, at) != length || image->page_offset != offset ||
+			image->length != length - (int)sizeof(cold_image) ||
+			image->checksum != cold_checksum((char*)(image + 1), image->length, offset) ||
+			lz_expand((unsigned char*)(image + 1), image->length, (unsigned char*)page, PAGE_SIZE) != PAGE_SIZE){
+		fprintf(stderr, "Cold page %" PRId64 " is corrupt.\n", offset);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+/* A page about to be written in place stays in the map,
+ * marked, until cold_forget after the write: the last cmap
+ * may still send recovery to its cold image, and its slot
+ * must not be punched under the write.
+ */
+void cold_begin_write(int64_t offset){
+	cold_entry * e;
+
+	pthread_mutex_lock(&cold_mutex);
+	if((e = cold_lookup(offset)) != NULL)
+		e->writing = 1;
+	pthread_mutex_unlock(&cold_mutex);
+}
+
+// 제자리에 쓴 페이지를 map에서 뺀다
+void cold_forget(int64_t offset){
+	cold_entry * e;
+
+	pthread_mutex_lock(&cold_mutex);
+	if((e = cold_lookup(offset)) != NULL){
+		cold_discard(e->offset, e->length);
+		memset(e, 0, sizeof(cold_entry));
+		cold_pages--;
+	}
+	pthread_mutex_unlock(&cold_mutex);
+}
+
+int cold_compare_extents(const void * x, const void * y){
+	int64_t a = ((const int64_t*)x)[0], c = ((const int64_t*)y)[0];
+	return a < c ? -1 : a > c;
+}
+
+/* Makes the map durable, then punches out what it made
+ * unnecessary: the slots of the cold pages in the data
+ * file and the images no longer in the map.  Every image
+ * in the copy was written before it was entered, so one
+ * sync of the cold file covers them all.
+ */
+void cold_checkpoint(){
+	int out, num_dead;
+	int64_t i, j, n = 0, num_punch = 0, size, * dead, * punch;
+	char tmp_path[1040];
+	cold_map_header * header;
+	cold_map_record * records;
+	cold_entry * e;
+
+	if(cold_fd < 0)
+		return;
+	pthread_mutex_lock(&cold_sync_mutex);
+	pthread_mutex_lock(&cold_mutex);
+	if(!cold_changed){
+		pthread_mutex_unlock(&cold_mutex);
+		pthread_mutex_unlock(&cold_sync_mutex);
+		return;
+	}
+	size = sizeof(cold_map_header) + sizeof(cold_map_record) * cold_pages;
+	header = (cold_map_header*)malloc(size);
+	punch = (int64_t*)malloc(sizeof(int64_t) * (cold_pages + 1));
+	if(header == NULL || punch == NULL){
+		perror("Cold page map.");
+		exit(EXIT_FAILURE);
+	}
+	records = (cold_map_record*)(header + 1);
+	for(i=0; i < cold_map_size; i++){
+		if(cold_map[i].offset == 0)
+			continue;
+		records[n].page_offset = i * PAGE_SIZE;
+		records[n].offset = cold_map[i].offset;
+		records[n].length = cold_map[i].length;
+		n++;
+		if(!cold_map[i].punched && !cold_map[i].writing)
+			punch[num_punch++] = i;
+	}
+	header->magic = COLD_MAGIC;
+	header->num_entries = n;
+	header->cold_end = cold_end;
+	header->reserved = 0;
+	dead = cold_dead;
+	num_dead = cold_num_dead;
+	cold_dead = NULL;
+	cold_num_dead = cold_max_dead = 0;
+	cold_changed = 0;
+	pthread_mutex_unlock(&cold_mutex);
+
+	// 이미지가 먼저, 그 다음에 그것을 가리키는 map
+	header->checksum = cold_checksum((char*)records, sizeof(cold_map_record) * n, 0);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cold_map_path);
+	if(fdatasync(cold_fd) != 0 || (out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0777)) < 0){
+		perror("Cold page map.");
+		exit(EXIT_FAILURE);
+	}
+	if(write(out, header, size) != size || fdatasync(out) != 0 || close(out) != 0 ||
+			rename(tmp_path, cold_map_path) != 0){
+		perror("Cold page map.");
+		exit(EXIT_FAILURE);
+	}
+
+	// 이어지는 페이지의 자리는 한 번에 뚫는다
+	for(i=0; i < num_punch; i = j){
+		pthread_mutex_lock(&cold_mutex);
+		for(j=i; j < num_punch && punch[j] == punch[i] + (j - i); j++){
+			e = &cold_map[punch[j]];
+			if(e->offset == 0 || e->punched || e->writing)
+				break;
+			e->punched = 1;
+		}
+		if(j > i)
+			fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, punch[i] * PAGE_SIZE, (j - i) * PAGE_SIZE);
+		else
+			j = i + 1;
+		pthread_mutex_unlock(&cold_mutex);
+	}
+	// 이미지들은 붙어 있으니 이어지는 것끼리 합쳐야 블록이 통째로 빈다
+	qsort(dead, num_dead, 2 * sizeof(int64_t), cold_compare_extents);
+	for(i=0; i < num_dead; i = j){
+		size = dead[2*i] + dead[2*i + 1];
+		for(j=i+1; j < num_dead && dead[2*j] == size; j++)
+			size += dead[2*j + 1];
+		fallocate(cold_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, dead[2*i], size - dead[2*i]);
+	}
+	pthread_mutex_unlock(&cold_sync_mutex);
+
+	free(header);
+	free(punch);
+	free(dead);
+}
+
+/* Opens <db>.cold and loads the map of the last
+ * cold_checkpoint; a new data file (create) starts without
+ * one.  Images appended after that map are dropped.
+ */
+int cold_open(char * pathname, int create){
+	int in;
+	int64_t i, magic[2] = { COLD_MAGIC, 0 };
+	cold_map_header header;
+	cold_map_record * records;
+	cold_entry * e;
+
+	snprintf(cold_path, sizeof(cold_path), "%s.cold", pathname);
+	snprintf(cold_map_path, sizeof(cold_map_path), "%s.cmap", pathname);
+	cold_active = leaf_compression && storage_mode == STORAGE_BUFFERED;
+	cold_pages = 0;
+	cold_end = COLD_HEADER_SIZE;
+	cold_changed = 0;
+	if(create){
+		unlink(cold_map_path);
+		unlink(cold_path);
+	}
+
+	if((in = open(cold_map_path, O_RDONLY)) >= 0){
+		if(read(in, &header, sizeof(header)) != sizeof(header) || header.magic != COLD_MAGIC ||
+				(records = (cold_map_record*)malloc(sizeof(cold_map_record) * (header.num_entries + 1))) == NULL ||
+				read(in, records, sizeof(cold_map_record) * header.num_entries) != (ssize_t)(sizeof(cold_map_record) * header.num_entries) ||
+				header.checksum != cold_checksum((char*)records, sizeof(cold_map_record) * header.num_entries, 0)){
+			fprintf(stderr, "Cold page map %s is corrupt.\n", cold_map_path);
+			exit(EXIT_FAILURE);
+		}
+		close(in);
+		if((cold_fd = open(cold_path, O_RDWR)) < 0){
+			free(records);
+			return -1;
+		}
+		for(i=0; i < header.num_entries; i++){
+			e = cold_entry_at(records[i].page_offset);
+			e->offset = records[i].offset;
+			e->length = records[i].length;
+		}
+		cold_pages = header.num_entries;
+		cold_end = header.cold_end;
+		cold_changed = 1; // 다음 cold_checkpoint가 못 뚫은 자리를 마저 뚫는다
+		free(records);
+		if(ftruncate(cold_fd, cold_end) != 0)
+			perror("Cold file truncation.");
+		if(cold_pages > 0 && storage_mode == STORAGE_MMAP){
+			fprintf(stderr, "%s has compressed leaves and cannot be mapped.\n", pathname);
+			return -1;
+		}
+	}
+	else if(cold_active){
+		if((cold_fd = open(cold_path, O_RDWR | O_CREAT | O_TRUNC, 0777)) < 0 ||
+				pwrite(cold_fd, magic, COLD_HEADER_SIZE, 0) != COLD_HEADER_SIZE)
+			return -1;
+	}
+	return 0;
+}
+
+void cold_close(){
+	if(cold_fd >= 0)
+		close(cold_fd);
+	cold_fd = -1;
+	cold_active = 0;
+	free(cold_map);
+	free(cold_dead);
+	cold_map = NULL;
+	cold_dead = NULL;
+	cold_map_size = cold_pages = 0;
+	cold_num_dead = cold_max_dead = 0;
+}
+
+int buf_hash(int64_t offset){
+	return (int)((offset / PAGE_SIZE) % page_table_size);
+}
+
+buf_partition * buf_partition_of(int64_t offset){
+	return &buf_partitions[(offset / PAGE_SIZE) % buf_num_partitions];
+}
+
+// 파티션 p에 속한 프레임 수, 프레임 p, p + n, p + 2n, ...
+int buf_partition_frames(int p){
+	return (frame_count - p + buf_num_partitions - 1) / buf_num_partitions;
+}
+
+void buf_init_frame(buffer_frame * f, int64_t offset, char * page){
+	f->page = page;
+	f->offset = offset;
+	f->pin_count = 0;
+	f->is_dirty = 0;
+	f->ref_bit = 0;
+	f->busy = 0;
+	f->page_lsn = 0;
+	f->rec_lsn = 0;
+	f->next = NULL;
+}
+
+int buf_init(int num_frames){
+	int i;
+
+	// 파티션마다 희생자를 찾을 만큼의 프레임은 남긴다
+	buf_num_partitions = num_frames / BUF_PARTITION_FRAMES;
+	if(buf_num_partitions < 1)
+		buf_num_partitions = 1;
+	if(buf_num_partitions > BUF_PARTITIONS)
+		buf_num_partitions = BUF_PARTITIONS;
+	frames = (buffer_frame*)malloc(sizeof(buffer_frame) * num_frames);
+	frame_pages = (char*)malloc((size_t)PAGE_SIZE * num_frames);
+	page_table_size = (num_frames * 2 + buf_num_partitions - 1) / buf_num_partitions * buf_num_partitions;
+	page_table = (buffer_frame**)calloc(page_table_size, sizeof(buffer_frame*));
+	if (frames == NULL || frame_pages == NULL || page_table == NULL) {
+		perror("Buffer pool creation.");
+		exit(EXIT_FAILURE);
+	}
+	for(i=0; i<num_frames; i++)
+		buf_init_frame(&frames[i], -1, frame_pages + (size_t)i*PAGE_SIZE);
+	frame_count = num_frames;
+	for(i=0; i < buf_num_partitions; i++)
+		buf_partitions[i].clock_hand = 0;
+	return 0;
+}
+
+/* Grows the file and the frame array until offset is
+ * mapped.  Threads that need it at the same time take
+ * turns on mmap_grow_mutex; the second one finds the file
+ * already grown.
+ */
+void mmap_grow(int64_t offset){
+	int i, old_count;
+	int64_t size;
+
+	pthread_mutex_lock(&mmap_grow_mutex);
+	old_count = frame_count;
+	size = mapped_size;
+	if(size > offset){
+		pthread_mutex_unlock(&mmap_grow_mutex);
+		return;
+	}
+	while(size <= offset)
+		size += MMAP_CHUNK;
+	if(size > mmap_reserve || ftruncate(fd, size) != 0){
+		perror("Mapped file growth.");
+		exit(EXIT_FAILURE);
+	}
+	for(i=old_count; i < size / PAGE_SIZE; i++)
+		buf_init_frame(&frames[i], (int64_t)i*PAGE_SIZE, frame_pages + (int64_t)i*PAGE_SIZE);
+	// 새 프레임을 다 채운 다음에 보인다, 둘 다 잠금 없이 읽힌다
+	__atomic_store_n(&frame_count, (int)(size / PAGE_SIZE), __ATOMIC_RELEASE);
+	__atomic_store_n(&mapped_size, size, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mmap_grow_mutex);
+}
+
+int mmap_init(){
+	struct stat st;
+
+	if(fstat(fd, &st) != 0)
+		return -1;
+	frame_pages = (char*)mmap(NULL, mmap_reserve, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	if(frame_pages == MAP_FAILED){
+		frame_pages = NULL;
+		return -1;
+	}
+	frames = (buffer_frame*)mmap(NULL, mmap_reserve / PAGE_SIZE * sizeof(buffer_frame), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(frames == MAP_FAILED){
+		frames = NULL;
+		munmap(frame_pages, mmap_reserve);
+		frame_pages = NULL;
+		return -1;
+	}
+	buf_num_partitions = BUF_PARTITIONS;
+	frame_count = 0;
+	mapped_size = 0;
+	mmap_grow(st.st_size > 0 ? st.st_size - 1 : 0);
+	return 0;
+}
+
+// 호출하는 쪽이 offset의 파티션 mutex를 쥐고 있다
+buffer_frame * buf_lookup(int64_t offset){
+	buffer_frame * f;
+
+	if(storage_mode == STORAGE_MMAP)
+		return offset < __atomic_load_n(&mapped_size, __ATOMIC_ACQUIRE) ? &frames[offset / PAGE_SIZE] : NULL;
+	f = page_table[buf_hash(offset)];
+	while(f != NULL && f->offset != offset)
+		f = f->next;
+	return f;
+}
+
+void buf_write_back(buffer_frame * f){
+	if(!f->is_dirty) return;
+	wal_flush(f->page_lsn); // WAL: 로그가 먼저 디스크에
+	cold_begin_write(f->offset);
+	io_page(IO_WRITE, f->offset, f->page);
+	cold_forget(f->offset);
+	f->is_dirty = 0;
+	if(storage_mode == STORAGE_MMAP && __atomic_load_n(&f->pin_count, __ATOMIC_ACQUIRE) == 0)
+		madvise(f->page, PAGE_SIZE, MADV_DONTNEED); // 사본을 버리고 파일 페이지로 돌아간다
+}
+
+/* Takes f out of the page table.  A dirty page is written
+ * first, and a leaf that leaves unchanged since it was
+ * last written is compressed into the cold file.  The
+ * caller holds the mutex of f's partition, which is let go
+ * meanwhile; f stays pinned and busy until the write is
+ * done.
+ */
+void buf_evict(buffer_frame * f){
+	buffer_frame ** p;
+	buf_partition * part = buf_partition_of(f->offset);
+	int cold = cold_active && !f->is_dirty && !cold_contains(f->offset);
+
+	if(cold || f->is_dirty){
+		__atomic_add_fetch(&f->pin_count, 1, __ATOMIC_RELAXED);
+		f->busy = 1;
+		pthread_mutex_unlock(&part->mutex);
+		if(cold)
+			cold_write(f->offset, f->page);
+		else{
+			wal_flush(f->page_lsn); // WAL: 로그가 먼저 디스크에
+			cold_begin_write(f->offset);
+			io_page(IO_WRITE, f->offset, f->page);
+			cold_forget(f->offset);
+		}
+		pthread_mutex_lock(&part->mutex);
+		f->is_dirty = 0; // 쓰는 동안에는 checkpoint의 dirty page table에 남아 있었다
+		f->busy = 0;
+		__atomic_sub_fetch(&f->pin_count, 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&part->busy_cond);
+	}
+	p = &page_table[buf_hash(f->offset)];
+	while(*p != f)
+		p = &(*p)->next;
+	__atomic_store_n(p, f->next, __ATOMIC_RELEASE); // buf_pinned_frame이 잠금 없이 따라간다
+	__atomic_store_n(&f->offset, -1, __ATOMIC_RELAXED);
+	__atomic_store_n(&f->next, NULL, __ATOMIC_RELAXED);
+}
+
+/* Clock replacement: 파티션 p의 핀 안 된 프레임 중에서
+ * ref_bit가 꺼진 첫 프레임을 비워서 돌려준다.
+ * 내보내는 동안 파티션 mutex를 놓았다가 다시 잡는다.
+ * 모든 프레임이 핀 되어 있으면 wait일 때는 읽거나
+ * 내보내는 프레임이 풀리기를 기다리고, 아니면 NULL.
+ */
+buffer_frame * buf_victim(int p, int wait){
+	int i, busy, num_frames = buf_partition_frames(p);
+	buf_partition * part = &buf_partitions[p];
+	buffer_frame * f;
+
+	do{
+		busy = 0;
+		for(i=0; i < 2*num_frames; i++){
+			f = &frames[p + part->clock_hand * buf_num_partitions];
+			part->clock_hand = (part->clock_hand + 1) % num_frames;
+			if(__atomic_load_n(&f->pin_count, __ATOMIC_ACQUIRE) > 0){
+				busy |= f->busy;
+				continue;
+			}
+			if(f->ref_bit){
+				f->ref_bit = 0;
+				continue;
+			}
+			if(f->offset != -1)
+				buf_evict(f);
+			return f;
+		}
+		if(busy && wait) // 읽거나 내보내는 프레임은 곧 풀린다
+			pthread_cond_wait(&part->busy_cond, &part->mutex);
+	}while(busy && wait);
+	if(!wait)
+		return NULL;
+	fprintf(stderr, "Buffer pool: every frame of partition %d is pinned.\n", p);
+	exit(EXIT_FAILURE);
+}
+
+/* Takes a victim frame for the page at offset and enters
+ * it in the page table.  The caller holds the mutex of the
+ * page's partition and reads the image.  Returns NULL if
+ * another thread entered the page while the victim was
+ * being written, or if wait is 0 and there is no victim
+ * without waiting.
+ */
+buffer_frame * buf_install(int64_t offset, int wait){
+	buffer_frame * f = buf_victim((int)((offset / PAGE_SIZE) % buf_num_partitions), wait);
+
+	if(f == NULL || buf_lookup(offset) != NULL)
+		return NULL; // f는 빈 프레임으로 남는다
+	f->is_dirty = 0;
+	f->page_lsn = 0;
+	__atomic_store_n(&f->offset, offset, __ATOMIC_RELAXED);
+	__atomic_store_n(&f->next, page_table[buf_hash(offset)], __ATOMIC_RELAXED);
+	__atomic_store_n(&page_table[buf_hash(offset)], f, __ATOMIC_RELEASE);
+	return f;
+}
+
+/* Pins the page at the given (page-aligned) offset
+ * and returns its in-memory image.
+ * The page is read from the file only on a miss.
+ */
+char * buf_pin(int64_t offset){
+	buffer_frame * f;
+	buf_partition * part = buf_partition_of(offset);
+
+	pthread_mutex_lock(&part->mutex);
+	while(1){
+		f = buf_lookup(offset);
+		if(f != NULL && f->busy){ // 다른 스레드가 읽거나 내보내고 있다
+			pthread_cond_wait(&part->busy_cond, &part->mutex);
+			continue;
+		}
+		if(f != NULL)
+			break;
+		if(storage_mode == STORAGE_MMAP){
+			pthread_mutex_unlock(&part->mutex);
+			mmap_grow(offset);
+			pthread_mutex_lock(&part->mutex);
+			continue;
+		}
+		if((f = buf_install(offset, 1)) == NULL)
+			continue;
+		__atomic_add_fetch(&f->pin_count, 1, __ATOMIC_RELAXED); // 읽는 동안 희생자로 뽑히지 않게
+		f->busy = 1;
+		pthread_mutex_unlock(&part->mutex);
+		if(cold_read(offset, f->page) != 0)
+			io_page(IO_READ, offset, f->page);
+		pthread_mutex_lock(&part->mutex);
+		f->busy = 0;
+		__atomic_sub_fetch(&f->pin_count, 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&part->busy_cond);
+		break;
+	}
+	__atomic_add_fetch(&f->pin_count, 1, __ATOMIC_RELAXED);
+	f->ref_bit = 1;
+	pthread_mutex_unlock(&part->mutex);
+	return f->page;
+}
+
+/* Brings the given pages into the pool without pinning
+ * them, reading all the missing ones as one batch.
+ * At most a quarter of each partition is filled per call,
+ * so a prefetch never takes every free frame, and a page
+ * whose partition has no victim right now is skipped
+ * rather than waited for.
+ */
+void buf_prefetch(const int64_t * offsets, int n){
+	int i, j, p, num_fetched = 0, num_reqs = 0;
+	int reserved[BUF_PARTITIONS] = { 0 };
+	io_request * reqs;
+	buffer_frame ** fetched, * f;
+	buf_partition * part;
+
+	if(storage_mode == STORAGE_MMAP){
+		for(i=0; i<n; i++)
+			if(offsets[i] < __atomic_load_n(&mapped_size, __ATOMIC_ACQUIRE))
+				madvise(frame_pages + offsets[i], PAGE_SIZE, MADV_WILLNEED);
+		return;
+	}
+	reqs = (io_request*)malloc(sizeof(io_request) * (n + 1));
+	fetched = (buffer_frame**)malloc(sizeof(buffer_frame*) * (n + 1));
+	if(reqs == NULL || fetched == NULL){
+		perror("Buffer prefetch.");
+		exit(EXIT_FAILURE);
+	}
+
+	for(i=0; i<n; i++){
+		p = (int)((offsets[i] / PAGE_SIZE) % buf_num_partitions);
+		if(reserved[p] >= buf_partition_frames(p) / 4)
+			continue;
+		part = &buf_partitions[p];
+		pthread_mutex_lock(&part->mutex);
+		// 이미 있거나 이번 배치에 들어있으면 건너뛴다
+		if(buf_lookup(offsets[i]) == NULL && (f = buf_install(offsets[i], 0)) != NULL){
+			__atomic_add_fetch(&f->pin_count, 1, __ATOMIC_RELAXED); // 배치가 끝날 때까지 다른 희생자로 뽑히지 않게
+			f->busy = 1;
+			fetched[num_fetched++] = f;
+			reserved[p]++;
+		}
+		pthread_mutex_unlock(&part->mutex);
+	}
+
+	for(j=0; j<num_fetched; j++){
+		if(cold_read(fetched[j]->offset, fetched[j]->page) == 0)
+			continue; // 압축된 이미지를 풀었다
+		reqs[num_reqs].opcode = IO_READ;
+		reqs[num_reqs].offset = fetched[j]->offset;
+		reqs[num_reqs].buf = fetched[j]->page;
+		reqs[num_reqs].length = PAGE_SIZE;
+		num_reqs++;
+	}
+	if(num_reqs > 0)
+		io_run(reqs, num_reqs);
+
+	for(j=0; j<num_fetched; j++){
+		part = buf_partition_of(fetched[j]->offset);
+		pthread_mutex_lock(&part->mutex);
+		fetched[j]->busy = 0;
+		__atomic_sub_fetch(&fetched[j]->pin_count, 1, __ATOMIC_RELEASE);
+		fetched[j]->ref_bit = 1;
+		pthread_cond_broadcast(&part->busy_cond);
+		pthread_mutex_unlock(&part->mutex);
+	}
+
+	free(reqs);
+	free(fetched);
+}
+
+/* Finds the frame of a page the caller has pinned, without
+ * a lock: the frame of a pinned page stays in its chain and
+ * no other frame can take its offset, so the frame found
+ * with that offset is the right one.  A walk that went
+ * astray, because a frame it passed was moved to another
+ * chain meanwhile, is done again under the mutex.
+ */
+buffer_frame * buf_pinned_frame(int64_t offset){
+	buffer_frame * f;
+	buf_partition * part;
+	int steps = 0;
+
+	if(storage_mode == STORAGE_MMAP)
+		f = buf_lookup(offset);
+	else{
+		f = __atomic_load_n(&page_table[buf_hash(offset)], __ATOMIC_ACQUIRE);
+		while(f != NULL && __atomic_load_n(&f->offset, __ATOMIC_RELAXED) != offset && steps++ < frame_count)
+			f = __atomic_load_n(&f->next, __ATOMIC_ACQUIRE);
+		if(f == NULL || __atomic_load_n(&f->offset, __ATOMIC_RELAXED) != offset){
+			part = buf_partition_of(offset);
+			pthread_mutex_lock(&part->mutex);
+			f = buf_lookup(offset);
+			pthread_mutex_unlock(&part->mutex);
+		}
+	}
+	if(f == NULL || __atomic_load_n(&f->pin_count, __ATOMIC_RELAXED) == 0){
+		fprintf(stderr, "Buffer pool: page %" PRId64 " is not pinned.\n", offset);
+		exit(EXIT_FAILURE);
+	}
+	return f;
+}
+
+/* Marks a pinned page dirty before its change is logged,
+ * so that a checkpoint taken in between already lists it.
+ */
+void buf_mark_dirty(int64_t offset){
+	buffer_frame * f;
+	buf_partition * part = buf_partition_of(offset);
+
+	f = buf_pinned_frame(offset);
+	pthread_mutex_lock(&part->mutex);
+	if(!f->is_dirty){
+		f->is_dirty = 1;
+		f->rec_lsn = wal_tail_lsn();
+	}
+	pthread_mutex_unlock(&part->mutex);
+}
+
+/* lsn is the end of the log record of the last change,
+ * or 0.  Needs no lock: page_lsn is raised before the pin
+ * is let go, so whoever sees the frame unpinned under the
+ * mutex also sees the new page_lsn.
+ */
+void buf_unpin(int64_t offset, int64_t lsn){
+	buffer_frame * f = buf_pinned_frame(offset);
+	int64_t old = __atomic_load_n(&f->page_lsn, __ATOMIC_RELAXED);
+
+	while(lsn > old && !__atomic_compare_exchange_n(&f->page_lsn, &old, lsn, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+	__atomic_sub_fetch(&f->pin_count, 1, __ATOMIC_RELEASE);
+}
+
+void buf_flush_all(){
+	int i, p;
+
+	for(p=0; p < buf_num_partitions; p++){
+		pthread_mutex_lock(&buf_partitions[p].mutex);
+		for(i=p; i < frame_count; i += buf_num_partitions)
+			if(frames[i].offset != -1)
+				buf_write_back(&frames[i]);
+		pthread_mutex_unlock(&buf_partitions[p].mutex);
+	}
+}
+
+/* Writes back every dirty page nobody has pinned, a
+ * batch of FLUSH_BATCH pages of one partition at a time
+ * and without holding its mutex during the writes.  A
+ * batch pins at most half of a small partition, so other
+ * threads still find a victim.
+ * An unpinned page can only change after a pin, so the
+ * copy taken under the mutex is consistent; the frame
+ * stays pinned until the write is done so that a newer
+ * image cannot be evicted and then overwritten by ours.
+ */
+#define FLUSH_BATCH 32
+
+void buf_flush_dirty(){
+	int i, j, n, p, count;
+	int64_t lsn;
+	int batch[FLUSH_BATCH];
+	io_request reqs[FLUSH_BATCH];
+	char * images;
+	buf_partition * part;
+
+	images = (char*)malloc((size_t)PAGE_SIZE * FLUSH_BATCH);
+	if(images == NULL){
+		perror("Buffer flush.");
+		exit(EXIT_FAILURE);
+	}
+	for(p=0; p < buf_num_partitions; p++){
+		part = &buf_partitions[p];
+		i = p;
+		do{
+			n = 0;
+			lsn = 0;
+			pthread_mutex_lock(&part->mutex);
+			count = __atomic_load_n(&frame_count, __ATOMIC_ACQUIRE); // STORAGE_MMAP에서는 도중에 늘어날 수 있다
+			for(; i < count && n < FLUSH_BATCH && n < buf_partition_frames(p) / 2; i += buf_num_partitions){
+				if(frames[i].offset == -1 || !frames[i].is_dirty || __atomic_load_n(&frames[i].pin_count, __ATOMIC_ACQUIRE) > 0)
+					continue;
+				memcpy(images + (size_t)n*PAGE_SIZE, frames[i].page, PAGE_SIZE);
+				reqs[n].opcode = IO_WRITE;
+				reqs[n].offset = frames[i].offset;
+				reqs[n].buf = images + (size_t)n*PAGE_SIZE;
+				reqs[n].length = PAGE_SIZE;
+				if(frames[i].page_lsn > lsn)
+					lsn = frames[i].page_lsn;
+				frames[i].is_dirty = 0;
+				__atomic_add_fetch(&frames[i].pin_count, 1, __ATOMIC_RELAXED);
+				cold_begin_write(frames[i].offset);
+				batch[n++] = i;
+			}
+			pthread_mutex_unlock(&part->mutex);
+			if(n == 0)
+				break;
+
+			wal_flush(lsn);
+			io_run(reqs, n);
+
+			pthread_mutex_lock(&part->mutex);
+			for(j=0; j<n; j++){
+				cold_forget(frames[batch[j]].offset);
+				if(__atomic_sub_fetch(&frames[batch[j]].pin_count, 1, __ATOMIC_RELEASE) == 0
+						&& storage_mode == STORAGE_MMAP && !frames[batch[j]].is_dirty)
+					madvise(frames[batch[j]].page, PAGE_SIZE, MADV_DONTNEED);
+			}
+			pthread_mutex_unlock(&part->mutex);
+		}while(1);
+	}
+	free(images);
+}
+
+/* Copies the dirty page table into a new array (*out)
+ * and returns the number of entries.
+ */
+int buf_dirty_pages(wal_dirty_page ** out){
+	int i, p, count, n = 0;
+
+	count = __atomic_load_n(&frame_count, __ATOMIC_ACQUIRE); // 새로 생기는 프레임은 깨끗하다
+	*out = (wal_dirty_page*)malloc(sizeof(wal_dirty_page) * (count + 1));
+	if(*out == NULL){
+		perror("Dirty page table.");
+		exit(EXIT_FAILURE);
+	}
+	for(p=0; p < buf_num_partitions; p++){
+		pthread_mutex_lock(&buf_partitions[p].mutex);
+		for(i=p; i < count; i += buf_num_partitions)
+			if(frames[i].offset != -1 && frames[i].is_dirty){
+				(*out)[n].page_offset = frames[i].offset;
+				(*out)[n].rec_lsn = frames[i].rec_lsn;
+				n++;
+			}
+		pthread_mutex_unlock(&buf_partitions[p].mutex);
+	}
+	return n;
+}
+
+/* Typed access to a page of the data file.
+ * get_page pins the page in the buffer pool and returns
+ * its image, which may be used as any of the page structs.
+ * Every get_page must be matched by one put_page;
+ * is_dirty tells whether the image was modified.
+ * Inside an operation, put_page logs the change
+ * before the page can be written back.
+ */
+void * get_page(int64_t offset){
+	char * page = buf_pin(offset);
+	if(wal_current()->op_id != 0)
+		wal_snapshot_page(offset, page);
+	return page;
+}
+
+void put_page(int64_t offset, int is_dirty){
+	int64_t lsn = 0;
+
+	if(is_dirty){
+		buf_mark_dirty(offset);
+		if(wal_current()->op_id != 0)
+			lsn = wal_log_page(offset, buf_pinned_frame(offset)->page);
+	}
+	buf_unpin(offset, lsn);
+}
+
+/* get_page for a page that is only read, let go of with
+ * put_page_read.  With STORAGE_MMAP the page comes straight
+ * from the mapping, without a pin and without a lock:
+ * nothing is evicted and the mapping never moves, and a
+ * clean page dropped with MADV_DONTNEED reads back the
+ * same bytes from the file.
+ */
+void * get_page_read(int64_t offset){
+	char * page;
+
+	if(storage_mode != STORAGE_MMAP)
+		return get_page(offset);
+	if(offset >= __atomic_load_n(&mapped_size, __ATOMIC_ACQUIRE))
+		mmap_grow(offset);
+	page = frame_pages + offset;
+	if(wal_current()->op_id != 0)
+		wal_snapshot_page(offset, page);
+	return page;
+}
+
+void put_page_read(int64_t offset){
+	if(storage_mode != STORAGE_MMAP)
+		put_page(offset, 0);
+}
+
+/* Checkpoints.
+ * A checkpoint is fuzzy: it first writes back the dirty pages
+ * nobody has pinned, then logs CHECKPOINT_BEGIN, copies the
+ * dirty page table and the active operation table into
+ * CHECKPOINT_END, with the transactions in progress, and
+ * points the master record at BEGIN.
+ * Writers keep running the whole time.  Recovery has to read
+ * the log only from the oldest rec_lsn the checkpoint saw,
+ * so everything before it is punched out of the log file.
+ */
+void take_checkpoint(){
+	int i, num_dirty, num_active, num_txs, size;
+	int64_t begin_lsn, discard_lsn;
+	wal_record begin;
+	wal_checkpoint * end;
+	wal_dirty_page * dirty;
+	wal_active_op * active, * txs;
+	wal_op * op;
+	transaction * tx;
+
+	buf_flush_dirty();
+
+	begin.prev_lsn = 0;
+	begin.op_id = 0;
+	begin.type = WAL_CHECKPOINT_BEGIN;
+	begin.size = sizeof(wal_record);
+	begin.checksum = wal_checksum(&begin);
+	begin_lsn = wal_append(&begin, NULL);
+
+	num_dirty = buf_dirty_pages(&dirty);
+
+	pthread_mutex_lock(&wal_mutex);
+	num_active = 0;
+	for(op = wal_ops; op != NULL; op = op->next)
+		num_active++;
+	for(tx = wal_txs; tx != NULL; tx = tx->next)
+		num_active++;
+	size = sizeof(wal_checkpoint) + sizeof(wal_dirty_page)*num_dirty + sizeof(wal_active_op)*num_active;
+	end = (wal_checkpoint*)malloc(size);
+	if(end == NULL){
+		perror("Checkpoint record.");
+		exit(EXIT_FAILURE);
+	}
+	active = (wal_active_op*)((char*)end + sizeof(wal_checkpoint) + sizeof(wal_dirty_page)*num_dirty);
+	num_active = 0;
+	for(op = wal_ops; op != NULL; op = op->next)
+		if(op->first_lsn != 0){ // 아직 아무것도 쓰지 않은 operation은 복구할 것도 없다
+			active[num_active].op_id = op->op_id;
+			active[num_active].first_lsn = op->first_lsn;
+			active[num_active].last_lsn = op->last_lsn;
+			num_active++;
+		}
+	txs = active + num_active;
+	num_txs = 0;
+	for(tx = wal_txs; tx != NULL; tx = tx->next)
+		if(tx->first_lsn != 0){
+			txs[num_txs].op_id = tx->tx_id;
+			txs[num_txs].first_lsn = tx->first_lsn;
+			txs[num_txs].last_lsn = tx->last_lsn;
+			num_txs++;
+		}
+	pthread_mutex_unlock(&wal_mutex);
+	memcpy((char*)end + sizeof(wal_checkpoint), dirty, sizeof(wal_dirty_page)*num_dirty);
+
+	end->num_dirty_pages = num_dirty;
+	end->num_active_ops = num_active;
+	end->num_active_txs = num_txs;
+	end->rec.prev_lsn = begin_lsn;
+	end->rec.op_id = 0;
+	end->rec.type = WAL_CHECKPOINT_END;
+	end->rec.size = sizeof(wal_checkpoint) + sizeof(wal_dirty_page)*num_dirty
+		+ sizeof(wal_active_op)*(num_active + num_txs);
+	end->rec.checksum = wal_checksum(&end->rec);
+	wal_append(&end->rec, NULL);
+	wal_flush(end->rec.lsn + end->rec.size);
+
+	cold_checkpoint(); // master가 이 체크포인트를 가리키기 전에 map을
+	if(wal_write_master(begin_lsn) != 0){
+		perror("Checkpoint master record.");
+		exit(EXIT_FAILURE);
+	}
+
+	/* 복구에 더 이상 필요 없는 로그는 구멍을 뚫어 돌려준다. */
+	discard_lsn = begin_lsn;
+	for(i=0; i < num_dirty; i++)
+		if(dirty[i].rec_lsn < discard_lsn)
+			discard_lsn = dirty[i].rec_lsn;
+	for(i=0; i < num_active + num_txs; i++) // 트랜잭션의 TX_UNDO도 남긴다
+		if(active[i].first_lsn < discard_lsn)
+			discard_lsn = active[i].first_lsn;
+	discard_lsn -= discard_lsn % PAGE_SIZE;
+	if(discard_lsn > wal_discarded_lsn){
+		fallocate(log_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				wal_discarded_lsn, discard_lsn - wal_discarded_lsn);
+		wal_discarded_lsn = discard_lsn;
+	}
+
+	pthread_mutex_lock(&wal_mutex);
+	wal_checkpoint_lsn = begin_lsn;
+	pthread_mutex_unlock(&wal_mutex);
+
+	free(dirty);
+	free(end);
+}
+
+int wal_checkpointing = 0; // 체크포인터가 돌고 있다
+
+void * wal_checkpointer_main(void * arg){
+	struct timespec deadline;
+
+	(void)arg;
+	pthread_mutex_lock(&wal_mutex);
+	while(wal_checkpointing){
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += checkpoint_interval;
+		pthread_cond_timedwait(&wal_checkpoint_cond, &wal_mutex, &deadline);
+		if(!wal_checkpointing)
+			break;
+		pthread_mutex_unlock(&wal_mutex);
+		take_checkpoint();
+		pthread_mutex_lock(&wal_mutex);
+	}
+	pthread_mutex_unlock(&wal_mutex);
+	return NULL;
+}
+
+void wal_start_checkpointer(){
+	wal_checkpointing = 1;
+	pthread_create(&wal_checkpointer, NULL, wal_checkpointer_main, NULL);
+}
+
+void wal_stop_checkpointer(){
+	pthread_mutex_lock(&wal_mutex);
+	wal_checkpointing = 0;
+	pthread_cond_signal(&wal_checkpoint_cond);
+	pthread_mutex_unlock(&wal_mutex);
+	pthread_join(wal_checkpointer, NULL);
+}
+
+/* Crash recovery.
+ * Analysis reads forward from the last checkpoint and rebuilds
+ * the dirty page table and the operations that never committed.
+ * Redo repeats history from the oldest rec_lsn: after images
+ * are absolute, so applying them again is harmless.
+ * Undo then walks every unfinished operation backwards through
+ * prev_lsn and puts the before images back.  Finally the pages
+ * are written back and synced, and the caller empties the log.
+ * Transactions without TX_END are left: their before images
+ * are read into recovery_undo, and open_db rolls them back
+ * with tx_recover once the tree can be written again.
+ */
+typedef struct recovery_page {
+	int64_t page_offset; // -1이면 빈 칸
+	int64_t rec_lsn;
+} recovery_page;
+
+recovery_page * recovery_pages = NULL;
+int recovery_pages_size = 0;
+int recovery_pages_used = 0;
+wal_active_op * recovery_ops = NULL;
+int recovery_num_ops = 0;
+wal_active_op * recovery_txs = NULL;
+int recovery_num_txs = 0;
+tx_undo * recovery_undo = NULL; // 끝나지 않은 트랜잭션들의 before image, LSN 순
+int recovery_num_undo = 0;
+
+recovery_page * recovery_find_page(int64_t page_offset, int create){
+	int i, old_size;
+	recovery_page * old, * p;
+
+	if(create && (recovery_pages_used + 1) * 2 > recovery_pages_size){
+		old = recovery_pages;
+		old_size = recovery_pages_size;
+		recovery_pages_size = old_size ? old_size * 2 : 1024;
+		recovery_pages = (recovery_page*)malloc(sizeof(recovery_page) * recovery_pages_size);
+		for(i=0; i < recovery_pages_size; i++)
+			recovery_pages[i].page_offset = -1;
+		recovery_pages_used = 0;
+		for(i=0; i < old_size; i++)
+			if(old[i].page_offset != -1){
+				p = recovery_find_page(old[i].page_offset, 1);
+				p->rec_lsn = old[i].rec_lsn;
+			}
+		free(old);
+	}
+	if(recovery_pages_size == 0)
+		return NULL;
+
+	i = (int)((page_offset / PAGE_SIZE) % recovery_pages_size);
+	while(recovery_pages[i].page_offset != -1 && recovery_pages[i].page_offset != page_offset)
+		i = (i + 1) % recovery_pages_size;
+	if(recovery_pages[i].page_offset == -1){
+		if(!create) return NULL;
+		recovery_pages[i].page_offset = page_offset;
+		recovery_pages[i].rec_lsn = INT64_MAX;
+		recovery_pages_used++;
+	}
+	return &recovery_pages[i];
+}
+
+// ops는 recovery_ops나 recovery_txs
+wal_active_op * recovery_find(wal_active_op ** ops, int * num_ops, int64_t op_id, int create){
+	int i;
+	for(i=0; i < *num_ops; i++)
+		if((*ops)[i].op_id == op_id)
+			return &(*ops)[i];
+	if(!create) return NULL;
+	*ops = (wal_active_op*)realloc(*ops, sizeof(wal_active_op) * (*num_ops + 1));
+	(*ops)[*num_ops].op_id = op_id;
+	(*ops)[*num_ops].first_lsn = 0;
+	(*ops)[*num_ops].last_lsn = 0;
+	return &(*ops)[(*num_ops)++];
+}
+
+wal_active_op * recovery_find_op(int64_t op_id, int create){
+	return recovery_find(&recovery_ops, &recovery_num_ops, op_id, create);
+}
+
+wal_active_op * recovery_find_tx(int64_t tx_id, int create){
+	return recovery_find(&recovery_txs, &recovery_num_txs, tx_id, create);
+}
+
+/* Reads the record at lsn into *buf (grown as needed).
+ * Returns 0, or -1 if there is no valid record there,
+ * which marks the end of the log.
+ */
+int wal_read_record(int64_t lsn, char ** buf, int * buf_size){
+	wal_record rec;
+	wal_update * up;
+	wal_tx_undo * undo;
+
+	if(pread(log_fd, &rec, sizeof(wal_record), lsn) != sizeof(wal_record))
+		return -1;
+	if(rec.lsn != lsn || rec.size < (int)sizeof(wal_record) || rec.size > 64 * 1024 * 1024
+			|| rec.type < WAL_BEGIN || rec.type > WAL_TX_END)
+		return -1;
+	if(rec.size > *buf_size){
+		*buf_size = rec.size;
+		*buf = (char*)realloc(*buf, rec.size);
+	}
+	if(pread(log_fd, *buf, rec.size, lsn) != rec.size)
+		return -1;
+	if(wal_checksum((wal_record*)*buf) != rec.checksum)
+		return -1;
+	if(rec.type == WAL_UPDATE){
+		up = (wal_update*)*buf;
+		if(up->offset < 0 || up->length <= 0 || up->offset + up->length > PAGE_SIZE
+				|| rec.size != (int)sizeof(wal_update) + 2*up->length)
+			return -1;
+	}
+	if(rec.type == WAL_TX_UNDO){
+		undo = (wal_tx_undo*)*buf;
+		if(undo->length < -1 || rec.size != (int64_t)sizeof(wal_tx_undo) + (undo->length > 0 ? undo->length : 0))
+			return -1;
+	}
+	return 0;
+}
+
+void recovery_apply(wal_update * up, int undo){
+	char * page = get_page(up->page_offset);
+	memcpy(page + up->offset, (char*)up + sizeof(wal_update) + (undo ? 0 : up->length), up->length);
+	put_page(up->page_offset, 1);
+}
+
+void wal_recover(){
+	int i, buf_size = 0;
+	int64_t lsn, start_lsn, redo_lsn, end_lsn;
+	char * buf = NULL;
+	wal_file_header header;
+	wal_record * rec;
+	wal_checkpoint * ck;
+	wal_dirty_page * dp;
+	wal_active_op * op, * ck_op;
+	wal_tx_undo * undo;
+	tx_undo entry;
+	recovery_page * p;
+
+	if(pread(log_fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != WAL_MAGIC)
+		return; // 로그가 없다
+	start_lsn = header.checkpoint_lsn != 0 ? header.checkpoint_lsn : WAL_HEADER_SIZE;
+
+	/* Analysis */
+	for(lsn = start_lsn; wal_read_record(lsn, &buf, &buf_size) == 0; lsn += rec->size){
+		rec = (wal_record*)buf;
+		switch(rec->type){
+		case WAL_BEGIN:
+		case WAL_UPDATE:
+			op = recovery_find_op(rec->op_id, 1);
+			if(op->first_lsn == 0) op->first_lsn = lsn;
+			op->last_lsn = lsn;
+			if(rec->type == WAL_UPDATE){
+				p = recovery_find_page(((wal_update*)rec)->page_offset, 1);
+				if(lsn < p->rec_lsn) p->rec_lsn = lsn;
+			}
+			break;
+		case WAL_COMMIT:
+			op = recovery_find_op(rec->op_id, 1);
+			op->last_lsn = -1; // 끝난 operation
+			break;
+		case WAL_TX_UNDO:
+			op = recovery_find_tx(rec->op_id, 1);
+			if(op->first_lsn == 0) op->first_lsn = lsn;
+			op->last_lsn = lsn;
+			break;
+		case WAL_TX_END:
+			op = recovery_find_tx(rec->op_id, 1);
+			op->last_lsn = -1;
+			break;
+		case WAL_CHECKPOINT_END:
+			ck = (wal_checkpoint*)rec;
+			dp = (wal_dirty_page*)(buf + sizeof(wal_checkpoint));
+			for(i=0; i < ck->num_dirty_pages; i++){
+				p = recovery_find_page(dp[i].page_offset, 1);
+				if(dp[i].rec_lsn < p->rec_lsn) p->rec_lsn = dp[i].rec_lsn;
+			}
+			ck_op = (wal_active_op*)(dp + ck->num_dirty_pages);
+			for(i=0; i < ck->num_active_ops; i++){
+				if(recovery_find_op(ck_op[i].op_id, 0) != NULL) continue;
+				op = recovery_find_op(ck_op[i].op_id, 1);
+				*op = ck_op[i];
+			}
+			ck_op += ck->num_active_ops;
+			for(i=0; i < ck->num_active_txs; i++){
+				if(recovery_find_tx(ck_op[i].op_id, 0) != NULL) continue;
+				op = recovery_find_tx(ck_op[i].op_id, 1);
+				*op = ck_op[i];
+			}
+			break;
+		}
+	}
+	end_lsn = lsn;
+
+	/* Redo */
+	redo_lsn = end_lsn;
+	for(i=0; i < recovery_pages_size; i++)
+		if(recovery_pages[i].page_offset != -1 && recovery_pages[i].rec_lsn < redo_lsn)
+			redo_lsn = recovery_pages[i].rec_lsn;
+	for(lsn = redo_lsn; lsn < end_lsn && wal_read_record(lsn, &buf, &buf_size) == 0; lsn += rec->size){
+		rec = (wal_record*)buf;
+		if(rec->type != WAL_UPDATE) continue;
+		p = recovery_find_page(((wal_update*)rec)->page_offset, 0);
+		if(p != NULL && lsn >= p->rec_lsn)
+			recovery_apply((wal_update*)rec, 0);
+	}
+
+	/* Undo: 여러 operation이 함께 돌았을 수 있으니 LSN이 큰 것부터 */
+	while(1){
+		op = NULL;
+		for(i=0; i < recovery_num_ops; i++)
+			if(recovery_ops[i].last_lsn > 0 && (op == NULL || recovery_ops[i].last_lsn > op->last_lsn))
+				op = &recovery_ops[i];
+		if(op == NULL)
+			break;
+		if(wal_read_record(op->last_lsn, &buf, &buf_size) != 0){
+			op->last_lsn = 0;
+			continue;
+		}
+		rec = (wal_record*)buf;
+		if(rec->type == WAL_UPDATE)
+			recovery_apply((wal_update*)rec, 1);
+		op->last_lsn = rec->prev_lsn;
+	}
+
+	buf_flush_all();
+	fsync(fd);
+	cold_checkpoint();
+
+	/* 끝나지 않은 트랜잭션의 before image를 모은다 (최신 것부터) */
+	for(i=0; i < recovery_num_txs; i++)
+		for(lsn = recovery_txs[i].last_lsn; lsn > 0 && wal_read_record(lsn, &buf, &buf_size) == 0; lsn = rec->prev_lsn){
+			rec = (wal_record*)buf;
+			if(rec->type != WAL_TX_UNDO)
+				continue;
+			undo = (wal_tx_undo*)rec;
+			recovery_undo = (tx_undo*)realloc(recovery_undo, sizeof(tx_undo) * (recovery_num_undo + 1));
+			if(recovery_undo == NULL){
+				perror("Transaction recovery.");
+				exit(EXIT_FAILURE);
+			}
+			recovery_undo[recovery_num_undo].key = undo->key;
+			recovery_undo[recovery_num_undo].length = undo->length;
+			recovery_undo[recovery_num_undo].image = NULL;
+			if(undo->length >= 0){
+				recovery_undo[recovery_num_undo].image = (char*)malloc(undo->length + 1);
+				if(recovery_undo[recovery_num_undo].image == NULL){
+					perror("Transaction recovery.");
+					exit(EXIT_FAILURE);
+				}
+				memcpy(recovery_undo[recovery_num_undo].image, (char*)undo + sizeof(wal_tx_undo), undo->length);
+			}
+			recovery_num_undo++;
+		}
+	// 트랜잭션들의 키는 겹치지 않으니 (락) 트랜잭션마다의 순서만 지키면 된다
+	for(i=0; i < recovery_num_undo / 2; i++){
+		entry = recovery_undo[i];
+		recovery_undo[i] = recovery_undo[recovery_num_undo - 1 - i];
+		recovery_undo[recovery_num_undo - 1 - i] = entry;
+	}
+
+	free(buf);
+	free(recovery_pages);
+	free(recovery_ops);
+	free(recovery_txs);
+	recovery_pages = NULL;
+	recovery_ops = NULL;
+	recovery_txs = NULL;
+	recovery_pages_size = recovery_pages_used = recovery_num_ops = recovery_num_txs = 0;
+}
+
+/* Concurrency.
+ * tree_lock sits above the root.  Lookups and scans take
+ * it shared, and so do inserts and deletes that change a
+ * single leaf and inserts that split a leaf whose parent
+ * has room for the separator.  Nodes are latched: a
+ * descent holds one shared latch at a time, reading a
+ * node under it and moving right when the key it looks
+ * for is past the node's high key (see B-link), so it
+ * never waits on a split that is under way above it.  A
+ * writer holds its leaf's latch exclusively from before it
+ * reads the leaf until its commit record is appended, so a
+ * crash can undo the bytes it changed without touching
+ * anybody else's.  The latches are striped over
+ * PAGE_LATCHES rwlocks by page number.
+ *
+ * A leaf split in shared mode also needs the parent.  It
+ * only tries that latch, since waiting for it with the
+ * leaf held would go against the top-down order of the
+ * others, and alloc_mutex, which covers the header and
+ * free space map pages, until its commit.  The new leaf
+ * is reachable only through those two, and the sibling
+ * chain stays correct at every step, so a reader that
+ * reads the leaf before the parent is updated finds its
+ * key through the right link.
+ *
+ * A writer that cannot do that (the parent is busy or
+ * would split, a delete that would make its leaf underflow
+ * or empty the root, anything with an overflow chain) lets
+ * go of everything and runs again with tree_lock
+ * exclusive, which is where every other split, every
+ * merge and every page that is given back happens.
+ * Writers are preferred, so a steady stream of readers
+ * cannot starve them.  Waiting for the commit to become
+ * durable happens outside of both, so that operations of
+ * other threads join the same fsync.
+ *
+ * With optimistic_latching set, readers take no latches.
+ * Each stripe also has a version that a writer makes odd
+ * when it latches the stripe exclusively and even again
+ * when it lets go.  A reader copies the page when the
+ * version is even and reads it again if the version moved
+ * meanwhile, so a reader never writes the stripe.  It
+ * still takes tree_lock shared, and with STORAGE_BUFFERED
+ * pins the page under its partition's mutex, so readers of
+ * the root do share those cache lines; only with
+ * STORAGE_MMAP is the page read without a pin.
+ * Exclusive mode writes without latches, but readers are
+ * kept out of it by tree_lock.
+ */
+#define PAGE_LATCHES 1024
+
+typedef struct latch_stripe {
+	pthread_rwlock_t latch;
+	int64_t version; // 배타 래치가 잡혀 있는 동안 홀수
+} __attribute__((aligned(64))) latch_stripe; // 한 캐시 라인씩
+
+pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+latch_stripe page_latches[PAGE_LATCHES] = { [0 ... PAGE_LATCHES - 1] = { PTHREAD_RWLOCK_INITIALIZER, 0 } };
+int optimistic_latching = 0; // open_db 전에 켜면 읽는 쪽은 래치 없이 버전만 본다
+int64_t tree_version = 0; // 배타 모드에서 구조를 바꿀 수 있는 operation마다 하나씩 는다
+pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; // 공유 모드의 split이 COMMIT까지 쥔다
+
+latch_stripe * page_latch(int64_t offset){
+	return &page_latches[(offset / PAGE_SIZE) % PAGE_LATCHES];
+}
+
+void latch_page(int64_t offset, int exclusive){
+	latch_stripe * stripe = page_latch(offset);
+
+	if(!exclusive){
+		pthread_rwlock_rdlock(&stripe->latch);
+		return;
+	}
+	pthread_rwlock_wrlock(&stripe->latch);
+	__atomic_store_n(&stripe->version, stripe->version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); // 페이지를 바꾸기 전에 홀수가 보여야 한다
+}
+
+/* Like latch_page(offset, 1), but returns -1 instead of
+ * waiting if the latch is held.
+ */
+int try_latch_page(int64_t offset){
+	latch_stripe * stripe = page_latch(offset);
+
+	if(pthread_rwlock_trywrlock(&stripe->latch) != 0)
+		return -1;
+	__atomic_store_n(&stripe->version, stripe->version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 0;
+}
+
+void unlatch_page(int64_t offset){
+	latch_stripe * stripe = page_latch(offset);
+
+	if(stripe->version & 1) // 홀수면 우리가 배타로 쥐고 있었다
+		__atomic_store_n(&stripe->version, stripe->version + 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&stripe->latch);
+}
+
+/* Returns the page at offset for reading: latched shared
+ * and in the buffer pool, or, with optimistic_latching, a
+ * consistent copy of it in copy.  Either way the caller
+ * lets go of it with put_page_shared.
+ */
+void * get_page_shared(int64_t offset, void * copy){
+	int64_t version;
+	latch_stripe * stripe = page_latch(offset);
+	char * page;
+
+	if(!optimistic_latching){
+		latch_page(offset, 0);
+		return get_page_read(offset);
+	}
+	page = get_page_read(offset);
+	while(1){
+		version = __atomic_load_n(&stripe->version, __ATOMIC_ACQUIRE);
+		if(version & 1){ // 쓰는 중이다
+			sched_yield();
+			continue;
+		}
+		memcpy(copy, page, PAGE_SIZE);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&stripe->version, __ATOMIC_RELAXED) == version)
+			break;
+	}
+	put_page_read(offset);
+	return copy;
+}
+
+void put_page_shared(int64_t offset){
+	if(optimistic_latching)
+		return;
+	put_page_read(offset);
+	unlatch_page(offset);
+}
+
+/* Transactions.
+ * begin_tx makes the inserts, deletes and lookups that the
+ * calling thread runs next one transaction, up to commit_tx
+ * or abort_tx.  Records are locked under strict two-phase
+ * locking: a lookup takes its key shared, a write takes it
+ * exclusive, and nothing is let go before the end.  The
+ * locks live in a table hashed on the key, LOCK_BUCKETS
+ * lists each under its own mutex, so transactions on
+ * different records only meet in the tree.  Record locks
+ * are taken before tree_lock, never with a latch held.
+ *
+ * Before a transaction writes a record it logs the record's
+ * before image (TX_UNDO) and keeps a copy.  abort_tx puts
+ * the images back, newest first, with ordinary logged
+ * operations, and open_db does the same for transactions
+ * that a crash cut short.  Putting an image back gives the
+ * same record however often it is done, so a crash during
+ * a rollback only means that it runs again.  The operations
+ * of a transaction commit as usual but do not wait for the
+ * log; commit_tx waits once, for TX_END.
+ *
+ * Deadlocks are avoided with wait-die: a transaction waits
+ * for a lock only if it is older than every transaction
+ * holding it.  Otherwise it is rolled back on the spot, the
+ * operation fails and so does commit_tx.  Writes outside of
+ * a transaction lock their key only while they run (and
+ * insert_batch, which holds many, starts over instead of
+ * dying).  Lookups outside of a transaction and scans do not
+ * lock.  No transaction may be running at close_db.
+ */
+#define LOCK_BUCKETS 1024
+#define TX_MAX_IMAGE (WAL_BUFFER_SIZE / 2) // 이보다 긴 값은 트랜잭션 안에서 바꿀 수 없다
+
+// 롤백이 쓰는 트리 연산, 정의는 아래에
+char * tree_find_value(int64_t key, int64_t * length);
+int tree_insert_value(int64_t key, const char * value, int64_t length);
+int tree_delete(int64_t key);
+
+typedef struct record_lock {
+	int64_t key;
+	transaction * owner;
+	int exclusive;
+	struct record_lock * next; // 같은 버킷
+	struct record_lock * owner_next; // 같은 트랜잭션
+} record_lock;
+
+typedef struct lock_bucket {
+	pthread_mutex_t mutex;
+	pthread_cond_t released;
+	record_lock * locks;
+} lock_bucket;
+
+lock_bucket lock_table[LOCK_BUCKETS] = { [0 ... LOCK_BUCKETS - 1] =
+	{ PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL } };
+
+lock_bucket * lock_bucket_of(int64_t key){
+	return &lock_table[(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32) % LOCK_BUCKETS];
+}
+
+/* Locks key for tx, shared or exclusive.  tx waits for the
+ * holders if it has no age or is older than all of them.
+ * Returns 0, or -1 if tx has to give way.
+ */
+int lock_record(transaction * tx, int64_t key, int exclusive){
+	int conflict, die;
+	lock_bucket * b = lock_bucket_of(key);
+	record_lock * l, * mine;
+
+	pthread_mutex_lock(&b->mutex);
+	while(1){
+		mine = NULL;
+		conflict = die = 0;
+		for(l = b->locks; l != NULL; l = l->next){
+			if(l->key != key)
+				continue;
+			if(l->owner == tx)
+				mine = l;
+			else if(exclusive || l->exclusive){
+				conflict = 1;
+				if(tx->age != 0 && l->owner->age != 0 && l->owner->age < tx->age)
+					die = 1; // 더 오래된 쪽을 기다리지 않는다
+			}
+		}
+		if(!conflict)
+			break;
+		if(die){
+			pthread_mutex_unlock(&b->mutex);
+			return -1;
+		}
+		pthread_cond_wait(&b->released, &b->mutex);
+	}
+	if(mine != NULL)
+		mine->exclusive |= exclusive;
+	else{
+		l = (record_lock*)malloc(sizeof(record_lock));
+		if(l == NULL){
+			perror("Record lock.");
+			exit(EXIT_FAILURE);
+		}
+		l->key = key;
+		l->owner = tx;
+		l->exclusive = exclusive;
+		l->next = b->locks;
+		b->locks = l;
+		l->owner_next = tx->locks;
+		tx->locks = l;
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return 0;
+}
+
+// tx가 마지막으로 잡은 잠금을 놓는다
+void unlock_newest_record(transaction * tx){
+	lock_bucket * b;
+	record_lock * l = tx->locks, ** p;
+
+	tx->locks = l->owner_next;
+	b = lock_bucket_of(l->key);
+	pthread_mutex_lock(&b->mutex);
+	for(p = &b->locks; *p != l; p = &(*p)->next) ;
+	*p = l->next;
+	pthread_cond_broadcast(&b->released);
+	pthread_mutex_unlock(&b->mutex);
+	free(l);
+}
+
+void unlock_records(transaction * tx){
+	while(tx->locks != NULL)
+		unlock_newest_record(tx);
+}
+
+/* Logs image (length bytes, or length -1 if key did not
+ * exist) as a before image of tx and keeps it, taking
+ * over the buffer.
+ */
+void tx_add_undo(transaction * tx, int64_t key, char * image, int64_t length){
+	int size = sizeof(wal_tx_undo) + (length > 0 ? length : 0);
+	wal_tx_undo * rec = (wal_tx_undo*)malloc(size);
+
+	if(tx->num_undo == tx->max_undo){
+		tx->max_undo = tx->max_undo ? tx->max_undo * 2 : 16;
+		tx->undo = (tx_undo*)realloc(tx->undo, sizeof(tx_undo) * tx->max_undo);
+	}
+	if(rec == NULL || tx->undo == NULL){
+		perror("Transaction undo log.");
+		exit(EXIT_FAILURE);
+	}
+	rec->key = key;
+	rec->length = length;
+	if(length > 0)
+		memcpy((char*)rec + sizeof(wal_tx_undo), image, length);
+	wal_append_tx(&rec->rec, WAL_TX_UNDO, size);
+	free(rec);
+
+	tx->undo[tx->num_undo].key = key;
+	tx->undo[tx->num_undo].length = length;
+	tx->undo[tx->num_undo].image = image;
+	tx->num_undo++;
+}
+
+/* Logs the value key has now as a before image of tx.
+ * Returns 0, or -1 if the value is too long to log.
+ */
+int tx_log_undo(transaction * tx, int64_t key){
+	int64_t length;
+	char * image = tree_find_value(key, &length);
+
+	if(image == NULL)
+		length = -1;
+	else if(length > TX_MAX_IMAGE){
+		free(image);
+		return -1;
+	}
+	tx_add_undo(tx, key, image, length);
+	return 0;
+}
+
+// before image를 최신 것부터 되돌려놓는다
+void tx_rollback(transaction * tx){
+	int i;
+
+	for(i = tx->num_undo - 1; i >= 0; i--){
+		tree_delete(tx->undo[i].key);
+		if(tx->undo[i].length >= 0)
+			tree_insert_value(tx->undo[i].key, tx->undo[i].image, tx->undo[i].length);
+	}
+}
+
+/* Logs TX_END if tx logged anything, lets go of its locks
+ * and drops its before images.  Returns the LSN to wait
+ * for before the end is durable.
+ */
+int64_t tx_finish(transaction * tx){
+	int i;
+	int64_t lsn = 0;
+	wal_record rec;
+
+	if(tx->last_lsn != 0){
+		wal_append_tx(&rec, WAL_TX_END, sizeof(wal_record));
+		lsn = rec.lsn + rec.size;
+	}
+	pthread_mutex_lock(&wal_mutex);
+	if(tx->prev != NULL)
+		tx->prev->next = tx->next;
+	else
+		wal_txs = tx->next;
+	if(tx->next != NULL)
+		tx->next->prev = tx->prev;
+	tx->first_lsn = tx->last_lsn = 0;
+	pthread_mutex_unlock(&wal_mutex);
+
+	unlock_records(tx);
+	tx->age = 0;
+	for(i=0; i < tx->num_undo; i++)
+		free(tx->undo[i].image);
+	tx->num_undo = 0;
+	return lsn;
+}
+
+// wait-die에서 졌다: 바로 되돌리고 commit_tx가 실패하게 한다
+void tx_kill(transaction * tx){
+	tx->restart_age = tx->age;
+	tx_rollback(tx);
+	tx_finish(tx);
+	tx->aborted = 1;
+}
+
+/* Starts a transaction in the calling thread.  Returns 0,
+ * or -1 if the thread is already in one.  If the thread's
+ * last transaction was rolled back to give way, this one
+ * keeps its age, so that trying again cannot starve.
+ */
+int begin_tx(){
+	transaction * tx = tx_current();
+
+	if(tx->tx_id != 0)
+		return -1;
+	tx->aborted = 0;
+	tx->first_lsn = tx->last_lsn = 0;
+	pthread_mutex_lock(&wal_mutex);
+	tx->tx_id = wal_next_op_id++;
+	tx->age = tx->restart_age != 0 ? tx->restart_age : tx->tx_id;
+	tx->restart_age = 0;
+	tx->prev = NULL;
+	tx->next = wal_txs;
+	if(wal_txs != NULL)
+		wal_txs->prev = tx;
+	wal_txs = tx;
+	pthread_mutex_unlock(&wal_mutex);
+	return 0;
+}
+
+/* Ends the calling thread's transaction and waits until it
+ * is durable.  Returns 0, or -1 if there is no transaction
+ * or it was already rolled back to avoid a deadlock.
+ */
+int commit_tx(){
+	int ret = 0;
+	int64_t lsn = 0;
+	transaction * tx = tx_current();
+
+	if(tx->tx_id == 0)
+		return -1;
+	if(tx->aborted)
+		ret = -1;
+	else
+		lsn = tx_finish(tx);
+	tx->tx_id = 0;
+	tx->aborted = 0;
+	wal_flush(lsn);
+	return ret;
+}
+
+/* Rolls back the calling thread's transaction.  Returns 0,
+ * or -1 if there is none.
+ */
+int abort_tx(){
+	transaction * tx = tx_current();
+
+	if(tx->tx_id == 0)
+		return -1;
+	if(!tx->aborted){
+		tx_rollback(tx);
+		tx_finish(tx); // 기다리지 않는다: 잃어버리면 복구가 다시 되돌린다
+	}
+	tx->tx_id = 0;
+	tx->aborted = 0;
+	return 0;
+}
+
+/* Called by a write of key before it touches the tree:
+ * locks key and, in a transaction, logs its before image.
+ * Returns -1 if the write must fail: the transaction has
+ * died, or key holds a value longer than TX_MAX_IMAGE that
+ * cannot be logged.  In the latter case the transaction
+ * goes on and a lock the write took anew is let go again.
+ * tx_write_end lets go of the lock of a write outside of a
+ * transaction.
+ */
+int tx_write_begin(int64_t key){
+	transaction * tx = tx_current();
+	record_lock * held;
+
+	if(tx->aborted)
+		return -1;
+	held = tx->locks;
+	if(lock_record(tx, key, 1) != 0){
+		tx_kill(tx);
+		return -1;
+	}
+	if(tx->tx_id != 0 && tx_log_undo(tx, key) != 0){
+		if(tx->locks != held) // lock_record가 새로 잡은 잠금은 맨 앞에 있다
+			unlock_newest_record(tx);
+		return -1;
+	}
+	return 0;
+}
+
+void tx_write_end(){
+	transaction * tx = tx_current();
+
+	if(tx->tx_id == 0){
+		unlock_records(tx);
+		tx->age = 0;
+	}
+}
+
+/* Called by a lookup of key: in a transaction, locks key
+ * shared.  Returns -1 if the lookup must fail.
+ */
+int tx_read_begin(int64_t key){
+	transaction * tx = tx_current();
+
+	if(tx->tx_id == 0)
+		return 0;
+	if(tx->aborted)
+		return -1;
+	if(lock_record(tx, key, 0) != 0){
+		tx_kill(tx);
+		return -1;
+	}
+	return 0;
+}
+
+// 트랜잭션 안이면 TX_END에서 한꺼번에 기다린다
+void tx_flush(int64_t lsn){
+	if(tx_current()->tx_id == 0)
+		wal_flush(lsn);
+}
+
+/* Rolls back the transactions that a crash cut short (see
+ * wal_recover).  Their before images are logged again as
+ * one transaction first, so that a crash in the middle
+ * finds them in the new log.
+ */
+void tx_recover(){
+	int i;
+	transaction * tx = tx_current();
+
+	if(recovery_num_undo == 0)
+		return;
+	begin_tx();
+	for(i=0; i < recovery_num_undo; i++)
+		tx_add_undo(tx, recovery_undo[i].key, recovery_undo[i].image, recovery_undo[i].length);
+	abort_tx();
+	wal_flush(wal_tail_lsn());
+	free(recovery_undo);
+	recovery_undo = NULL;
+	recovery_num_undo = 0;
+}
+
+int close_db(){
+	wal_stop_checkpointer();
+	pthread_rwlock_wrlock(&tree_lock);
+	wal_flush(wal_tail_lsn());
+	buf_flush_all();
+	fsync(fd);
+	cold_checkpoint();
+	wal_close();
+	pthread_rwlock_unlock(&tree_lock);
+	if(storage_mode == STORAGE_MMAP){
+		// 청크 단위로 늘려둔 파일을 실제 페이지 수로 되돌린다
+		if(ftruncate(fd, (((header_page*)frame_pages)->num_pages + 1) * PAGE_SIZE) != 0)
+			perror("Mapped file truncation.");
+		munmap(frame_pages, mmap_reserve);
+		munmap(frames, mmap_reserve / PAGE_SIZE * sizeof(buffer_frame));
+	}
+	else{
+		free(frame_pages);
+		free(frames);
+	}
+	free(page_table);
+	frames = NULL;
+	frame_pages = NULL;
+	page_table = NULL;
+	frame_count = 0;
+	io_close();
+	cold_close();
+	return close(fd);
+}
+
+/* Free space map.
+ * A set bit in a bitmap page is a page in use; bits for
+ * pages past the end of the file are set as well, so a
+ * clear bit is always a page that can be taken.  The
+ * bitmap of group g (pages g*BITMAP_GROUP and up) is page
+ * g*BITMAP_GROUP + 1, so the first one sits right after
+ * the header.  Each bitmap also counts its free pages, and
+ * a full group is passed over without reading its bits.
+ * Taking or returning a page changes and logs a few bytes
+ * of one bitmap page instead of the header and a list link.
+ *
+ * The file grows an extent at a time, an eighth of its
+ * size but between FREE_EXTENT_MIN and FREE_EXTENT_MAX
+ * pages, preallocated with fallocate so that the
+ * filesystem can lay it out contiguously.  Nothing is
+ * written to the new pages; they are only marked free.
+ *
+ * Pages are also grouped in aligned runs of ALLOC_RUN, a
+ * quarter of a bitmap word.  A page taken for a new
+ * neighbour of another (a split sibling, the next page of
+ * an overflow chain) comes from that page's run or the
+ * runs on either side when they have room, otherwise it
+ * opens a run nobody uses yet, whose rest is then left to
+ * the pages that split next to it.  bulk_load leaves a few
+ * pages of every run free for the same purpose, so leaves
+ * that split after a load keep their siblings within 64KB
+ * and the sibling chain does not jump to the end of the
+ * file.  Only when the group has no empty run left are
+ * holes elsewhere reused.
+ */
+#define FREE_EXTENT_MIN 64
+#define FREE_EXTENT_MAX 4096
+#define ALLOC_RUN 16
+
+int64_t bitmap_offset(int64_t page_number){ // 이 페이지를 맡은 비트맵 페이지
+	return (page_number / BITMAP_GROUP * BITMAP_GROUP + 1) * PAGE_SIZE;
+}
+
+// 새 그룹의 비트맵: 전부 쓰는 중으로 시작한다
+void bitmap_init(int64_t offset){
+	bitmap_page * map;
+
+	map = get_page(offset);
+	memset(map, 0, 64);
+	memset(map->bits, 0xFF, sizeof(map->bits));
+	put_page(offset, 1);
+}
+
+/* Marks pages first..last (page numbers) used or free. */
+void bitmap_mark(int64_t first, int64_t last, int used){
+	int64_t offset, end, i;
+	uint64_t bit;
+	bitmap_page * map;
+
+	while(first <= last){
+		offset = bitmap_offset(first);
+		end = (first / BITMAP_GROUP + 1) * BITMAP_GROUP - 1;
+		if(end > last)
+			end = last;
+		map = get_page(offset);
+		for(i = first % BITMAP_GROUP; i <= end % BITMAP_GROUP; i++){
+			bit = 1ULL << (i % 64);
+			if(((map->bits[i / 64] & bit) != 0) == used)
+				continue;
+			map->bits[i / 64] ^= bit;
+			map->num_free += used ? -1 : 1;
+			freepage_num += used ? -1 : 1;
+		}
+		put_page(offset, 1);
+		first = end + 1;
+	}
+}
+
+/* Grows the file to last (a page number): starts the
+ * bitmaps of new groups and marks the other new pages free.
+ */
+void bitmap_grow(header_page * header, int64_t last){
+	int64_t first = header->num_pages + 1, p, bitmaps;
+
+	if(last < first)
+		return;
+	if(last % BITMAP_GROUP == 0) // 그룹의 첫 페이지가 들어오면 그 비트맵도
+		last++;
+	// first 이후 첫 비트맵 페이지
+	bitmaps = (first + BITMAP_GROUP - 2) / BITMAP_GROUP * BITMAP_GROUP + 1;
+	for(p = bitmaps; p <= last; p += BITMAP_GROUP)
+		bitmap_init(p * PAGE_SIZE);
+	header->num_pages = last;
+	bitmap_mark(first, last, 0);
+	for(p = bitmaps; p <= last; p += BITMAP_GROUP)
+		bitmap_mark(p, p, 1);
+}
+
+void makefreepage(){ // 파일 끝에 extent 하나를 붙인다
+	int64_t count;
+	header_page * header;
+
+	header = get_page(0);
+	count = header->num_pages / 8;
+	if(count < FREE_EXTENT_MIN) count = FREE_EXTENT_MIN;
+	if(count > FREE_EXTENT_MAX) count = FREE_EXTENT_MAX;
+	// 블록만 미리 잡는다, 파일 크기는 페이지를 쓸 때 는다
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, (header->num_pages + 1) * PAGE_SIZE, count * PAGE_SIZE);
+	bitmap_grow(header, header->num_pages + count);
+	put_page(0, 1);
+}
+
+/* The first clear bit at or after start, or failing that
+ * the last one before it; -1 if the group is full.
+ */
+int bitmap_find(const bitmap_page * map, int start){
+	int w = start / 64;
+	uint64_t free_bits;
+
+	free_bits = ~map->bits[w] & (~0ULL << (start % 64));
+	for(; free_bits == 0 && ++w < BITMAP_GROUP / 64; )
+		free_bits = ~map->bits[w];
+	if(free_bits != 0)
+		return w * 64 + __builtin_ctzll(free_bits);
+
+	w = start / 64;
+	free_bits = ~map->bits[w] & ((1ULL << (start % 64)) - 1);
+	for(; free_bits == 0 && --w >= 0; )
+		free_bits = ~map->bits[w];
+	if(free_bits != 0)
+		return w * 64 + 63 - __builtin_clzll(free_bits);
+	return -1;
+}
+
+uint64_t bitmap_run(const bitmap_page * map, int r){ // 묶음 r 의 빈 페이지 비트
+	if(r < 0 || r >= BITMAP_GROUP / ALLOC_RUN)
+		return 0;
+	return ~map->bits[r / 4] >> (r % 4 * ALLOC_RUN) & 0xFFFF;
+}
+
+/* Finds a page in the group to put next to page start:
+ * a free one in start's run, after start if possible,
+ * else one in the run after or before it, else the first
+ * page of the nearest empty run.  Returns -1 if there is
+ * none of these.
+ */
+int bitmap_find_near(const bitmap_page * map, int start){
+	int r = start / ALLOC_RUN, k;
+	uint64_t free_bits = bitmap_run(map, r);
+
+	if(free_bits >> start % ALLOC_RUN != 0)
+		return start + __builtin_ctzll(free_bits >> start % ALLOC_RUN);
+	if(free_bits != 0)
+		return r * ALLOC_RUN + 63 - __builtin_clzll(free_bits);
+	if((free_bits = bitmap_run(map, r + 1)) != 0)
+		return (r + 1) * ALLOC_RUN + __builtin_ctzll(free_bits);
+	if((free_bits = bitmap_run(map, r - 1)) != 0)
+		return (r - 1) * ALLOC_RUN + 63 - __builtin_clzll(free_bits);
+
+	for(k = r + 2; k < BITMAP_GROUP / ALLOC_RUN; k++)
+		if(bitmap_run(map, k) == 0xFFFF)
+			return k * ALLOC_RUN;
+	for(k = r - 2; k >= 0; k--)
+		if(bitmap_run(map, k) == 0xFFFF)
+			return k * ALLOC_RUN;
+	return -1;
+}
 
-void makefreepage(){ //여기서 헤더페이지의 Number of page 관리해야될 것 같음, 나중에 구현
+/* Takes a free page and returns its offset.  With a hint
+ * (the offset of the page it will sit next to) it is the
+ * page bitmap_find_near picks in the hint's group, else
+ * the nearest free page there; without one, or if that
+ * group is full, the first free page of the next group
+ * that has any.  A new extent is added if no group has one.
+ */
+int64_t takefreepage(int64_t hint){
+	int64_t start = hint / PAGE_SIZE, num_pages, g, k, num_groups, offset;
 	int i;
-	lseek(fd,0,SEEK_SET);
-	int64_t F_O,val,N_F_O;
-	read(fd,&F_O,8); // 마지막 남은 프리페이지의 오프셋을 읽는다
-
-	for(i=0; i<11; i++){
-		lseek(fd,F_O+(i*4096),SEEK_SET);
-		val = F_O + ((i+1)*4096); // next free page offset
-		write(fd,&val,8);
-	}
-	lseek(fd,F_O+40960,SEEK_SET);
-	val = -1; // 마지막 프리페이지의 next free page offset은 -1, 즉 존재하지 않음
-	write(fd,&val,8);
-	freepage_num += 10; // 프리페이지 열개 추가
-}
-
-int64_t takefreepage(){ // 프리페이지의 오프셋 반환
-			   		// 프리페이지가 1개밖에 없는 경우 프리페이지 10개 생성
-	lseek(fd,0,SEEK_SET);
-	int64_t F_O,NF_O; //Free Page Offset
-	read(fd,&F_O,8);
-	if(freepage_num == 1){
+	header_page * header;
+	bitmap_page * map;
+
+	while(1){
+		header = get_page(0);
+		num_pages = header->num_pages;
+		put_page(0, 0);
+		if(start > num_pages)
+			start = 0;
+		num_groups = num_pages / BITMAP_GROUP + 1;
+		for(k = 0; k < num_groups; k++){
+			g = (start / BITMAP_GROUP + k) % num_groups;
+			offset = (g * BITMAP_GROUP + 1) * PAGE_SIZE;
+			map = get_page(offset);
+			i = -1;
+			if(map->num_free > 0 && k == 0 && hint != 0)
+				i = bitmap_find_near(map, start % BITMAP_GROUP);
+			if(map->num_free > 0 && i < 0)
+				i = bitmap_find(map, k == 0 ? start % BITMAP_GROUP : 0);
+			put_page(offset, 0);
+			if(i >= 0){
+				bitmap_mark(g * BITMAP_GROUP + i, g * BITMAP_GROUP + i, 1);
+				return (g * BITMAP_GROUP + i) * PAGE_SIZE;
+			}
+		}
 		makefreepage();
 	}
-	freepage_num--; //프리페이지 갯수 차감
-	lseek(fd,0,SEEK_SET);
-	NF_O = F_O + 4096;
-	
-	write(fd,&NF_O,8); // 헤더페이지의 프리페이지 오프셋 변경
-	printf("take free page %ld\n", F_O);
-	return F_O;
 }
 
 int open_db(char * pathname){
 	int i;
-	int64_t buf, val;
-	if ( (fd = open(pathname, O_RDWR|O_SYNC , 0777)) > 0){
-		lseek(fd,0,SEEK_SET);
+	int64_t p;
+	header_page * header;
+	bitmap_page * map;
+
+#ifdef SLOTTED_LEAF_LAYOUT
+	leaf_order = LEAF_ORDER; // leaf는 바이트로만 찬다
+#else
+	if(leaf_order < 3 || leaf_order > LEAF_ORDER)
+		leaf_order = LEAF_ORDER;
+#endif
+	if(internal_order < 3 || internal_order > INTERNAL_ORDER)
+		internal_order = INTERNAL_ORDER;
+	search_init();
+
+	if ( (fd = open(pathname, O_RDWR, 0777)) > 0){
+		io_open();
+		if(cold_open(pathname, 0) != 0)
+			return -1;
+		if(storage_mode == STORAGE_MMAP ? mmap_init() != 0 : buf_init(buffer_frames) != 0)
+			return -1;
+		if(wal_open(pathname) != 0)
+			return -1;
+		wal_recover(); // 지난번에 close_db 없이 끝났다면 로그가 남아있다
+		if(wal_reset() != 0)
+			return -1;
+		wal_start_checkpointer();
+		header = get_page(0);
+		i = header->page_layout != PAGE_LAYOUT;
+		put_page(0, 0);
+		if(i){ // 다른 레이아웃으로 빌드된 파일
+			close_db();
+			return -1;
+		}
+		header = get_page(0);
+		freepage_num = 0;
+		for(p = 1; p <= header->num_pages; p += BITMAP_GROUP){
+			map = get_page(p * PAGE_SIZE);
+			freepage_num += map->num_free;
+			put_page(p * PAGE_SIZE, 0);
+		}
+		put_page(0, 0);
+		tx_recover(); // 끝나지 않은 트랜잭션을 되돌린다
 		return 0;// 존재하는 파일
 	}
-	else if( (fd = open(pathname, O_RDWR | O_CREAT | O_SYNC, 0777)) > 0){
-		val = 4096; //Free Page Offset 초기화
-		write(fd,&val,8); 
-		val = -1; // Root Page Offset -1, 존재하지 않음
-		write(fd,&val,8); // Root page offset
-		val = 10; // Number of pages, 처음에 프리페이지 10개 만듬
-		write(fd,&val,8);
-		
-		for(i=0; i<10; i++){
-			lseek(fd,(i+1)*4096,SEEK_SET);
-			val = (i+2)*4096;
-			write(fd,&val,8);
-		} //프리페이지 열개 생성, 첫번째 프리페이지 주소 = 4096
-		//열번째 프리페이지 주소 = 40960
-		val = -1;
-		lseek(fd,40960,SEEK_SET); //마지막 프리페이지로 이동
-		write(fd,&val,8); //마지막 프리페이지의 next 프리페이지 = -1, 즉 존재하지 않는다.
-		freepage_num = 10;
+	else if( (fd = open(pathname, O_RDWR | O_CREAT, 0777)) > 0){
+		io_open();
+		if(cold_open(pathname, 1) != 0)
+			return -1;
+		if(storage_mode == STORAGE_MMAP ? mmap_init() != 0 : buf_init(buffer_frames) != 0)
+			return -1;
+		if(wal_open(pathname) != 0 || wal_reset() != 0)
+			return -1;
+		wal_start_checkpointer();
+		wal_begin();
+		header = get_page(0);
+		memset(header, 0, PAGE_SIZE);
+		header->root_page_offset = -1; // 루트 없음
+		header->num_pages = 1; // 첫 그룹의 비트맵
+		header->page_layout = PAGE_LAYOUT;
+		bitmap_init(PAGE_SIZE);
+		put_page(0, 1);
+		freepage_num = 0;
+		makefreepage(); // 첫 extent
+		wal_flush(wal_commit());
 		return 0;// 새로운 파일 생성	
 	}// succuess
 	else
 		return -1; // fail
 }
 
-char * find(int64_t key){
+/* Overflow chains.
+ * The part of a long value past its inline prefix is cut
+ * into OVERFLOW_DATA-byte pieces on free pages; all the
+ * pages are taken before any is written, each near the
+ * one before, so a chain usually runs forward through the
+ * file.  The caller holds tree_lock inside a logged
+ * operation, so a chain is written, and freed, atomically
+ * with the record that points to it.
+ */
+void return_freepage(int64_t N_offset);
+
+int64_t overflow_write(const char * data, int64_t length){
+	int64_t i, count, n, * offsets, first;
+	overflow_page * page;
+
+	count = (length + OVERFLOW_DATA - 1) / OVERFLOW_DATA;
+	offsets = (int64_t*)malloc(sizeof(int64_t) * count);
+	if(offsets == NULL){
+		perror("Overflow chain.");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i < count; i++)
+		offsets[i] = takefreepage(i > 0 ? offsets[i - 1] : 0);
+	for(i = 0; i < count; i++){
+		n = length < OVERFLOW_DATA ? length : OVERFLOW_DATA;
+		page = get_page(offsets[i]);
+		page->next_overflow_offset = i + 1 < count ? offsets[i + 1] : 0;
+		memcpy(page->data, data, n);
+		memset(page->data + n, 0, OVERFLOW_DATA - n);
+		put_page(offsets[i], 1);
+		data += n;
+		length -= n;
+	}
+	first = offsets[0];
+	free(offsets);
+	return first;
+}
+
+// 체인 앞에서부터 length 바이트를 읽는다
+void overflow_read(int64_t offset, char * data, int64_t length){
+	int64_t n, next;
+	overflow_page * page;
+
+	while(length > 0 && offset != 0){
+		n = length < OVERFLOW_DATA ? length : OVERFLOW_DATA;
+		page = get_page(offset);
+		memcpy(data, page->data, n);
+		next = page->next_overflow_offset;
+		put_page(offset, 0);
+		data += n;
+		length -= n;
+		offset = next;
+	}
+}
+
+void overflow_free(int64_t offset){
+	int64_t next;
+	overflow_page * page;
+
+	while(offset != 0){
+		page = get_page(offset);
+		next = page->next_overflow_offset;
+		put_page(offset, 0);
+		return_freepage(offset);
+		offset = next;
+	}
+}
+
+/* Replaces an overflow stub with the first VALUE_SIZE
+ * bytes of its value (zero-padded), which is what find
+ * and the cursors hand out; use find_value for the whole
+ * value.  Other records are left as they are.
+ */
+void overflow_resolve(char * value){
+	int64_t length;
+	overflow_stub * stub = (overflow_stub*)value;
+
+	if(!is_overflow(value))
+		return;
+	length = stub->length < VALUE_SIZE ? stub->length : VALUE_SIZE;
+	if(length > OVERFLOW_PREFIX)
+		overflow_read(stub->first_page_offset, value + OVERFLOW_PREFIX, length - OVERFLOW_PREFIX);
+	memset(value + length, 0, VALUE_SIZE - length);
+}
+
+/* Latches the leaf L_O that find_leaf returned for key
+ * exclusively, or the leaf to its right that key moved to
+ * in a split since, and returns its offset.
+ */
+int64_t latch_leaf(int64_t L_O, int64_t key){
+	int64_t next;
+	leaf_page * leaf;
+
+	while(1){
+		latch_page(L_O, 1);
+		leaf = get_page(L_O);
+		next = node_moved_right((node_page*)leaf, key) ? leaf->right_sibling_offset : 0;
+		put_page(L_O, 0);
+		if(next == 0)
+			return L_O;
+		unlatch_page(L_O);
+		L_O = next;
+	}
+}
+
+/* The reading side of latch_leaf: gets the leaf for key
+ * with get_page_shared, starting at *L_O and moving right,
+ * and leaves its offset in *L_O for put_page_shared.
+ */
+leaf_page * get_leaf_shared(int64_t * L_O, int64_t key, leaf_page * copy){
+	int64_t next;
+	leaf_page * leaf;
+
+	while(1){
+		leaf = get_page_shared(*L_O, copy);
+		next = node_moved_right((node_page*)leaf, key) ? leaf->right_sibling_offset : 0;
+		if(next == 0)
+			return leaf;
+		put_page_shared(*L_O);
+		*L_O = next;
+	}
+}
+
+/* Copies the value under key into value (if not NULL).
+ * Returns 0 if the key exists, -1 otherwise.
+ * The caller holds tree_lock, shared or exclusive.
+ */
+int find_record(int64_t key, char * value){
 		
-	int i = 0, num_keys;
-	int64_t page_offset, keys;
-	char *re;
-	
-	re = (char*)malloc(sizeof(char)*120);
+	int i = 0;
+	int64_t page_offset;
+	leaf_page * leaf, copy;
 
 	page_offset = find_leaf(key);
-	if(page_offset == -1) return NULL; 
+	if(page_offset == -1) return -1; 
 
-	lseek(fd,page_offset+12,SEEK_SET);
-	read(fd,&num_keys,4);
-	
-	if(num_keys == 0) return NULL;
+	leaf = get_leaf_shared(&page_offset, key, &copy);
+	i = leaf_lower_bound(leaf, key);
+	if ( i == leaf->num_keys || LEAF_KEY(leaf, i) != key){
+		put_page_shared(page_offset);
+		return -1;
+	}
+	if(value != NULL)
+		leaf_value(leaf, i, value);
+	put_page_shared(page_offset);
+	return 0;
+}
 
-	lseek(fd,page_offset+128,SEEK_SET);
-	for(i=0; i < num_keys; i++){
-		read(fd,&keys,8);
-		if(key == keys) break;
-		lseek(fd,120,SEEK_CUR);
+char * find(int64_t key){
+	char * re;
+
+	if(tx_read_begin(key) != 0)
+		return NULL;
+	re = (char*)malloc(sizeof(char)*VALUE_SIZE);
+	pthread_rwlock_rdlock(&tree_lock);
+	if(find_record(key, re) != 0){
+		free(re);
+		re = NULL;
 	}
-	if ( i == num_keys) return NULL;
-	else{
-		read(fd,re,120);
-		return re;
+	else
+		overflow_resolve(re);
+	pthread_rwlock_unlock(&tree_lock);
+	return re;
+}
+
+/* Returns the whole value under key in a malloc'd buffer
+ * and its length in *length, or NULL if the key does not
+ * exist.  The buffer has one more byte, a NUL, after the
+ * value.
+ */
+char * tree_find_value(int64_t key, int64_t * length){
+	char record[VALUE_SIZE], * re = NULL;
+	overflow_stub * stub = (overflow_stub*)record;
+
+	pthread_rwlock_rdlock(&tree_lock);
+	if(find_record(key, record) == 0){
+		*length = is_overflow(record) ? stub->length : (int64_t)strnlen(record, VALUE_SIZE);
+		re = (char*)malloc(*length + 1);
+		if(re == NULL){
+			perror("Value read.");
+			exit(EXIT_FAILURE);
+		}
+		if(is_overflow(record)){
+			memcpy(re, stub->prefix, *length < OVERFLOW_PREFIX ? *length : OVERFLOW_PREFIX);
+			if(*length > OVERFLOW_PREFIX)
+				overflow_read(stub->first_page_offset, re + OVERFLOW_PREFIX, *length - OVERFLOW_PREFIX);
+		}
+		else
+			memcpy(re, record, *length);
+		re[*length] = 0;
 	}
+	pthread_rwlock_unlock(&tree_lock);
+	return re;
 }
 
+char * find_value(int64_t key, int64_t * length){
+	if(tx_read_begin(key) != 0)
+		return NULL;
+	return tree_find_value(key, length);
+}
+
+/* Descends to the leaf for key.  Each node is latched
+ * only while it is read (or not at all, see Concurrency),
+ * and a node that split after its parent was read is left
+ * to the right (see B-link).
+ */
 int64_t find_leaf(int64_t key){
-	int i, num_keys; 
-	int64_t R_O, isLeaf, keys, page_offset, buf;
-	lseek(fd,8,SEEK_SET);
-	read(fd,&R_O,8); //root page offset 읽기
+	int i;
+	int64_t R_O, page_offset, next_offset;
+	header_page * header;
+	internal_page * page, copy;
+
+	header = get_page(0);
+	R_O = header->root_page_offset; //root page offset 읽기
+	put_page(0, 0);
 	if (R_O == -1) return -1; // 실패, 아무 키도 존재하지 않음
-	
-	lseek(fd,R_O+8,SEEK_SET); // 루트페이지로 이동 후 8바이트이동, 즉  Is_Leaf로 이동
-	read(fd,&isLeaf,4); 
-	page_offset = R_O; // root page offset
-
-	while(!isLeaf){
-		i = 0;
-		lseek(fd,page_offset+12,SEEK_SET);
-		read(fd,&num_keys,4); //root page키의 개수
-		lseek(fd,page_offset+128,SEEK_SET); // root page의 첫번째 키 값으로 이동
-		while (i < num_keys){
-			read(fd,&keys,8); // key 값 읽음
-			lseek(fd,8,SEEK_CUR); //페이지 오프셋은 건너뛰어
-			if (key >= keys) i++;
-			else{
-				lseek(fd,-16,SEEK_CUR); // 작은 경우 back
-				break;
-			}
-		} //계산상 현재 오프셋보다 8 뒤로 이동해야함
-		lseek(fd,-8,SEEK_CUR); 
-		read(fd,&page_offset,8); // 이동해야 할 페이지 오프셋을 받는다.
-		lseek(fd,page_offset+8,SEEK_SET);
-		read(fd,&isLeaf,4); // isLeaf 확인
+
+	page_offset = R_O;
+	while(1){
+		page = get_page_shared(page_offset, &copy);
+		if(node_moved_right((node_page*)page, key))
+			next_offset = node_right((node_page*)page); // 그새 쪼개졌다, 오른쪽으로
+		else if(page->is_leaf)
+			next_offset = -1;
+		else{
+			i = internal_child_index(page, key);
+			// i == 0 이면 맨 왼쪽 자식, 아니면 entries[i-1]의 자식
+			next_offset = i == 0 ? page->leftmost_offset : ENTRY_OFFSET(page, i-1);
+		}
+		put_page_shared(page_offset);
+		if(next_offset == -1)
+			return page_offset; // Leaf의 page offset
+		page_offset = next_offset;
+	}
+}
+
+/* Like find_leaf, but also sets *high to the smallest
+ * separator above key on the way down (INT64_MAX if there
+ * is none): every key in [key, high) is in the same leaf.
+ */
+int64_t find_leaf_high(int64_t key, int64_t * high){
+	int i;
+	int64_t R_O, page_offset, next_offset;
+	header_page * header;
+	internal_page * page;
+
+	*high = INT64_MAX;
+	header = get_page(0);
+	R_O = header->root_page_offset;
+	put_page(0, 0);
+	if (R_O == -1) return -1;
+
+	page_offset = R_O;
+	page = get_page(page_offset);
+	while(!page->is_leaf){
+		i = internal_child_index(page, key);
+		if(i < page->num_keys) // 아래로 갈수록 범위가 좁아진다
+			*high = ENTRY_KEY(page, i);
+		next_offset = i == 0 ? page->leftmost_offset : ENTRY_OFFSET(page, i-1);
+		put_page(page_offset, 0);
+		page_offset = next_offset;
+		page = get_page(page_offset);
 	}
-	return page_offset; // Leaf의 page offset
+	put_page(page_offset, 0);
+	return page_offset;
 }
-//디버깅 완료
 
-int64_t make_node(){
+int64_t make_node(int64_t near){
 
-	int is_Leaf;
-	int64_t parent_offset, offset;
-	parent_offset = -1; // Parent = -1, 아직 설정하지 않았음
-	offset = takefreepage();
+	int64_t offset;
+	node_page * node;
 
-	lseek(fd,offset,SEEK_SET);
-	write(fd,&parent_offset,8);
-	is_Leaf = 0;
-	write(fd,&is_Leaf,4); // is_Leaf = 0
-	write(fd,&is_Leaf,4); // num_keys = 0
+	offset = takefreepage(near);
+	node = get_page(offset);
+	memset(node, 0, PAGE_SIZE);
+	node->parent_page_offset = -1; // Parent = -1, 아직 설정하지 않았음
+	node->is_leaf = 0;
+	node->num_keys = 0;
+	put_page(offset, 1);
 
 	return offset;
 }
-//디버깅 완료
 
-int64_t make_leaf(){
+int64_t make_leaf(int64_t near){
 
 	int64_t L_O;
-	int is_Leaf = 1;
-	L_O = make_node();
-	lseek(fd,L_O+8,SEEK_SET);
-	write(fd,&is_Leaf,4); // is_Leaf = 1
-	
+	leaf_page * leaf;
+
+	L_O = make_node(near);
+	leaf = get_page(L_O);
+	leaf->is_leaf = 1;
+	leaf->right_sibling_offset = 0; // 가장 오른쪽 리프
+	put_page(L_O, 1);
+
 	return L_O;
 }
 
-//디버깅 완료
 int64_t start_new_tree(int64_t key, char * value){
-	int64_t F_O, val, L_O, R_O, R_S_O;
-	int isLeaf,num_keys;
-	L_O = make_leaf();// 리프 만듬 
-	lseek(fd,L_O+128,SEEK_SET); //Leaf node의 첫번째 키 값으로 이동
-	write(fd,&key,8);
-	write(fd,value,120);
-	num_keys = 1;
-	lseek(fd,L_O+12,SEEK_SET);
-	write(fd,&num_keys,4);
-	lseek(fd,8,SEEK_SET);
-	write(fd,&L_O,8); // Root page offset 설정
-	R_S_O = 0;
-	lseek(fd,L_O+120,SEEK_SET);
-	write(fd,&R_S_O,8);
+	int64_t L_O;
+	leaf_page * leaf;
+	header_page * header;
+
+	L_O = make_leaf(0);// 리프 만듬 
+	leaf = get_page(L_O);
+	leaf_insert(leaf, 0, key, value);
+	put_page(L_O, 1);
+
+	header = get_page(0);
+	header->root_page_offset = L_O; // Root page offset 설정
+	put_page(0, 1);
 	return 0;
 }
 
-//디버깅 완료
 int insert_into_leaf(int64_t L_O, int64_t key, char* value){
-	int insertion_point,num_keys, copy;
-	int64_t leaf_key;
-	char leaf_value[120];
-
-	lseek(fd,L_O+12,SEEK_SET); // L_O number of keys 로이동
-	read(fd,&num_keys,4);
+	int insertion_point;
+	leaf_page * leaf;
 
-	lseek(fd,L_O +128*num_keys,SEEK_SET); //L_O 마지막 키 값으로 이동
-	read(fd,&leaf_key,8);
-	read(fd,leaf_value,120);
+	leaf = get_page(L_O);
 
-	insertion_point = num_keys;
-
-	while(insertion_point > 0 && leaf_key > key){
-		lseek(fd,L_O+128*(insertion_point+1),SEEK_SET);
-		write(fd,&leaf_key,8);
-		write(fd,leaf_value,120);
-
-		insertion_point--;
-
-		lseek(fd,L_O + insertion_point * 128,SEEK_SET);
-		read(fd,&leaf_key,8);
-		read(fd,leaf_value,120);
-	}
-	
-	lseek(fd,L_O + (insertion_point+1)*128,SEEK_SET);
-	write(fd,&key,8);
-	write(fd,value,120);
+	insertion_point = leaf_lower_bound(leaf, key);
 
-	lseek(fd,L_O+12,SEEK_SET);
-	num_keys++;
-	write(fd,&num_keys,4);
+	leaf_insert(leaf, insertion_point, key, value);
 
+	put_page(L_O, 1);
 	return 0;
 }
 
-//디버깅완료
 int insert_into_node(int64_t P_O, int64_t N_key, int64_t N_L_O){
 
-	int num_keys, insertion_point;
-	int64_t node_key, page_offset, A = N_key, B = N_L_O;
+	int ret;
+	internal_page * parent;
 
-	lseek(fd,P_O+12,SEEK_SET);
-	read(fd,&num_keys,4);
-	
-	insertion_point = num_keys;
-	lseek(fd,P_O+128+(num_keys-1)*16,SEEK_SET);
-	
-	read(fd,&node_key,8);
-	read(fd,&page_offset,8);
-	
-	while(insertion_point > 0 && node_key > N_key){
-		lseek(fd,P_O+128+((insertion_point)*16),SEEK_SET);
-		write(fd,&node_key,8);
-		write(fd,&page_offset,8);
+	parent = get_page(P_O);
+	ret = internal_insert(parent, internal_lower_bound(parent, N_key), N_key, N_L_O);
+	put_page(P_O, ret == 0);
+	return ret;
+}
 
-		insertion_point--;
-		lseek(fd,P_O+128+((insertion_point-1)*16),SEEK_SET);
-		read(fd,&node_key,8);
-		read(fd,&page_offset,8);
+/* Splits the internal page P_O whose n entries, given in
+ * keys and offsets, no longer fit in it.  The middle key
+ * goes up into the parent.
+ */
+int split_internal(int64_t P_O, const int64_t * keys, const int64_t * offsets, int n){
+
+	int i, split;
+	int64_t N_P_O, mid_key, child_offset;
+	internal_page * old_node, * new_node;
+	node_page * child;
+
+	N_P_O = make_node(P_O);
+	old_node = get_page(P_O);
+	new_node = get_page(N_P_O);
+
+	/* keys[split-1]은 부모로 올라가고, 그 자식은
+	 * 새 노드의 맨 왼쪽 자식이 된다.
+	 */
+	split = cut(n);
+	internal_store(old_node, keys, offsets, split - 1);
+
+	mid_key = keys[split - 1];
+	new_node->leftmost_offset = offsets[split - 1];
+	internal_store(new_node, keys + split, offsets + split, n - split);
+	new_node->parent_page_offset = old_node->parent_page_offset;
+	node_link((node_page*)new_node, old_node->right_sibling_offset, old_node->high_key);
+	node_link((node_page*)old_node, N_P_O, mid_key);
+
+	/* 옮겨진 자식들의 부모를 새 노드로 바꿔준다. */
+	for(i = -1; i < new_node->num_keys; i++){
+		child_offset = i == -1 ? new_node->leftmost_offset : ENTRY_OFFSET(new_node, i);
+		child = get_page(child_offset);
+		child->parent_page_offset = N_P_O;
+		put_page(child_offset, 1);
 	}
 
-	lseek(fd,P_O+128+((insertion_point)*16),SEEK_SET);
-	write(fd,&A,8);
-	write(fd,&B,8);
-	
-	lseek(fd,P_O+12,SEEK_SET);
-	num_keys++;
-	write(fd,&num_keys,4);
-	return 0;
+	put_page(N_P_O, 1);
+	put_page(P_O, 1);
+	return insert_into_parent(P_O, N_P_O, mid_key);
 }
 
-
 int insert_into_node_after_splitting(int64_t P_O, int64_t N_key, int64_t N_L_O){ 
 	
-	int i,j,insertion_point,num_keys;
-	int64_t N_P_O, node_key, node_offset,copy_key,copy_offset,N_offset, mid_key,mid_offset;
+	int n, insertion_point;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+	internal_page * old_node;
 	
-	N_P_O = make_node();
-	/*lseek(fd,L_O,SEEK_SET);
-	write(fd,&N_P_O,8);
-	*/
-	
-	lseek(fd,P_O+12,SEEK_SET); // 추가할 P_O의 number of keys 로 이동
-	read(fd,&num_keys,4);
+	/* 새 키를 넣은 상태의 엔트리들을 순서대로 모은다. */
+	old_node = get_page(P_O);
+	insertion_point = internal_lower_bound(old_node, N_key);
+	n = internal_load(old_node, keys, offsets);
+	put_page(P_O, 0);
+
+	memmove(&keys[insertion_point + 1], &keys[insertion_point], sizeof(int64_t) * (n - insertion_point));
+	memmove(&offsets[insertion_point + 1], &offsets[insertion_point], sizeof(int64_t) * (n - insertion_point));
+	keys[insertion_point] = N_key;
+	offsets[insertion_point] = N_L_O;
+
+	return split_internal(P_O, keys, offsets, n + 1);
+}
 
-	lseek(fd,P_O+128+((num_keys-1)*16),SEEK_SET); // 추가할 P_O의 마지막 키 값으로 이동
-	read(fd,&node_key,8);
-	read(fd,&node_offset,8);
+int insert_into_parent(int64_t L_O, int64_t N_L_O, int64_t N_key){
+	int64_t P_O, R_O; //Parent offset, Root offset
+	node_page * left, * right;
+	internal_page * root;
+	header_page * header;
 
-	insertion_point = num_keys;
+	left = get_page(L_O);
+	P_O = left->parent_page_offset; // 왼쪽 노드의 부모 오프셋
+	put_page(L_O, 0);
 
-	while(insertion_point > 0 && node_key > N_key){
-		lseek(fd,P_O+128+((insertion_point)*16),SEEK_SET);
-		write(fd,&node_key,8);
-		write(fd,&node_offset,8);
-		
-		insertion_point--;
-		lseek(fd,P_O + 128 + ((insertion_point-1)*16),SEEK_SET);
-		read(fd,&node_key,8);
-		read(fd,&node_offset,8);
+	if(P_O == -1){ //부모가 존재하지 않는다, 새로운 루트 생성해야 함
+		R_O = make_node(L_O);
+		root = get_page(R_O);
+		root->leftmost_offset = L_O;
+		internal_insert(root, 0, N_key, N_L_O);
+		put_page(R_O, 1);
+
+		header = get_page(0);
+		header->root_page_offset = R_O; //헤더페이지에서 이어줌
+		put_page(0, 1);
+
+		//이제 자식들의 부모를 이어주자
+		left = get_page(L_O);
+		left->parent_page_offset = R_O;
+		put_page(L_O, 1);
+		right = get_page(N_L_O);
+		right->parent_page_offset = R_O;
+		put_page(N_L_O, 1);
+		return 0;
 	}
 
-	lseek(fd,P_O+128+(insertion_point*16),SEEK_SET);
-	write(fd,&N_key,8);
-	write(fd,&N_L_O,8);
-	
-	//아 123빼고 옮겨야 하구나! 해결했다 씨바 123오프셋값을 맨왼쪽에 써주고 124 올리면 된다
-	//그리고 자식의 부모 오프셋값을 N_P_O해주면 되겠다.
-	
-	int split = cut(internal_order); //4 -> 2, 5-> 3, 6-> 3
-//여기 밑에 좀 이상해
-	lseek(fd,P_O+128+(16*(split-1)),SEEK_SET);
-	read(fd,&mid_key,8);
-	read(fd,&mid_offset,8);
-	
-	lseek(fd,mid_offset,SEEK_SET);
-	write(fd,&N_P_O,8);
+	if(insert_into_node(P_O, N_key, N_L_O) == 0){ // 스플릿 안생기니까 여기서 부모 자식 이어주자
+		right = get_page(N_L_O);
+		right->parent_page_offset = P_O;
+		put_page(N_L_O, 1);
+		return 0;
+	}
+	return insert_into_node_after_splitting(P_O, N_key, N_L_O);
+}
 
-	lseek(fd,N_P_O+120,SEEK_SET);
-	write(fd,&mid_offset,8);
+/* Puts the records of a full leaf and the new one into
+ * temp in key order and returns their number; the first
+ * *split of them stay in the leaf when it splits.
+ */
+int leaf_split_records(const leaf_page * leaf, int64_t key, const char * value, leaf_record * temp, int * split){
+	int i, j, n, insertion_point;
+	int ends[LEAF_ORDER];
 
-	for(i=split, j=0; i < internal_order; i++,j++){
-		lseek(fd,P_O+128+(i*16),SEEK_SET);
-		read(fd,&copy_key,8);
-		read(fd,&copy_offset,8);
+	insertion_point = leaf_lower_bound(leaf, key);
 
-		lseek(fd,copy_offset,SEEK_SET);
-		write(fd,&N_P_O,8);
-		
-		lseek(fd,N_P_O+128+(j*16),SEEK_SET);
-		write(fd,&copy_key,8);
-		write(fd,&copy_offset,8);
+	for(i=0, j=0; i < leaf->num_keys; i++, j++){
+		if(j == insertion_point) j++;
+		leaf_load(leaf, i, &temp[j]);
 	}
-	
-	/* 이 부분은 디버깅 해봐야 해, 뭐를 올리는지 아직 정확하게는 몰라! */
+	temp[insertion_point].key = key;
+	memcpy(temp[insertion_point].value, value, VALUE_SIZE);
+
+	n = leaf->num_keys + 1;
+	leaf_partition(temp, n, ends); // 넘친 레코드는 하나뿐이라 두 리프면 된다
+	*split = ends[0];
+	return n;
+}
+
+int insert_into_leaf_after_splitting(int64_t L_O, int64_t key, char * value){
+	int n, split;
+	int64_t N_L_O, N_key; //new leaf offset
+	leaf_record temp[LEAF_ORDER];
+	leaf_page * leaf, * new_leaf;
+
+	N_L_O = make_leaf(L_O); // 형제는 되도록 바로 뒤에
+	leaf = get_page(L_O);
+	new_leaf = get_page(N_L_O);
+
+	/* 앞쪽 split개는 원래 리프에, 나머지는 새 리프에 */
+	n = leaf_split_records(leaf, key, value, temp, &split);
+	leaf_store(leaf, temp, split);
+	leaf_store(new_leaf, &temp[split], n - split);
+
+	//새 리프가 이전 노드의 오른쪽 링크와 high key를 물려받는다
+	new_leaf->parent_page_offset = leaf->parent_page_offset;
+	N_key = leaf_separator(LEAF_KEY(leaf, leaf->num_keys - 1), LEAF_KEY(new_leaf, 0));
+	node_link((node_page*)new_leaf, leaf->right_sibling_offset, leaf->high_key);
+	node_link((node_page*)leaf, N_L_O, N_key);
+
+	put_page(N_L_O, 1);
+	put_page(L_O, 1);
+	return insert_into_parent(L_O, N_L_O, N_key); //부모 공유는 여기서!
+}
+
+
+/* Inserts a key that is not in the tree yet.  value is a
+ * VALUE_SIZE record.  The caller holds tree_lock inside a
+ * logged operation.
+ */
+int insert_record(int64_t key, char * value){
+
+	int64_t R_O, L_O; // root page offset, leaf page offset
+	int has_room;
+	header_page * header;
+	leaf_page * leaf;
+
+	header = get_page(0);
+	R_O = header->root_page_offset;
+	put_page(0, 0);
 
-	lseek(fd,P_O+12,SEEK_SET);
-	num_keys = split - 1;
-	write(fd,&num_keys,4);
+	if(R_O == -1)
+		return start_new_tree(key,value);
+
+	L_O = find_leaf(key); //넣어야 할 리프 페이지의 오프셋 받음
 
-	lseek(fd,N_P_O+12,SEEK_SET);
-	num_keys = internal_order - split;
-	write(fd,&num_keys,4);
-	printf("insert into parent after splitting\n");
-	//이제 부모 설정은 insert into parent한테 맡긴다.
-	return insert_into_parent(P_O,N_P_O,mid_key);
+	leaf = get_page(L_O);
+	has_room = leaf_has_room(leaf, 1, leaf_record_size(value));
+	put_page(L_O, 0);
+
+	if (has_room) // 꽉 찬 리프면 나눠야 한다
+		return insert_into_leaf(L_O,key,value);
+	else
+		return insert_into_leaf_after_splitting(L_O,key,value);
 }
 
-//여기맨 밑 전까지 디버깅
-int insert_into_parent(int64_t L_O, int64_t N_L_O, int64_t N_key){
-	//맨처음 리프노드의 parent를 내가 -1로 했다는 가정 하에 작성해봄
-	//즉 루트가 리프인 경우를  생각해야 하니까
-	int num_keys;
-	int64_t P_O, R_O; //Parent offset, New key, Root offset
+/* Splits the full leaf L_O, which the caller has latched,
+ * with tree_lock held shared (see Concurrency), if its
+ * parent takes the separator without splitting.  Returns
+ * 0, or 1 if the split has to run with tree_lock
+ * exclusive.
+ */
+int split_in_leaf(int64_t L_O, int64_t key, char * value, int64_t * lsn){
+	int i, n, split, fits, same;
+	int64_t P_O, separator;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+	leaf_record temp[LEAF_ORDER];
+	leaf_page * leaf;
+	internal_page * parent;
+
+	leaf = get_page(L_O);
+	P_O = leaf->parent_page_offset;
+	n = leaf_split_records(leaf, key, value, temp, &split);
+	put_page(L_O, 0);
+	if(P_O == -1)
+		return 1; // 루트가 바뀐다
+	separator = leaf_separator(temp[split - 1].key, temp[split].key);
+
+	// 부모는 기다리지 않는다: 위에서 내려오는 쪽과 순서가 거꾸로다
+	same = page_latch(P_O) == page_latch(L_O);
+	if(!same && try_latch_page(P_O) != 0)
+		return 1;
+	parent = get_page(P_O);
+	i = internal_lower_bound(parent, separator);
+	n = internal_load(parent, keys, offsets);
+	put_page(P_O, 0);
+	memmove(&keys[i + 1], &keys[i], sizeof(int64_t) * (n - i));
+	keys[i] = separator;
+	fits = internal_fits(keys, n + 1);
+
+	if(fits){
+		pthread_mutex_lock(&alloc_mutex);
+		wal_begin();
+		insert_into_leaf_after_splitting(L_O, key, value);
+		*lsn = wal_commit();
+		pthread_mutex_unlock(&alloc_mutex);
+	}
+	if(!same)
+		unlatch_page(P_O);
+	return !fits;
+}
 
-	lseek(fd,L_O,SEEK_SET); // 왼쪽 노드의 부모 오프셋
-	read(fd,&P_O,8);
+/* Inserts into the leaf with tree_lock held shared (see
+ * Concurrency).  Returns 0 or -1 like insert, or 1 if the
+ * insert has to run with tree_lock exclusive.  *lsn is
+ * what the caller waits for.
+ */
+int insert_in_leaf(int64_t key, char * value, int64_t * lsn){
+	int64_t L_O;
+	int i, ret;
+	leaf_page * leaf;
+
+	*lsn = 0;
+	L_O = find_leaf(key);
+	if(L_O == -1)
+		return 1; // 빈 트리는 루트를 만든다
+
+	L_O = latch_leaf(L_O, key);
+	leaf = get_page(L_O);
+	i = leaf_lower_bound(leaf, key);
+	if(i < leaf->num_keys && LEAF_KEY(leaf, i) == key)
+		ret = -1;
+	else
+		ret = leaf_has_room(leaf, 1, leaf_record_size(value)) ? 0 : 2;
+	put_page(L_O, 0);
 
-	if(P_O == -1){ //부모가 존재하지 않는다, 새로운 루트 생성해야 함
-		R_O = make_node();
-		//printf("12288다음은 여기겠고");
+	if(ret == 0){
+		wal_begin();
+		insert_into_leaf(L_O, key, value);
+		*lsn = wal_commit(); // 래치를 쥔 채로 COMMIT까지
+	}
+	else if(ret == 2)
+		ret = split_in_leaf(L_O, key, value, lsn);
+	unlatch_page(L_O);
+	return ret;
+}
 
-		num_keys = 1;
-		lseek(fd,R_O+12,SEEK_SET);
-		write(fd,&num_keys,4); // 키가 1개 생성되니까
-		
-		lseek(fd,R_O+120,SEEK_SET);
-		write(fd,&L_O,8);
-		write(fd,&N_key,8);
-		write(fd,&N_L_O,8); // 키값+오프셋들 넣어줬어
+/* insert without the record lock (see Transactions);
+ * record is VALUE_SIZE bytes.
+ */
+int tree_insert(int64_t key, char * record){
 
-		lseek(fd,8,SEEK_SET);
-		write(fd,&R_O,8); //헤더페이지에서 이어줌
-		//이제 자식들의 부모를 이어주자
-		
-		lseek(fd,L_O,SEEK_SET);
-		write(fd,&R_O,8);
+	int64_t lsn;
+	int ret;
 
-		lseek(fd,N_L_O,SEEK_SET);
-		write(fd,&R_O,8);
-		printf("make new root----\n");
-		return 0;
-	}else{ 
-		//여기서 아직 자식들의 부모를 이어주지 않았음, 그냥 여기서 이어주면 될 것 같아.
-		lseek(fd,P_O+12,SEEK_SET);
-		read(fd,&num_keys,4);
-		
-		if (num_keys < internal_order - 1){//247 여기서 이어주고 부모 자식 이어주자 어차피 스플릿 안생겨
-			lseek(fd,N_L_O,SEEK_SET);
-			write(fd,&P_O,8);
-			return insert_into_node(P_O, N_key, N_L_O); 
-			// 넣어야 할 parent page offset과 넣어야 할 key 값을 전달한다.
-		}
-		return insert_into_node_after_splitting(P_O, N_key, N_L_O);
+	pthread_rwlock_rdlock(&tree_lock);
+	ret = insert_in_leaf(key, record, &lsn);
+	pthread_rwlock_unlock(&tree_lock);
+	if(ret != 1){
+		tx_flush(lsn);
+		return ret;
 	}
+
+	pthread_rwlock_wrlock(&tree_lock);
+	wal_begin();
+
+	if (find_record(key, NULL) == 0)
+		ret = -1; // 존재하므로 실패
+	else
+		ret = insert_record(key, record);
+
+	lsn = wal_commit();
+	if(lsn != 0) tree_version++;
+	pthread_rwlock_unlock(&tree_lock);
+	tx_flush(lsn); // group commit
+	return ret;
 }
 
-//이거 사실 여기서 넣을 필요도 없는데, 잘못했네
-//디버깅 완료
-//넣을 리프페이지 , 키값, value값 받았음, 디버깅 해봤는데 오류 없는 것 같아.
-int insert_into_leaf_after_splitting(int64_t L_O, int64_t key, char * value){
-	int i,j,insertion_point,num_keys,leaf_key;
-	int64_t N_L_O, R_S_O, copy_key, re_key,N_key; //new leaf offset, right sibling offset, return key
-	char copy_val[120],leaf_value[120];
+int insert(int64_t key, char * value){
 
+	int ret;
+	char record[VALUE_SIZE];
 
-//마지막 수정.. 필요 없는 거였어 생각해보니
-/*	
-	lseek(fd,L_O+12,SEEK_SET); // L_O로 number of keys 로이동
-	read(fd,&num_keys,4); //사실 31이니까 굳이 읽을필요는 없지..
-*/
+	record_from_string(record, value);
+
+	if(tx_write_begin(key) != 0)
+		return -1;
+	ret = tree_insert(key, record);
+	tx_write_end();
+	return ret;
+}
+
+/* insert_value without the record lock. */
+int tree_insert_value(int64_t key, const char * value, int64_t length){
+	int64_t lsn;
+	int ret;
+	char record[VALUE_SIZE];
+	overflow_stub * stub = (overflow_stub*)record;
+
+	if(length <= VALUE_SIZE && memchr(value, 0, length) == NULL){
+		memset(record, 0, VALUE_SIZE);
+		memcpy(record, value, length);
+		return tree_insert(key, record);
+	}
+
+	pthread_rwlock_wrlock(&tree_lock);
+	wal_begin();
+
+	if (find_record(key, NULL) == 0)
+		ret = -1;
+	else{
+		memset(record, 0, VALUE_SIZE);
+		memcpy(stub->prefix, value, length < OVERFLOW_PREFIX ? length : OVERFLOW_PREFIX);
+		stub->length = length;
+		stub->magic = OVERFLOW_MAGIC;
+		stub->first_page_offset = length > OVERFLOW_PREFIX ?
+			overflow_write(value + OVERFLOW_PREFIX, length - OVERFLOW_PREFIX) : 0;
+		ret = insert_record(key, record);
+	}
 
-	num_keys = leaf_order - 1;
+	lsn = wal_commit();
+	if(lsn != 0) tree_version++;
+	pthread_rwlock_unlock(&tree_lock);
+	tx_flush(lsn);
+	return ret;
+}
 
-	lseek(fd,L_O + 128*num_keys,SEEK_SET); //L_O 마지막 키 값으로 이동
-	read(fd,&leaf_key,8);
-	read(fd,leaf_value,120);
+/* Inserts a value of any length; value need not be a
+ * string.  Values that can be stored as a string record
+ * go in as one, the others as an overflow stub with the
+ * rest of the bytes in an overflow chain.  Returns 0,
+ * or -1 if the key exists.
+ * A value longer than TX_MAX_IMAGE cannot be logged as a
+ * before image: inside a transaction, a write of its key
+ * (delete) fails with -1 and the transaction goes on.
+ */
+int insert_value(int64_t key, const char * value, int64_t length){
+	int ret;
+
+	if(length < 0)
+		return -1;
+	if(tx_write_begin(key) != 0)
+		return -1;
+	ret = tree_insert_value(key, value, length);
+	tx_write_end();
+	return ret;
+}
 
-	insertion_point = num_keys;
+/* Batched inserts.
+ * insert_batch sorts the batch and walks it in key order.
+ * Each leaf is found with one descent, which also tells
+ * which of the following keys belong to the same leaf;
+ * they are merged into it with a single edit.  If they do
+ * not fit, the leaf is split once into as many evenly
+ * filled leaves as needed.  The whole batch is one logged
+ * operation and costs one commit.
+ */
+typedef struct batch_entry {
+	int64_t key;
+	int index; // keys[]/values[]에서의 위치
+} batch_entry;
+
+int batch_entry_compare(const void * x, const void * y){
+	const batch_entry * a = (const batch_entry*)x, * b = (const batch_entry*)y;
+	if(a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->index - b->index; // 같은 키는 먼저 온 것이 앞에
+}
 
-	while(insertion_point > 0 && leaf_key > key){
-		lseek(fd,L_O+128*(insertion_point+1),SEEK_SET);
-		write(fd,&leaf_key,8);
-		write(fd,leaf_value,120);
+/* tx_write_begin for the sorted keys of a batch.  Outside
+ * of a transaction the batch takes an age, since it waits
+ * while holding locks, and starts over when it has to give
+ * way.  In a transaction only the keys that do not exist
+ * yet are logged, as absent: insert_batch skips the others,
+ * so they keep their value and need no before image.
+ */
+int tx_write_batch(const batch_entry * entries, int n){
+	int i, exists;
+	transaction * tx = tx_current();
+
+	if(tx->aborted)
+		return -1;
+	if(tx->tx_id == 0){
+		pthread_mutex_lock(&wal_mutex);
+		tx->age = wal_next_op_id++;
+		pthread_mutex_unlock(&wal_mutex);
+	}
+	for(i = 0; i < n; i++){
+		if(lock_record(tx, entries[i].key, 1) == 0)
+			continue;
+		if(tx->tx_id != 0){
+			tx_kill(tx);
+			return -1;
+		}
+		unlock_records(tx); // 나이는 그대로 두고 처음부터
+		sched_yield();
+		i = -1;
+	}
+	if(tx->tx_id != 0)
+		for(i = 0; i < n; i++){
+			pthread_rwlock_rdlock(&tree_lock);
+			exists = find_record(entries[i].key, NULL) == 0;
+			pthread_rwlock_unlock(&tree_lock);
+			if(!exists)
+				tx_add_undo(tx, entries[i].key, NULL, -1);
+		}
+	return 0;
+}
 
-		insertion_point--;
-		lseek(fd,L_O + insertion_point * 128,SEEK_SET);
-		read(fd,&leaf_key,8);
-		read(fd,leaf_value,120);
+/* Merges the sorted entries (all inside the leaf's key
+ * range, no repeats) into the leaf and returns how many
+ * were new.
+ */
+int insert_batch_into_leaf(int64_t L_O, const batch_entry * entries, int count, char * values[]){
+	int i, j, total, inserted, num_leaves, start;
+	int * ends;
+	int64_t N_L_O, prev_offset, right_sibling, high_key, separator;
+	leaf_record * temp;
+	leaf_page * leaf, * new_leaf, * prev;
+
+	leaf = get_page(L_O);
+	temp = (leaf_record*)malloc(sizeof(leaf_record) * (leaf->num_keys + count));
+	ends = (int*)malloc(sizeof(int) * (leaf->num_keys + count));
+	if(temp == NULL || ends == NULL){
+		perror("Batch insert.");
+		exit(EXIT_FAILURE);
+	}
+	total = inserted = 0;
+	for(i = 0, j = 0; i < leaf->num_keys || j < count; ){
+		if(j == count || (i < leaf->num_keys && LEAF_KEY(leaf, i) < entries[j].key))
+			leaf_load(leaf, i++, &temp[total++]);
+		else if(i < leaf->num_keys && LEAF_KEY(leaf, i) == entries[j].key)
+			j++; // 이미 있는 키
+		else{
+			temp[total].key = entries[j].key;
+			record_from_string(temp[total].value, values[entries[j].index]);
+			total++;
+			inserted++;
+			j++;
+		}
+	}
+	if(inserted == 0){
+		put_page(L_O, 0);
+		free(temp);
+		free(ends);
+		return 0;
 	}
-	
-	lseek(fd,L_O + (insertion_point+1)*128,SEEK_SET);
-	write(fd,&key,8);
-	write(fd,value,120);
-
-	/*이제 31개 되었으니.. key[15] 가 중간값이겠네.
-	  그러면 15부터 30까지 새로운 노드고, 이전노드에 right sibiling offset으로 이어준다
-	  루트에 15를 추가해야 겠지?*/
-	//이전 노드의  right sibling을 새로운 애의 right sibling 으로 설정하자
-
-	N_L_O = make_leaf();
-	lseek(fd,L_O+120,SEEK_SET); 
-	read(fd,&R_S_O,8); //원래 right sibling offset
 
-	lseek(fd,L_O+120,SEEK_SET); 
-	write(fd,&N_L_O,8);
-	
-	lseek(fd,N_L_O+120,SEEK_SET);
-	write(fd,&R_S_O,8);
-	
-	//이어주는 것 까지 설정
-	//원래 노드 keys[0]~keys[15] 
-	//new_leaf_node에 keys[15]~keys[30] insertion
-	
-	//현재 꽉찬 노드
-	
-	for(i=leaf_order / 2 ,j=0; i < leaf_order; i++,j++){ //15 , 31에서 수정.
-		lseek(fd,L_O+((i+1)*128),SEEK_SET);
-		read(fd,&copy_key,8);
-		read(fd,copy_val,120);
-		lseek(fd,N_L_O+((j+1)*128),SEEK_SET);
-		write(fd,&copy_key,8);
-		write(fd,copy_val,120);
+	// 한 번에 필요한 만큼의 leaf로 나눈다
+	num_leaves = leaf_partition(temp, total, ends);
+	start = ends[0];
+	leaf_store(leaf, temp, start);
+	if(num_leaves == 1){
+		put_page(L_O, 1);
+		free(temp);
+		free(ends);
+		return inserted;
 	}
+	right_sibling = leaf->right_sibling_offset;
+	high_key = leaf->high_key;
+	put_page(L_O, 1);
+
+	prev_offset = L_O;
+	for(i = 1; i < num_leaves; i++){
+		j = ends[i] - start;
+		N_L_O = make_leaf(prev_offset);
+		separator = leaf_separator(temp[start - 1].key, temp[start].key);
+
+		prev = get_page(prev_offset);
+		node_link((node_page*)prev, N_L_O, separator);
+		new_leaf = get_page(N_L_O);
+		leaf_store(new_leaf, &temp[start], j);
+		if(i == num_leaves - 1) // 마지막 leaf가 원래 leaf의 링크를 물려받는다
+			node_link((node_page*)new_leaf, right_sibling, high_key);
+		new_leaf->parent_page_offset = prev->parent_page_offset;
+		put_page(N_L_O, 1);
+		put_page(prev_offset, 1);
+
+		insert_into_parent(prev_offset, N_L_O, separator);
+		start += j;
+		prev_offset = N_L_O;
+	}
+	free(temp);
+	free(ends);
+	return inserted;
+}
 
-	lseek(fd,N_L_O+128,SEEK_SET);
-	read(fd,&N_key,8);
+/* Inserts the n records keys[i] -> values[i].  Keys that
+ * already exist, and repeats within the batch after the
+ * first, are skipped.  Returns the number of records
+ * inserted, or -1 if the batch could not be sorted or
+ * its transaction was rolled back.
+ */
+int insert_batch(int64_t keys[], char * values[], int n){
+	int i, j, num_entries, inserted = 0;
+	int64_t L_O, high, lsn;
+	char record[VALUE_SIZE]; // 빈 트리에 들어가는 첫 레코드
+	batch_entry * entries;
 
-	lseek(fd,L_O+12,SEEK_SET);
-	num_keys = leaf_order / 2; //15 
-	write(fd,&num_keys,8);
+	if(n <= 0)
+		return 0;
+	entries = (batch_entry*)malloc(sizeof(batch_entry) * n);
+	if(entries == NULL)
+		return -1;
+	for(i=0; i<n; i++){
+		entries[i].key = keys[i];
+		entries[i].index = i;
+	}
+	qsort(entries, n, sizeof(batch_entry), batch_entry_compare);
+	for(i = 1, num_entries = 1; i < n; i++) // 배치 안에서 반복되는 키는 첫 번째만
+		if(entries[i].key != entries[num_entries - 1].key)
+			entries[num_entries++] = entries[i];
+	if(tx_write_batch(entries, num_entries) != 0){
+		free(entries);
+		return -1;
+	}
 
-	lseek(fd,N_L_O+12,SEEK_SET);
-	num_keys = leaf_order - num_keys; //16
-	write(fd,&num_keys,8);
+	pthread_rwlock_wrlock(&tree_lock);
+	wal_begin();
+
+	for(i = 0; i < num_entries; i = j){
+		L_O = find_leaf_high(entries[i].key, &high);
+		if(L_O == -1){ // 빈 트리
+			record_from_string(record, values[entries[i].index]);
+			start_new_tree(entries[i].key, record);
+			inserted++;
+			j = i + 1;
+			continue;
+		}
+		for(j = i + 1; j < num_entries && entries[j].key < high; j++) ;
+		inserted += insert_batch_into_leaf(L_O, &entries[i], j - i, values);
+	}
 
-	//number of keys 값들 수정
-	printf("-------split leaf!\n");
-	return insert_into_parent(L_O, N_L_O, N_key); //부모 공유는 여기서!
+	lsn = wal_commit();
+	if(lsn != 0) tree_version++;
+	pthread_rwlock_unlock(&tree_lock);
+	tx_write_end();
+	tx_flush(lsn);
+	free(entries);
+	return inserted;
 }
 
+/* Batched lookups.
+ * find_batch sorts the probes and walks the tree once,
+ * depth first.  An internal node is read once for all
+ * the probes below it, the children they lead to are
+ * read together as one batch (buf_prefetch), and each
+ * leaf is read once for all of its probes.  Probes that
+ * moved right in a split since the parent was read go on
+ * to the right sibling like another child.
+ */
+int find_batch_node(int64_t offset, const batch_entry * entries, int count, char * out[]){
+	int i, j, k, moved, found = 0, num_children = 0;
+	int64_t * children, child, right;
+	int * starts;
+	node_page * node;
+	leaf_page * leaf;
+	internal_page * page, copy;
+
+	node = get_page_shared(offset, &copy);
+	right = node_right(node);
+	for(moved = count; moved > 0 && node_moved_right(node, entries[moved - 1].key); moved--)
+		; // entries[moved..]는 오른쪽 노드에 있다
+	if(node->is_leaf){
+		leaf = (leaf_page*)node;
+		for(i = 0, j = 0; j < moved; j++){
+			while(i < leaf->num_keys && LEAF_KEY(leaf, i) < entries[j].key)
+				i++;
+			if(i < leaf->num_keys && LEAF_KEY(leaf, i) == entries[j].key){
+				leaf_value(leaf, i, out[entries[j].index]);
+				overflow_resolve(out[entries[j].index]);
+				found++;
+			}
+			else
+				out[entries[j].index] = NULL;
+		}
+		put_page_shared(offset);
+		if(moved < count)
+			found += find_batch_node(right, entries + moved, count - moved, out);
+		return found;
+	}
 
-int insert(int64_t key, char * value){
+	// 프로브를 자식별로 나눈다
+	page = (internal_page*)node;
+	children = (int64_t*)malloc(sizeof(int64_t) * (count + 1));
+	starts = (int*)malloc(sizeof(int) * (count + 1));
+	if(children == NULL || starts == NULL){
+		perror("Batch find.");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0, k = 0; k < moved; k++){
+		while(i < page->num_keys && entries[k].key >= ENTRY_KEY(page, i))
+			i++;
+		child = i == 0 ? page->leftmost_offset : ENTRY_OFFSET(page, i-1);
+		if(num_children == 0 || children[num_children - 1] != child){
+			children[num_children] = child;
+			starts[num_children++] = k;
+		}
+	}
+	if(moved < count){
+		children[num_children] = right;
+		starts[num_children++] = moved;
+	}
+	starts[num_children] = count;
+	put_page_shared(offset);
+
+	if(num_children > 1)
+		buf_prefetch(children, num_children);
+	for(i = 0; i < num_children; i++)
+		found += find_batch_node(children[i], entries + starts[i], starts[i+1] - starts[i], out);
+	free(children);
+	free(starts);
+	return found;
+}
 
-	int64_t R_O,F_O,L_O,val; // root page offset, free page offset, leaf page offset
-	int num_keys;
-	char * f;
+/* Looks up the n keys.  out[i] must point to a buffer of
+ * VALUE_SIZE bytes, which receives the value of keys[i];
+ * if keys[i] does not exist, out[i] is set to NULL.
+ * Returns the number of keys found, or -1 (which in a
+ * transaction may mean that it was rolled back).
+ */
+int find_batch(int64_t keys[], int n, char * out[]){
+	int i, found = 0;
+	int64_t R_O;
+	batch_entry * entries;
+	header_page * header;
 
-	if ( (f =find(key)) != NULL) return -1; // 존재하므로 실패
-	free(f);
+	if(n <= 0)
+		return 0;
+	entries = (batch_entry*)malloc(sizeof(batch_entry) * n);
+	if(entries == NULL)
+		return -1;
+	for(i=0; i<n; i++){
+		entries[i].key = keys[i];
+		entries[i].index = i;
+	}
+	qsort(entries, n, sizeof(batch_entry), batch_entry_compare);
+	for(i=0; i<n; i++)
+		if(tx_read_begin(entries[i].key) != 0){
+			free(entries);
+			return -1;
+		}
 
-	lseek(fd,8,SEEK_SET);
-	read(fd,&R_O,8);// root page offset
-	
+	pthread_rwlock_rdlock(&tree_lock);
+	header = get_page(0);
+	R_O = header->root_page_offset;
+	put_page(0, 0);
 	if(R_O == -1)
-		return start_new_tree(key,value);
-
-	L_O = find_leaf(key); //넣어야 할 리프 페이지의 오프셋 받음
-	//printf("L_O : %ld\n",L_O);
-
-	lseek(fd,L_O+12,SEEK_SET); // 리프 페이지로 이동
-	read(fd,&num_keys,4); // key 개수 받음 
-	
-	if (num_keys < leaf_order - 1) // if leaf order 31 -> num_keys 30이면 밑으로 가야함
-		return insert_into_leaf(L_O,key,value);
+		for(i=0; i<n; i++)
+			out[i] = NULL;
 	else
-		return insert_into_leaf_after_splitting(L_O,key,value);
+		found = find_batch_node(R_O, entries, n, out);
+	pthread_rwlock_unlock(&tree_lock);
+
+	free(entries);
+	return found;
 }
 
 /* 
    delete
 		  */
 
-//리프 노드로 가서, 지워주고, shift, num_keys 감소
+//노드에서 key를 지우고 shift, num_keys 감소
+//internal이면 key와 그 오른쪽 자식 오프셋을 함께 지운다.
 
 int64_t remove_entry_from_node(int64_t key, int64_t N_offset){
-	printf("-----remove entry from node-----\n");
-	int i, num_keys, is_Leaf;
-	int64_t N_keys,offset;
-	char leaf_values[120];
+	node_page * node;
+	leaf_page * leaf;
+	internal_page * internal;
 
-	lseek(fd,N_offset+8,SEEK_SET);
-	read(fd,&is_Leaf,4);
-	read(fd,&num_keys,4);
-
-	i = 0;
+	node = get_page(N_offset);
 
-	lseek(fd,N_offset+128,SEEK_SET);
-	read(fd,&N_keys,8);
-	
-	if(is_Leaf){
-		while(key != N_keys){
-			i++;
-			lseek(fd,120,SEEK_CUR);
-			read(fd,&N_keys,8);
-		}
-		//i가 0인경우..
-		for(++i; i < num_keys ; i++){
-			lseek(fd,N_offset+((i+1)*128),SEEK_SET);
-			read(fd,&N_keys,8);
-			read(fd,leaf_values,120);
-			lseek(fd,-256,SEEK_CUR);
-			write(fd,&N_keys,8);
-			write(fd,leaf_values,120);
-		}
+	if(node->is_leaf){
+		leaf = (leaf_page*)node;
+		leaf_remove_at(leaf, leaf_lower_bound(leaf, key));
 	}else{
-		//internal
-		while(key != N_keys){
-			i++; // index
-			lseek(fd,8,SEEK_CUR);
-			read(fd,&N_keys,8);
-		}
-		for(++i; i < num_keys+1; i++){
-			lseek(fd,N_offset+128+(16*i),SEEK_SET);
-			read(fd,&N_keys,8);
-			read(fd,&offset,8);
-			
-			lseek(fd,N_offset+128+(16*(i-1)),SEEK_SET);
-			write(fd,&N_keys,8);
-			write(fd,&offset,8);
-		}
-	}
-	num_keys--;
-	lseek(fd,N_offset+12,SEEK_SET);
-	write(fd,&num_keys,4);
+		internal = (internal_page*)node;
+		internal_remove_at(internal, internal_lower_bound(internal, key));
+	}
+
+	put_page(N_offset, 1);
 	return N_offset;
 }
 
 int adjust_root(int64_t leaf_offset){
-	printf("-----adjust root-----\n");
-	int num_keys,is_Leaf;
-	int64_t R_O,new_R_O, tmp;
+	int64_t new_R_O;
+	internal_page * root;
+	node_page * child;
+	header_page * header;
 
-	lseek(fd,leaf_offset+8,SEEK_SET);
-	read(fd,&is_Leaf,4);
-	read(fd,&num_keys,4);
+	root = get_page(leaf_offset);
 	
-	if (num_keys > 0)
+	if (root->num_keys > 0){
+		put_page(leaf_offset, 0);
 		return 0;
-	/* Case: empty root */
-	// 아직 is_Leaf가 0인 케이스는 이해를 못했음.
-	if(!is_Leaf){
-		lseek(fd,leaf_offset+120,SEEK_SET);
-		read(fd,&new_R_O,8);
-		lseek(fd,new_R_O,SEEK_SET);
-		tmp = -1;
-		write(fd,&tmp,8);
-		lseek(fd,8,SEEK_SET);
-		write(fd,&new_R_O,8);
 	}
-	else{
-		lseek(fd,8,SEEK_SET);
-		new_R_O = -1;
-		write(fd,&new_R_O,8);
+
+	/* Case: empty root */
+	if(!root->is_leaf){
+		// 자식이 하나 남았으니 그 자식을 새 루트로
+		new_R_O = root->leftmost_offset;
+		child = get_page(new_R_O);
+		child->parent_page_offset = -1;
+		put_page(new_R_O, 1);
 	}
-	//return_freepage(R_O);
+	else
+		new_R_O = -1; // 트리가 비었다
+	put_page(leaf_offset, 0);
+
+	header = get_page(0);
+	header->root_page_offset = new_R_O;
+	put_page(0, 1);
+
+	return_freepage(leaf_offset);
 	return 0;
 }
 
+/* 부모에서 N의 왼쪽 이웃을 가리키는 인덱스.
+ * N이 맨 왼쪽 자식이면 -1
+ */
 int get_neighbor_index(int64_t leaf_offset){
-	int num_keys, i;
-	int64_t parent_offset, keys, read_offset;
+	int i, num_keys;
+	int64_t parent_offset;
+	node_page * node;
+	internal_page * parent;
+
+	node = get_page(leaf_offset);
+	parent_offset = node->parent_page_offset;
+	put_page(leaf_offset, 0);
+
+	parent = get_page(parent_offset);
+	if(parent->leftmost_offset == leaf_offset){
+		put_page(parent_offset, 0);
+		return -1;
+	}
+	num_keys = parent->num_keys; // put_page 뒤에는 parent를 보면 안 된다
+	for(i=0; i < num_keys; i++)
+		if(ENTRY_OFFSET(parent, i) == leaf_offset) break;
+	put_page(parent_offset, 0);
+
+	if(i == num_keys){
+		fprintf(stderr, "Search for nonexistent pointer to node in parent.\n");
+		fprintf(stderr, "Node:  %" PRId64 "\n", leaf_offset);
+		exit(EXIT_FAILURE);
+	}
+	return i;
+}
 
-	lseek(fd,leaf_offset,SEEK_SET);
-	read(fd,&parent_offset,8);
+int64_t get_neighbor_offset(int64_t leaf_offset){
+	int neighbor_index;
+	int64_t parent_offset, neighbor_offset;
+	node_page * node;
+	internal_page * parent;
 
-	lseek(fd,parent_offset+12,SEEK_SET);
-	read(fd,&num_keys,8);
+	neighbor_index = get_neighbor_index(leaf_offset);
 
-	for(i=0; i <= num_keys; i++){
-		lseek(fd,parent_offset+120+(i*16),SEEK_SET);
-		read(fd,&read_offset,8);
-		if(read_offset == leaf_offset) break;
-	}
-	return i-1;
-}
+	node = get_page(leaf_offset);
+	parent_offset = node->parent_page_offset;
+	put_page(leaf_offset, 0);
 
-int64_t get_neighbor_offset(int key, int64_t leaf_offset){
-	int num_keys,i;
-	int64_t keys, neighbor_offset, parent_offset,read_offset;
-	
-	lseek(fd,leaf_offset,SEEK_SET);
-	read(fd,&parent_offset,8);
+	parent = get_page(parent_offset);
+	if(neighbor_index == -1) // 맨 왼쪽이면 오른쪽 이웃
+		neighbor_offset = ENTRY_OFFSET(parent, 0);
+	else if(neighbor_index == 0)
+		neighbor_offset = parent->leftmost_offset;
+	else
+		neighbor_offset = ENTRY_OFFSET(parent, neighbor_index - 1);
+	put_page(parent_offset, 0);
 
-	lseek(fd,parent_offset+12,SEEK_SET);
-	read(fd,&num_keys,8);
-	
-	for(i=0; i <num_keys; i++){
-		lseek(fd,parent_offset+120+(i*16),SEEK_SET);
-		read(fd,&read_offset,8);
-		if(read_offset == leaf_offset) break;
-	}
-	
-	if(i==0){
-		lseek(fd,parent_offset+136,SEEK_SET);
-		read(fd,&read_offset,8);
-		return read_offset;
-	}else{
-		lseek(fd,parent_offset+120+((i-1)*16),SEEK_SET);
-		read(fd,&read_offset,8);
-		return read_offset;
-	}
+	return neighbor_offset;
 }
 
 //병합할 때, neighbor offset으로 병합
 int coalesce_nodes(int64_t neighbor_offset, int64_t N_offset, int neighbor_index, int64_t k_prime)
 {
-	printf("-----coalesce_nodes-----\n");
-	int i, j, neighbor_num_keys, neighbor_insertion_index, is_Leaf, num_keys, n_end;
-	char value[120];
-	int64_t tmp, keys, parent_offset, copy_offset,R_S_O;
-
-
+	int i, n_keys, neighbor_insertion_index;
+	int64_t tmp, parent_offset, child_offset;
+	int64_t keys[2*INTERNAL_ORDER], offsets[2*INTERNAL_ORDER];
+	node_page * n, * neighbor, * child;
+
+	/* N이 맨 왼쪽이면 이웃과 자리를 바꿔서
+	 * 항상 오른쪽(N)을 왼쪽(neighbor)에 합친다.
+	 */
 	if(neighbor_index == -1){
 		tmp = neighbor_offset;
 		neighbor_offset = N_offset;
 		N_offset = tmp;
 	}
-	
-	lseek(fd,N_offset+12,SEEK_SET);
-	read(fd,&num_keys,4);
-	
-	lseek(fd,neighbor_offset+12,SEEK_SET);
-	read(fd,&neighbor_num_keys,4);
-
-	neighbor_insertion_index = neighbor_num_keys;
-	
-	lseek(fd,N_offset+8,SEEK_SET);
-	read(fd,&is_Leaf,4);
-	
-	if(!is_Leaf){
-		// internal
 
-		lseek(fd,neighbor_offset+128+(16*neighbor_insertion_index),SEEK_SET);
-		write(fd,&k_prime,8);
-		
-		neighbor_num_keys++; //copy offset도 올려줘야해
-		lseek(fd,neighbor_offset+12,SEEK_SET);
-		write(fd,&neighbor_num_keys,4);
-
-		n_end = num_keys;
-		
-		for(i = neighbor_insertion_index + 1, j = 0; j < n_end; i++, j++) {
-			
-			lseek(fd,N_offset+120+(16*j),SEEK_SET);
-			read(fd,&copy_offset,8);
-			read(fd,&keys,8);
-			
-			lseek(fd,neighbor_offset+120+(16*i),SEEK_SET);
-			write(fd,&copy_offset,8);
-			write(fd,&keys,8);
-
-			num_keys --;
-			neighbor_num_keys++;
-		}
-		
-		lseek(fd,N_offset+120+(16*j),SEEK_SET);
-		read(fd,&copy_offset,8);
-		
-		lseek(fd,neighbor_offset+120+(16*i),SEEK_SET);
-		write(fd,&copy_offset,8);
-
-		for (i=0; i<neighbor_num_keys+1;i++){
-			lseek(fd,neighbor_offset+120+(16*i),SEEK_SET);
-			read(fd,&copy_offset,8);
-			lseek(fd,copy_offset,SEEK_SET);
-			write(fd,&neighbor_offset,8);
+	n = get_page(N_offset);
+	neighbor = get_page(neighbor_offset);
+
+	neighbor_insertion_index = neighbor->num_keys;
+	parent_offset = n->parent_page_offset;
+
+	if(!n->is_leaf){
+		// internal: k_prime과 N의 맨 왼쪽 자식을 붙이고, N의 엔트리를 전부 붙인다
+		internal_page * in = (internal_page*)n;
+		internal_page * ineighbor = (internal_page*)neighbor;
+
+		internal_load(ineighbor, keys, offsets);
+		keys[neighbor_insertion_index] = k_prime;
+		offsets[neighbor_insertion_index] = in->leftmost_offset;
+		n_keys = neighbor_insertion_index + 1 + internal_load(in, keys + neighbor_insertion_index + 1, offsets + neighbor_insertion_index + 1);
+		internal_store(ineighbor, keys, offsets, n_keys);
+		node_link(neighbor, in->right_sibling_offset, in->high_key);
+
+		/* 옮겨진 자식들의 부모를 neighbor로 */
+		for(i = neighbor_insertion_index; i < ineighbor->num_keys; i++){
+			child_offset = ENTRY_OFFSET(ineighbor, i);
+			child = get_page(child_offset);
+			child->parent_page_offset = neighbor_offset;
+			put_page(child_offset, 1);
 		}
 	}
 	else{
-		for (i = neighbor_insertion_index, j=0; j < num_keys; i++, j++){
-			
-			lseek(fd,N_offset+(128*(j+1)),SEEK_SET);
-			read(fd,&keys,8);
-			read(fd,value,120);
-			
-			lseek(fd,neighbor_offset+(128*(i+1)),SEEK_SET);
-			write(fd,&keys,8);
-			write(fd,value,120);
-			
-			neighbor_num_keys++;
-		}
-		lseek(fd,N_offset+120,SEEK_SET);
-		read(fd,&R_S_O,8);
-		lseek(fd,neighbor_offset+120,SEEK_SET);
-		write(fd,&R_S_O,8);
-	}
-
-	lseek(fd,neighbor_offset+12,SEEK_SET);
-	write(fd,&neighbor_num_keys,4);
-	lseek(fd,N_offset+12,SEEK_SET);
-	num_keys = 0;	
-	write(fd,&num_keys,4);
-
-	lseek(fd,neighbor_offset,SEEK_SET);
-	read(fd,&parent_offset,8);
-	
-	return delete_entry(k_prime, parent_offset);
-}
-
-void return_freepage(int64_t N_offset){
-	int64_t N_F_O;
+		leaf_page * ln = (leaf_page*)n;
+		leaf_page * lneighbor = (leaf_page*)neighbor;
 
-	lseek(fd,0,SEEK_SET);
-	read(fd,&N_F_O,8);
+		for(i = 0; i < ln->num_keys; i++)
+			leaf_move(lneighbor, neighbor_insertion_index + i, ln, i);
+		node_link(neighbor, ln->right_sibling_offset, ln->high_key);
+	}
+	n->num_keys = 0;
 
-	lseek(fd,N_offset,SEEK_SET);
-	write(fd,&N_F_O,8);
+	put_page(neighbor_offset, 1);
+	put_page(N_offset, 1);
 
-	lseek(fd,0,SEEK_SET);
-	write(fd,&N_offset,8);
+	delete_entry(k_prime, parent_offset);
+	return_freepage(N_offset);
+	return 0;
+}
 
-	freepage_num++;
-	
-	return;
+void return_freepage(int64_t N_offset){
+	// 페이지는 그대로 두고 비트만 지운다, 다시 받는 쪽이 새로 채운다
+	bitmap_mark(N_offset / PAGE_SIZE, N_offset / PAGE_SIZE, 0);
 }
 
 
 int redistribute_node(int64_t N_offset, int64_t neighbor_offset, int neighbor_index,
 		int k_prime_index, int64_t k_prime){
 	
-	printf("-----redistribute node-----\n");
-	int i,is_Leaf,num_keys,neighbor_num_keys;
-	char value[120];
-	int64_t tmp, keys, parent_offset, offset;
+	int i, n_keys;
+	int64_t parent_offset, child_offset, new_k_prime;
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER];
+	node_page * n, * neighbor, * child;
+	internal_page * parent;
 	
-	lseek(fd,N_offset,SEEK_SET);
-	read(fd,&parent_offset,8);
-	read(fd,&is_Leaf,4);
-	read(fd,&num_keys,4);
-
-	lseek(fd,N_offset+12,SEEK_SET);
-	read(fd,&neighbor_num_keys,4);
-
-	/* Case: n has a neighbor to the left */
-
+	n = get_page(N_offset);
+	neighbor = get_page(neighbor_offset);
+	parent_offset = n->parent_page_offset;
+	parent = get_page(parent_offset);
+
+	/* Case: n has a neighbor to the left.
+	 * 이웃의 마지막 엔트리를 N의 맨 앞으로 가져온다.
+	 */
 	if(neighbor_index != -1) {
-		if(!is_Leaf) {
-			// case internal, 여기 조금 수정하자
-			lseek(fd,N_offset+120+(16*num_keys),SEEK_SET);
-			read(fd,&offset,8);
-
-			lseek(fd,N_offset+120+(16*(num_keys+1)),SEEK_SET);
-			write(fd,&offset,8);
-
-			for (i = num_keys; i > 0; i--){
-				lseek(fd,N_offset+120+(16*(i-1)),SEEK_SET);
-				read(fd,&offset,8);
-				read(fd,&keys,8);
-				
-				lseek(fd,N_offset+120+(16*i),SEEK_SET);
-				write(fd,&offset,8);
-				write(fd,&keys,8);
-			}
-
-			lseek(fd,neighbor_offset+120+(16*neighbor_num_keys),SEEK_SET);
-			read(fd,&offset,8);
-			
-			lseek(fd,offset,SEEK_SET); //parent
-			write(fd,&N_offset,8);
-
-			lseek(fd,N_offset+120,SEEK_SET);
-			write(fd,&offset,8);
-			write(fd,&k_prime,8);
-			
-			lseek(fd,neighbor_offset+128+(16*(neighbor_num_keys-1)),SEEK_SET);
-			read(fd,&keys,8);
-
-			lseek(fd,parent_offset+128+(16*k_prime_index),SEEK_SET);
-			write(fd,&keys,8);
+		if(!n->is_leaf) {
+			internal_page * in = (internal_page*)n;
+			internal_page * ineighbor = (internal_page*)neighbor;
+
+			i = ineighbor->num_keys - 1;
+			internal_insert(in, 0, k_prime, in->leftmost_offset); // underfull이라 자리는 있다
+			in->leftmost_offset = ENTRY_OFFSET(ineighbor, i);
+			new_k_prime = ENTRY_KEY(ineighbor, i);
+			internal_remove_at(ineighbor, i);
+
+			child_offset = in->leftmost_offset;
+			child = get_page(child_offset);
+			child->parent_page_offset = N_offset;
+			put_page(child_offset, 1);
 		}
 		else {
-			// case leaf
-			for (i = num_keys; i > 0; i--){
-				lseek(fd,N_offset+128+(128*(i-1)),SEEK_SET);
-				read(fd,&keys,8);
-				read(fd,value,120);
-				
-				lseek(fd,N_offset+128+(128*i),SEEK_SET);
-				write(fd,&keys,8);
-				write(fd,value,120);
-			}
-
-			lseek(fd,neighbor_offset+(128*neighbor_num_keys),SEEK_SET);
-			read(fd,&keys,8);
-			read(fd,value,120);
-
-			lseek(fd,N_offset+128,SEEK_SET);
-			write(fd,&keys,8);
-			write(fd,value,120);
-			
-			lseek(fd,parent_offset+128+(16*k_prime_index),SEEK_SET);
-			write(fd,&keys,8);
-		}
-	}
-	else { // n has a neighbor to the right
-		if(is_Leaf) {
-			lseek(fd,neighbor_offset+128,SEEK_SET);
-			read(fd,&keys,8);
-			read(fd,value,120);
-
-			lseek(fd,N_offset+128+(128*num_keys),SEEK_SET);
-			write(fd,&keys,8);
-			write(fd,value,120);
-
-			lseek(fd,neighbor_offset+256,SEEK_SET);
-			read(fd,&keys,8);
-
-			lseek(fd,parent_offset+128+(16*k_prime_index),SEEK_SET);
-			write(fd,&keys,8);
-
-			for(i = 0; i < neighbor_num_keys - 1; i++){
-				lseek(fd,neighbor_offset+128+(128*(i+1)),SEEK_SET);
-				read(fd,&keys,8);
-				read(fd,value,120);
-				
-				lseek(fd,neighbor_offset+128+(128*i),SEEK_SET);
-				write(fd,&keys,8);
-				write(fd,value,120);
-			}
+			leaf_page * ln = (leaf_page*)n;
+			leaf_page * lneighbor = (leaf_page*)neighbor;
+
+			do{ // 값 크기가 다르면 하나로는 모자랄 수 있다
+				i = lneighbor->num_keys - 1;
+				leaf_move(ln, 0, lneighbor, i);
+				leaf_remove_at(lneighbor, i);
+			}while(leaf_underfull(ln) && leaf_used(lneighbor) > leaf_used(ln));
+			new_k_prime = leaf_separator(LEAF_KEY(lneighbor, lneighbor->num_keys - 1), LEAF_KEY(ln, 0));
+		}
+	}
+	/* Case: n is the leftmost child.
+	 * 오른쪽 이웃의 첫 엔트리를 N의 맨 뒤로 가져온다.
+	 */
+	else {
+		if(n->is_leaf) {
+			leaf_page * ln = (leaf_page*)n;
+			leaf_page * lneighbor = (leaf_page*)neighbor;
+
+			do{
+				leaf_move(ln, ln->num_keys, lneighbor, 0);
+				leaf_remove_at(lneighbor, 0);
+			}while(leaf_underfull(ln) && leaf_used(lneighbor) > leaf_used(ln));
+			new_k_prime = leaf_separator(LEAF_KEY(ln, ln->num_keys - 1), LEAF_KEY(lneighbor, 0));
 		}
 		else{
-			//Case internl
-
-			lseek(fd,N_offset+128+(16*num_keys),SEEK_SET);
-			write(fd,&k_prime,8);
-			lseek(fd,neighbor_offset+120,SEEK_SET);
-			read(fd,&offset,8);
-			lseek(fd,N_offset+120+(16*(num_keys+1)),SEEK_SET);
-			write(fd,&offset,8);
-			lseek(fd,offset,SEEK_SET);
-			write(fd,&N_offset,8);
-			
-			lseek(fd,neighbor_offset+128,SEEK_SET);
-			read(fd,&keys,8);
-
-			lseek(fd,parent_offset+128+(16*k_prime_index),SEEK_SET);
-			write(fd,&keys,8);
-
-			for(i=0; i < neighbor_num_keys - 1 ; i++){
-				lseek(fd,neighbor_offset+120+(16*(i+1)),SEEK_SET);
-				read(fd,&offset,8);
-				read(fd,&keys,8);
-				
-				lseek(fd,neighbor_offset+(120+(16*i)),SEEK_SET);
-				write(fd,&offset,8);
-				write(fd,&keys,8);
-			}
+			internal_page * in = (internal_page*)n;
+			internal_page * ineighbor = (internal_page*)neighbor;
+
+			internal_insert(in, in->num_keys, k_prime, ineighbor->leftmost_offset);
+			new_k_prime = ENTRY_KEY(ineighbor, 0);
+			ineighbor->leftmost_offset = ENTRY_OFFSET(ineighbor, 0);
+			internal_remove_at(ineighbor, 0);
+
+			child_offset = ENTRY_OFFSET(in, in->num_keys - 1);
+			child = get_page(child_offset);
+			child->parent_page_offset = N_offset;
+			put_page(child_offset, 1);
+		}
+	}
 
-			lseek(fd,neighbor_offset+120+(16*(i+1)),SEEK_SET);
-			read(fd,&offset,8);
+	// 왼쪽 노드의 high key는 새 k_prime
+	node_link(neighbor_index != -1 ? neighbor : n, neighbor_index != -1 ? N_offset : neighbor_offset, new_k_prime);
+	put_page(neighbor_offset, 1);
+	put_page(N_offset, 1);
 
-			lseek(fd,neighbor_offset+(120+(16*i)),SEEK_SET);
-			write(fd,&offset,8);
-		}
+	/* 부모의 k_prime을 바꾼다.  압축된 키가 길어져서
+	 * 부모에 다 들어가지 않으면 부모를 나눈다.
+	 */
+	if(internal_set_key(parent, k_prime_index, new_k_prime) == 0){
+		put_page(parent_offset, 1);
+		return 0;
 	}
-	neighbor_num_keys --;
-	num_keys ++;
-	
-	lseek(fd,neighbor_offset+12,SEEK_SET);
-	write(fd,&neighbor_num_keys,4);
-	lseek(fd,N_offset+12,SEEK_SET);
-	write(fd,&num_keys,4);
-	return 0;
+	n_keys = internal_load(parent, keys, offsets);
+	put_page(parent_offset, 0);
+	keys[k_prime_index] = new_k_prime;
+	return split_internal(parent_offset, keys, offsets, n_keys);
+}
+
+/* Whether the internal pages left and right, with k_prime
+ * between them, fit in one page.
+ */
+int internal_can_merge(int64_t left_offset, int64_t k_prime, int64_t right_offset){
+	int n, fits;
+	int64_t keys[2*INTERNAL_ORDER], offsets[2*INTERNAL_ORDER];
+	internal_page * left, * right;
+
+	left = get_page(left_offset);
+	right = get_page(right_offset);
+	n = internal_load(left, keys, offsets);
+	keys[n++] = k_prime;
+	n += internal_load(right, keys + n, offsets + n);
+	fits = internal_fits(keys, n);
+	put_page(right_offset, 0);
+	put_page(left_offset, 0);
+	return fits;
 }
 
 // key를 가지고있는 오프셋이 N_offset인 페이지에서, key를 지운다.
 int delete_entry(int64_t key, int64_t N_offset){
 
-	printf("-----delete entry-----\n");
-	int min_keys, is_Leaf, neighbor_num_keys, num_keys; 
-	int capacity,  neighbor_index, k_prime_index;
-	int64_t root_offset, neighbor_offset, parent_offset, N_O,k_prime;
+	int is_Leaf, num_keys, underfull, fits, used = 0;
+	int neighbor_index, k_prime_index;
+	int64_t root_offset, neighbor_offset, parent_offset, k_prime;
+	header_page * header;
+	node_page * node;
+	internal_page * parent;
 
-	N_O = remove_entry_from_node(key,N_offset);
+	remove_entry_from_node(key, N_offset);
 	
-	lseek(fd,8,SEEK_SET);
-	read(fd,&root_offset,8);
+	header = get_page(0);
+	root_offset = header->root_page_offset;
+	put_page(0, 0);
 	
-	if ( N_O == root_offset )
+	if ( N_offset == root_offset )
 		return adjust_root(N_offset);
 
-	lseek(fd,N_O+8,SEEK_SET);
-	read(fd,&is_Leaf,4);
-	read(fd,&num_keys,4);
-	
-	if(is_Leaf == 1)
-		min_keys = cut(leaf_order - 1);
+	node = get_page(N_offset);
+	is_Leaf = node->is_leaf;
+	num_keys = node->num_keys;
+	parent_offset = node->parent_page_offset;
+	if(is_Leaf == 1){ // 리프는 키 수와 바이트로 잰다
+		underfull = leaf_underfull((leaf_page*)node);
+		used = leaf_used((leaf_page*)node);
+	}
 	else
-		min_keys = cut(internal_order) - 1;
+		underfull = internal_underfull((internal_page*)node);
+	put_page(N_offset, 0);
 	
-	//printf("num keys : %d\n", num_keys);
 	//종료 조건 1
-	if(num_keys >= min_keys)
+	if(!underfull)
 		return 0;
 	
-	//leaf offset은, 지워야 할 키를 가지고 있는 page offset이다.
-	
+	/* 합치거나 나눠 가질 이웃과, 부모에서 둘 사이의 키(k_prime)를 찾는다. */
 	neighbor_index = get_neighbor_index(N_offset);
 	k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
 	
-	lseek(fd,N_offset,SEEK_SET);
-	read(fd,&parent_offset,8);
-
-	lseek(fd,parent_offset+128+(16*k_prime_index),SEEK_SET);
-	read(fd,&k_prime,8);
+	parent = get_page(parent_offset);
+	k_prime = ENTRY_KEY(parent, k_prime_index);
+	put_page(parent_offset, 0);
 
-	neighbor_offset = get_neighbor_offset(key, N_offset);
+	neighbor_offset = get_neighbor_offset(N_offset);
 
-	lseek(fd,neighbor_offset+12,SEEK_SET);
-	read(fd,&neighbor_num_keys,4);
+	node = get_page(neighbor_offset);
+	if(is_Leaf)
+		fits = leaf_has_room((leaf_page*)node, num_keys, used);
+	else if(neighbor_index == -1)
+		fits = internal_can_merge(N_offset, k_prime, neighbor_offset);
+	else
+		fits = internal_can_merge(neighbor_offset, k_prime, N_offset);
+	put_page(neighbor_offset, 0);
 
-	//printf("neighbor_num_keys : %d, num_keys %d\n",neighbor_num_keys,num_keys);
-	if(is_Leaf){
-		capacity = leaf_order;
-	}else
-		capacity = internal_order - 1;
-	
-	printf("k_prime : %d\n",k_prime);
-	printf("neighbor_num_keys : %d num_keys : %d\n",neighbor_num_keys, num_keys);
-	
-	if ( neighbor_num_keys + num_keys < capacity )
+	if ( fits )
 		return coalesce_nodes(neighbor_offset, N_offset, neighbor_index, k_prime);
 	else
-		return redistribute_node(N_offset, neighbor_offset, neighbor_index, k_prime_index,k_prime);
+		return redistribute_node(N_offset, neighbor_offset, neighbor_index, k_prime_index, k_prime);
 }
 
 
-int delete(int64_t key){
+/* Deletes from the leaf alone, with tree_lock held shared
+ * (see Concurrency).  Returns 0 or -1 like delete, or 1 if
+ * the leaf would underflow, the root would become empty
+ * or the value has overflow pages to give back.
+ */
+int delete_in_leaf(int64_t key, int64_t * lsn){
+	int64_t L_O, R_O;
+	int i, ret;
+	char record[VALUE_SIZE];
+	header_page * header;
+	leaf_page * leaf, after;
+
+	*lsn = 0;
+	header = get_page(0);
+	R_O = header->root_page_offset;
+	put_page(0, 0);
+	if(R_O == -1)
+		return -1;
+	L_O = latch_leaf(find_leaf(key), key);
+	leaf = get_page(L_O);
+	i = leaf_lower_bound(leaf, key);
+	if(i == leaf->num_keys || LEAF_KEY(leaf, i) != key)
+		ret = -1;
+	else{
+		leaf_value(leaf, i, record);
+		memcpy(&after, leaf, PAGE_SIZE); // 지운 뒤의 모양을 사본에서 본다
+		leaf_remove_at(&after, i);
+		if(is_overflow(record))
+			ret = 1;
+		else if(L_O == R_O)
+			ret = after.num_keys > 0 ? 0 : 1;
+		else
+			ret = leaf_underfull(&after) ? 1 : 0;
+	}
+	put_page(L_O, 0);
+
+	if(ret == 0){
+		wal_begin();
+		remove_entry_from_node(key, L_O);
+		*lsn = wal_commit();
+	}
+	unlatch_page(L_O);
+	return ret;
+}
+
+/* delete without the record lock. */
+int tree_delete(int64_t key){
 	
-	int64_t leaf_offset;
-	char * f;
+	int64_t leaf_offset, lsn;
+	int ret;
+	char record[VALUE_SIZE];
+
+	pthread_rwlock_rdlock(&tree_lock);
+	ret = delete_in_leaf(key, &lsn);
+	pthread_rwlock_unlock(&tree_lock);
+	if(ret != 1){
+		tx_flush(lsn);
+		return ret;
+	}
+
+	pthread_rwlock_wrlock(&tree_lock);
+	wal_begin();
+
+	if (find_record(key, record) != 0)
+		ret = -1; // 존재하지 않으므로 실패
+	else{
+		leaf_offset = find_leaf(key);
+		ret = delete_entry(key,leaf_offset);
+		if(is_overflow(record)) // 오버플로 페이지도 돌려준다
+			overflow_free(((overflow_stub*)record)->first_page_offset);
+	}
+
+	lsn = wal_commit();
+	if(lsn != 0) tree_version++;
+	pthread_rwlock_unlock(&tree_lock);
+	tx_flush(lsn);
+	return ret;
+}
+
+int delete(int64_t key){
+	int ret;
+
+	if(tx_write_begin(key) != 0)
+		return -1;
+	ret = tree_delete(key);
+	tx_write_end();
+	return ret;
+}
+
+/* Range scans.
+ * A cursor walks the leaves from left to right through
+ * their right sibling offsets, so a scan descends from
+ * the root only once.  It works on a copy of the current
+ * leaf: records are returned without holding tree_lock,
+ * and the callback of scan may itself change the tree.
+ * To move on to the next leaf, the saved sibling offset
+ * is followed if no page was freed since the copy was
+ * taken (tree_version); otherwise the cursor looks its
+ * leaf up again from the first key it has not returned
+ * yet.  Either way it moves right past leaves that split
+ * in the meantime (see B-link).  Records inserted into a
+ * leaf after it was copied may be missed.
+ *
+ * While a cursor is on a leaf, the kernel is asked to
+ * read the next scan_prefetch_depth leaves in the
+ * background (posix_fadvise, or madvise in mmap mode), so
+ * a scan over cold data keeps the device busy instead of
+ * waiting for one page at a time.  The leaves ahead are
+ * the following children of the leaf's parent; at the
+ * end of a parent, the right sibling offset of the last
+ * child leads into the next one.
+ *
+ * It is off by default.  Leaves already in the buffer pool
+ * are skipped, but a leaf in the page cache still costs a
+ * system call.  On a scattered tree with a 256-frame pool,
+ * a depth of 8 made a buffered scan of a cold file about
+ * 40% faster and one of a cached file about 20% slower.
+ * With STORAGE_MMAP it was slower either way, because the
+ * kernel already reads ahead on the page faults.  Set it
+ * for scans over data that is mostly on the device.
+ */
+int scan_prefetch_depth = 0; // 0이면 prefetch하지 않는다
+
+struct cursor {
+	leaf_page leaf; // 현재 leaf의 사본
+	int64_t leaf_offset; // -1이면 끝
+	int index; // 다음에 돌려줄 레코드
+	int64_t version; // 사본을 뜰 때의 tree_version
+	int64_t next_key; // 아직 돌려주지 않은 가장 작은 키
+	int64_t prefetch_parent; // 이 부모의 자식들을
+	int prefetch_end; // 여기까지 prefetch했다 (-1은 leftmost)
+	int64_t prefetch_version;
+};
+
+/* Asks the kernel to start reading length bytes at offset. */
+void prefetch_range(int64_t offset, int64_t length){
+	if(storage_mode == STORAGE_MMAP){
+		if(offset + length <= mapped_size)
+			madvise(frame_pages + offset, length, MADV_WILLNEED);
+	}
+	else
+		posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+}
+
+/* Prefetches the children first..last of parent,
+ * skipping those already in the buffer pool and merging
+ * runs of adjacent pages into one request.
+ */
+void prefetch_children(internal_page * parent, int first, int last){
+	int i;
+	int64_t offset, run_start = -1, run_end = -1;
+	buf_partition * part;
+
+	for(i = first; i <= last; i++){
+		offset = i == -1 ? parent->leftmost_offset : ENTRY_OFFSET(parent, i);
+		if(storage_mode == STORAGE_BUFFERED){
+			part = buf_partition_of(offset);
+			pthread_mutex_lock(&part->mutex);
+			if(buf_lookup(offset) != NULL)
+				offset = -1; // 이미 pool에 있다
+			pthread_mutex_unlock(&part->mutex);
+			if(offset == -1)
+				continue;
+		}
+		if(offset != run_end){
+			if(run_start != -1)
+				prefetch_range(run_start, run_end - run_start);
+			run_start = offset;
+		}
+		run_end = offset + PAGE_SIZE;
+	}
+	if(run_start != -1)
+		prefetch_range(run_start, run_end - run_start);
+}
+
+/* Keeps the next scan_prefetch_depth leaves after the
+ * cursor's leaf in flight.  The window is refilled only
+ * when half of it was consumed, so that adjacent leaves
+ * go out as one request.  The caller holds tree_lock.
+ */
+void cursor_prefetch(cursor * c){
+	int i, start, end;
+	int64_t parent_offset = c->leaf.parent_page_offset;
+	internal_page * parent, copy;
+
+	if(scan_prefetch_depth <= 0 || parent_offset == -1)
+		return;
+
+	parent = get_page_shared(parent_offset, &copy); // leaf가 쪼개지면 부모도 바뀐다
+	for(i = -1; i < parent->num_keys; i++)
+		if((i == -1 ? parent->leftmost_offset : ENTRY_OFFSET(parent, i)) == c->leaf_offset)
+			break;
+	if(i == parent->num_keys){ // 있을 수 없지만, 부모를 못 믿으면 하지 않는다
+		put_page_shared(parent_offset);
+		return;
+	}
+
+	if(i == parent->num_keys - 1 && c->leaf.right_sibling_offset != 0)
+		prefetch_range(c->leaf.right_sibling_offset, PAGE_SIZE); // 다음 부모의 첫 leaf
+
+	start = i + 1;
+	if(parent_offset == c->prefetch_parent && c->prefetch_version == tree_version
+			&& c->prefetch_end >= start){
+		if(c->prefetch_end - i > scan_prefetch_depth / 2){ // 아직 반 넘게 남았다
+			put_page_shared(parent_offset);
+			return;
+		}
+		start = c->prefetch_end + 1;
+	}
+	end = i + scan_prefetch_depth;
+	if(end > parent->num_keys - 1)
+		end = parent->num_keys - 1;
+	if(start <= end)
+		prefetch_children(parent, start, end);
+
+	c->prefetch_parent = parent_offset;
+	c->prefetch_end = end;
+	c->prefetch_version = tree_version;
+	put_page_shared(parent_offset);
+}
+
+/* Copies the leaf that holds next_key, leaf_offset or
+ * one to its right, into the cursor and positions it at
+ * the first key >= next_key.  The caller holds tree_lock.
+ */
+void cursor_load(cursor * c, int64_t leaf_offset){
+	leaf_page * leaf;
+
+	c->leaf_offset = leaf_offset;
+	if(leaf_offset == -1)
+		return;
+	leaf = get_leaf_shared(&c->leaf_offset, c->next_key, &c->leaf);
+	if(leaf != &c->leaf)
+		memcpy(&c->leaf, leaf, PAGE_SIZE);
+	put_page_shared(c->leaf_offset);
+	c->version = tree_version;
+	c->index = leaf_lower_bound(&c->leaf, c->next_key);
+	cursor_prefetch(c);
+}
+
+/* Returns a cursor positioned before the first key
+ * >= start_key, or NULL if it could not be allocated.
+ */
+cursor * open_cursor(int64_t start_key){
+	cursor * c = (cursor*)malloc(sizeof(cursor));
+
+	if(c == NULL)
+		return NULL;
+	c->next_key = start_key;
+	c->prefetch_parent = -1;
+	c->prefetch_end = -1;
+	c->prefetch_version = -1;
+	pthread_rwlock_rdlock(&tree_lock);
+	cursor_load(c, find_leaf(start_key));
+	pthread_rwlock_unlock(&tree_lock);
+	return c;
+}
+
+/* Copies the next record into key and value (either
+ * may be NULL) and returns 0, or returns -1 at the end.
+ */
+int cursor_next(cursor * c, int64_t * key, char * value){
+	int64_t next;
+
+	while(c->leaf_offset != -1 && c->index == c->leaf.num_keys){
+		if(c->leaf.right_sibling_offset == 0){
+			c->leaf_offset = -1; // 마지막 leaf였다
+			break;
+		}
+		if(c->next_key < c->leaf.high_key)
+			c->next_key = c->leaf.high_key; // 남은 키는 모두 오른쪽에
+		pthread_rwlock_rdlock(&tree_lock);
+		if(c->version != tree_version) // leaf가 합쳐져 없어졌을 수 있다
+			next = find_leaf(c->next_key);
+		else
+			next = c->leaf.right_sibling_offset;
+		cursor_load(c, next);
+		pthread_rwlock_unlock(&tree_lock);
+	}
+	if(c->leaf_offset == -1)
+		return -1;
+
+	if(key != NULL)
+		*key = LEAF_KEY(&c->leaf, c->index);
+	if(value != NULL){
+		leaf_value(&c->leaf, c->index, value);
+		if(is_overflow(value)){ // 체인은 트리 락을 잡고 읽는다
+			pthread_rwlock_rdlock(&tree_lock);
+			if(find_record(LEAF_KEY(&c->leaf, c->index), value) == 0)
+				overflow_resolve(value);
+			else // 그새 지워졌다
+				memset(value + OVERFLOW_PREFIX, 0, VALUE_SIZE - OVERFLOW_PREFIX);
+			pthread_rwlock_unlock(&tree_lock);
+		}
+	}
+	if(LEAF_KEY(&c->leaf, c->index) == INT64_MAX)
+		c->leaf_offset = -1; // 더 큰 키는 없다
+	else
+		c->next_key = LEAF_KEY(&c->leaf, c->index) + 1;
+	c->index++;
+	return 0;
+}
+
+void close_cursor(cursor * c){
+	free(c);
+}
+
+/* Calls callback for every record with start <= key <= end,
+ * in key order, until it returns nonzero.
+ * Returns the number of records passed to callback.
+ */
+int scan(int64_t start, int64_t end, int (*callback)(int64_t key, char * value, void * arg), void * arg){
+	int num_found = 0;
+	int64_t key;
+	char value[VALUE_SIZE];
+	cursor * c;
+
+	if(start > end || (c = open_cursor(start)) == NULL)
+		return 0;
+	while(cursor_next(c, &key, value) == 0 && key <= end){
+		num_found++;
+		if(callback(key, value, arg) != 0)
+			break;
+	}
+	close_cursor(c);
+	return num_found;
+}
+
+/* Bulk loading.
+ * bulk_load builds the tree from records that arrive in
+ * strictly ascending key order, bottom up: leaves are
+ * filled one after the other to fill_factor of their
+ * capacity, and every time a node is full its first key
+ * and offset go up into the node one level above, which
+ * is filled the same way.  Only one open node per level
+ * (plus the one closed just before it) is kept in memory.
+ * The last node of a level is balanced with the one
+ * before it if it came out too small.
+ *
+ * The pages are appended after the end of the file,
+ * in the order they are opened, and written BULK_BATCH
+ * at a time with adjacent pages merged into one request.
+ * The last (1 - fill_factor) of every ALLOC_RUN pages, up
+ * to half, is skipped and left free for the nodes that
+ * will split next to it later.
+ * They are not logged: once they are all written the
+ * data file is synced, and a single logged update of the
+ * header page makes the new tree visible.  If the load
+ * fails or the process dies before that, the tree is
+ * still empty and the pages are reused by makefreepage.
+ * The tree must be empty; tree_lock is held throughout.
+ */
+#define BULK_BATCH 256
+#define BULK_MAX_LEVELS 64
+
+typedef struct bulk_level {
+	char page[PAGE_SIZE]; // 채우고 있는 노드
+	int64_t offset;
+	int64_t first_key; // 이 노드의 가장 작은 키
+	char pending[PAGE_SIZE]; // 바로 앞에 닫힌 노드, 마지막 노드와 나눌 수 있게 아직 쓰지 않았다
+	int64_t pending_offset;
+	int64_t pending_first_key;
+	int num_nodes; // 이 레벨에 연 노드 수
+} bulk_level;
+
+typedef struct bulk_fixup {
+	int64_t page_offset;
+	int64_t parent_offset;
+} bulk_fixup;
+
+typedef struct bulk_loader {
+	bulk_level levels[BULK_MAX_LEVELS];
+	int num_levels;
+	int leaf_fill; // leaf 하나에 넣을 레코드 수
+	int leaf_bytes; // leaf 하나에 채울 바이트
+	int internal_fill; // internal 하나에 넣을 자식 수
+	int reserve; // 묶음마다 split 몫으로 비워 두는 페이지 수
+	int64_t next_offset; // 다음에 붙일 페이지
+	int64_t first_offset;
+	char * batch; // 쓰기를 기다리는 페이지들
+	int64_t batch_offsets[BULK_BATCH];
+	int batch_len;
+	char * staging; // 오프셋 순으로 정렬해서 쓰는 버퍼
+	bulk_fixup * fixups; // 다 쓴 뒤에 parent를 고칠 페이지들
+	int num_fixups;
+	int64_t * wasted; // 합쳐졌거나 split 몫으로 남겨서 비어 있을 페이지들
+	int num_wasted;
+} bulk_loader;
+
+void bulk_add_wasted(bulk_loader * b, int64_t offset){
+	b->wasted = (int64_t*)realloc(b->wasted, sizeof(int64_t) * (b->num_wasted + 1));
+	b->wasted[b->num_wasted++] = offset;
+}
+
+int64_t bulk_alloc(bulk_loader * b){
+	int64_t offset;
+
+	while(1){
+		if((b->next_offset / PAGE_SIZE) % BITMAP_GROUP == 1) // 비트맵 자리는 건너뛴다
+			b->next_offset += PAGE_SIZE;
+		else if((b->next_offset / PAGE_SIZE) % ALLOC_RUN >= ALLOC_RUN - b->reserve){
+			bulk_add_wasted(b, b->next_offset); // 나중 split 몫으로 비워 둔다
+			b->next_offset += PAGE_SIZE;
+		}
+		else
+			break;
+	}
+	offset = b->next_offset;
+	b->next_offset += PAGE_SIZE;
+	return offset;
+}
+
+int bulk_compare_offsets(const void * x, const void * y){
+	int64_t a = (*(const int64_t**)x)[0], c = (*(const int64_t**)y)[0];
+	return a < c ? -1 : a > c;
+}
+
+void bulk_flush(bulk_loader * b){
+	int i, n = 0;
+	int64_t * order[BULK_BATCH];
+	io_request reqs[BULK_BATCH];
+	char * page;
+
+	if(b->batch_len == 0)
+		return;
+	for(i=0; i < b->batch_len; i++)
+		order[i] = &b->batch_offsets[i];
+	qsort(order, b->batch_len, sizeof(int64_t*), bulk_compare_offsets);
+
+	// 오프셋 순으로 모으고, 이어지는 페이지는 요청 하나로
+	for(i=0; i < b->batch_len; i++){
+		page = b->batch + (size_t)(order[i] - b->batch_offsets)*PAGE_SIZE;
+		if(cold_write(*order[i], page) == 0) // 압축된 leaf는 cold 파일로
+			continue;
+		cold_forget(*order[i]); // 헤더가 보이기 전이라 아무도 읽지 않는다
+		memcpy(b->staging + (size_t)i*PAGE_SIZE, page, PAGE_SIZE);
+		if(n > 0 && reqs[n-1].offset + reqs[n-1].length == *order[i]){
+			reqs[n-1].length += PAGE_SIZE;
+			continue;
+		}
+		reqs[n].opcode = IO_WRITE;
+		reqs[n].offset = *order[i];
+		reqs[n].buf = b->staging + (size_t)i*PAGE_SIZE;
+		reqs[n].length = PAGE_SIZE;
+		n++;
+	}
+	if(n > 0)
+		io_run(reqs, n);
+	b->batch_len = 0;
+}
+
+void bulk_write(bulk_loader * b, int64_t offset, const char * page){
+	if(b->batch_len == BULK_BATCH)
+		bulk_flush(b);
+	memcpy(b->batch + (size_t)b->batch_len*PAGE_SIZE, page, PAGE_SIZE);
+	b->batch_offsets[b->batch_len++] = offset;
+}
+
+void bulk_add_fixup(bulk_loader * b, int64_t page_offset, int64_t parent_offset){
+	b->fixups = (bulk_fixup*)realloc(b->fixups, sizeof(bulk_fixup) * (b->num_fixups + 1));
+	b->fixups[b->num_fixups].page_offset = page_offset;
+	b->fixups[b->num_fixups].parent_offset = parent_offset;
+	b->num_fixups++;
+}
+
+/* An internal node as (key, child) pairs; the key of
+ * the leftmost child is the node's first key.
+ */
+int bulk_children(internal_page * node, int64_t first_key, int64_t * keys, int64_t * offsets){
+	keys[0] = first_key;
+	offsets[0] = node->leftmost_offset;
+	return internal_load(node, keys + 1, offsets + 1) + 1;
+}
+
+void bulk_set_children(internal_page * node, const int64_t * keys, const int64_t * offsets, int n){
+	node->leftmost_offset = offsets[0];
+	internal_store(node, keys + 1, offsets + 1, n - 1);
+}
+
+void bulk_open(bulk_loader * b, int level, int64_t first_key){
+	bulk_level * lv = &b->levels[level];
+	node_page * node = (node_page*)lv->page;
+
+	memset(lv->page, 0, PAGE_SIZE);
+	node->parent_page_offset = -1;
+	node->is_leaf = level == 0;
+	lv->offset = bulk_alloc(b);
+	lv->first_key = first_key;
+	lv->num_nodes++;
+	if(lv->num_nodes > 1) // 앞 노드를 이어준다
+		node_link((node_page*)lv->pending, lv->offset, first_key);
+}
+
+int64_t bulk_push(bulk_loader * b, int level, int64_t key, int64_t child_offset);
+
+/* Closes the open node of a level: it goes up into the
+ * parent level, the node closed before it is written,
+ * and it becomes the pending one.
+ */
+void bulk_close(bulk_loader * b, int level){
+	bulk_level * lv = &b->levels[level];
+
+	((node_page*)lv->page)->parent_page_offset = bulk_push(b, level + 1, lv->first_key, lv->offset);
+	if(lv->num_nodes > 1)
+		bulk_write(b, lv->pending_offset, lv->pending);
+	memcpy(lv->pending, lv->page, PAGE_SIZE);
+	lv->pending_offset = lv->offset;
+	lv->pending_first_key = lv->first_key;
+	lv->offset = -1;
+}
 
-	if ( (f=find(key)) == NULL)  return -1; // 존재하지 않으므로 실패
-	free(f);
+/* Adds a child to the open node of level and returns
+ * the offset of that node, which is the child's parent.
+ */
+int64_t bulk_push(bulk_loader * b, int level, int64_t key, int64_t child_offset){
+	bulk_level * lv;
+	internal_page * node;
+
+	if(level == BULK_MAX_LEVELS){
+		fprintf(stderr, "Bulk load: too many levels.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(level == b->num_levels){ // 새 레벨
+		b->levels[level].offset = -1;
+		b->levels[level].num_nodes = 0;
+		b->num_levels++;
+	}
+	lv = &b->levels[level];
+	node = (internal_page*)lv->page;
+	if(lv->offset != -1){
+		if(node->num_keys + 1 < b->internal_fill && internal_insert(node, node->num_keys, key, child_offset) == 0)
+			return lv->offset;
+		bulk_close(b, level); // 다 찼다 (압축된 키는 바이트로도 찬다)
+	}
+	bulk_open(b, level, key);
+	node->leftmost_offset = child_offset;
+	return lv->offset;
+}
+
+/* Balances the last node of a level with the pending one
+ * when it has fewer than the minimum number of entries.
+ * Returns 1 if the two had to be merged into the pending
+ * node, 0 otherwise.
+ */
+int bulk_balance(bulk_loader * b, int level){
+	int i, n, total, minimum, move;
+	bulk_level * lv = &b->levels[level];
+	leaf_page * last_leaf = (leaf_page*)lv->page, * prev_leaf = (leaf_page*)lv->pending;
+	int64_t keys[2*INTERNAL_ORDER], offsets[2*INTERNAL_ORDER];
+
+	if(level == 0){
+		if(!leaf_underfull(last_leaf))
+			return 0;
+		if(leaf_has_room(prev_leaf, last_leaf->num_keys, leaf_used(last_leaf))){
+			for(i = 0; i < last_leaf->num_keys; i++)
+				leaf_move(prev_leaf, prev_leaf->num_keys, last_leaf, i);
+			node_link((node_page*)prev_leaf, 0, 0);
+			return 1;
+		}
+		while(leaf_underfull(last_leaf)){
+			n = prev_leaf->num_keys - 1;
+			leaf_move(last_leaf, 0, prev_leaf, n);
+			leaf_remove_at(prev_leaf, n);
+		}
+		lv->first_key = leaf_separator(LEAF_KEY(prev_leaf, prev_leaf->num_keys - 1), LEAF_KEY(last_leaf, 0));
+		prev_leaf->high_key = lv->first_key;
+		return 0;
+	}
+
+	minimum = cut(internal_order); // 자식 수
+	n = bulk_children((internal_page*)lv->pending, lv->pending_first_key, keys, offsets);
+	total = n + bulk_children((internal_page*)lv->page, lv->first_key, keys + n, offsets + n);
+	if(total - n >= minimum)
+		return 0;
+	if(total < 2*minimum && internal_fits(keys + 1, total - 1)){
+		bulk_set_children((internal_page*)lv->pending, keys, offsets, total);
+		node_link((node_page*)lv->pending, 0, 0);
+		for(i = n; i < total; i++)
+			bulk_add_fixup(b, offsets[i], lv->pending_offset);
+		return 1;
+	}
+	// 압축된 키가 길어서 합칠 수 없으면 반씩 나눈다
+	move = (total < 2*minimum ? total / 2 : minimum) - (total - n);
+	if(move <= 0)
+		return 0;
+	bulk_set_children((internal_page*)lv->pending, keys, offsets, n - move);
+	bulk_set_children((internal_page*)lv->page, keys + n - move, offsets + n - move, total - n + move);
+	lv->first_key = keys[n - move];
+	((node_page*)lv->pending)->high_key = lv->first_key;
+	for(i = n - move; i < n; i++)
+		bulk_add_fixup(b, offsets[i], lv->offset);
+	return 0;
+}
+
+/* Closes every level from the leaves up and returns
+ * the offset of the root, or -1 if nothing was loaded.
+ */
+int64_t bulk_finish(bulk_loader * b){
+	int level;
+	int64_t root = -1;
+	bulk_level * lv;
+	internal_page * top;
+
+	for(level = 0; level < b->num_levels; level++){
+		lv = &b->levels[level];
+		if(lv->offset == -1)
+			continue;
+		if(level == b->num_levels - 1 && lv->num_nodes == 1){ // 레벨에 노드가 하나뿐: 루트
+			top = (internal_page*)lv->page;
+			if(level > 0 && top->num_keys == 0){ // 아래 레벨에서 합쳐져서 자식이 하나 남았다
+				root = top->leftmost_offset;
+				bulk_add_fixup(b, root, -1);
+				bulk_add_wasted(b, lv->offset);
+				break;
+			}
+			root = lv->offset;
+			top->parent_page_offset = -1;
+			bulk_write(b, lv->offset, lv->page);
+			break;
+		}
+		if(bulk_balance(b, level))
+			bulk_add_wasted(b, lv->offset); // 앞 노드에 합쳐졌다
+		else
+			bulk_close(b, level);
+		bulk_write(b, lv->pending_offset, lv->pending);
+	}
+	bulk_flush(b);
+	return root;
+}
 
-	leaf_offset = find_leaf(key);
+int bulk_load(sorted_iterator next, void * arg, double fill_factor){
+	int i, size, ret = 0, loaded = 0;
+	int64_t key, prev_key = 0, root, lsn;
+	char value[VALUE_SIZE];
+	bulk_loader * b;
+	bulk_level * leaves;
+	leaf_page * leaf;
+	header_page * header;
+	node_page * node;
+
+	if(fill_factor <= 0 || fill_factor > 1)
+		return -1;
+	b = (bulk_loader*)calloc(1, sizeof(bulk_loader));
+	if(b == NULL)
+		return -1;
+	b->batch = (char*)malloc((size_t)PAGE_SIZE * BULK_BATCH);
+	b->staging = (char*)malloc((size_t)PAGE_SIZE * BULK_BATCH);
+	if(b->batch == NULL || b->staging == NULL){
+		free(b->batch);
+		free(b->staging);
+		free(b);
+		return -1;
+	}
+	b->leaf_fill = (int)(fill_factor * (leaf_order - 1));
+	if(b->leaf_fill < cut(leaf_order - 1)) b->leaf_fill = cut(leaf_order - 1);
+	b->leaf_bytes = (int)(fill_factor * LEAF_SPACE);
+	b->internal_fill = (int)(fill_factor * internal_order);
+	if(b->internal_fill < cut(internal_order)) b->internal_fill = cut(internal_order);
+	b->reserve = (int)((1 - fill_factor) * ALLOC_RUN + 0.5);
+	if(b->reserve > ALLOC_RUN / 2) b->reserve = ALLOC_RUN / 2;
+
+	pthread_rwlock_wrlock(&tree_lock);
+	header = get_page(0);
+	root = header->root_page_offset;
+	b->first_offset = b->next_offset = (header->num_pages + 1) * PAGE_SIZE; // 파일 끝부터
+	put_page(0, 0);
+	if(root != -1){ // 빈 트리에만 올릴 수 있다
+		ret = -1;
+		goto done;
+	}
 
-	return delete_entry(key,leaf_offset);
+	leaves = &b->levels[0];
+	leaves->offset = -1;
+	b->num_levels = 1;
+	while(next(&key, value, arg) == 0){
+		if(loaded > 0 && key <= prev_key){ // 정렬되어 있지 않다
+			ret = -1;
+			goto done;
+		}
+		size = strnlen(value, VALUE_SIZE);
+		memset(value + size, 0, VALUE_SIZE - size); // 문자열 레코드로 맞춘다
+		leaf = (leaf_page*)leaves->page;
+		size = leaf_record_size(value);
+		if(leaves->offset != -1 && (leaf->num_keys == b->leaf_fill || !leaf_has_room(leaf, 1, size) ||
+					(leaf_used(leaf) + size > b->leaf_bytes && !leaf_underfull(leaf))))
+			bulk_close(b, 0);
+		if(leaves->offset == -1)
+			bulk_open(b, 0, loaded > 0 ? leaf_separator(prev_key, key) : key);
+		leaf_insert(leaf, leaf->num_keys, key, value);
+		prev_key = key;
+		loaded++;
+
+		if(storage_mode == STORAGE_MMAP && b->next_offset + BULK_BATCH*PAGE_SIZE > mapped_size){
+			// ftruncate가 써둔 페이지를 자르지 않도록 미리 늘린다
+			mmap_grow(b->next_offset + BULK_BATCH*PAGE_SIZE);
+		}
+	}
+	if(loaded == 0)
+		goto done;
+	root = bulk_finish(b);
+
+	for(i=0; i < b->num_fixups; i++){
+		node = get_page(b->fixups[i].page_offset);
+		node->parent_page_offset = b->fixups[i].parent_offset;
+		put_page(b->fixups[i].page_offset, 1);
+	}
+	buf_flush_all();
+	if(fdatasync(fd) != 0){
+		perror("Bulk load sync.");
+		exit(EXIT_FAILURE);
+	}
+	cold_checkpoint(); // 압축한 leaf들도 헤더보다 먼저
+
+	// 여기서부터 로그: 헤더 하나로 새 트리를 보이게 한다
+	wal_begin();
+	header = get_page(0);
+	bitmap_grow(header, b->next_offset / PAGE_SIZE - 1);
+	bitmap_mark(b->first_offset / PAGE_SIZE, b->next_offset / PAGE_SIZE - 1, 1);
+	for(i=0; i < b->num_wasted; i++)
+		bitmap_mark(b->wasted[i] / PAGE_SIZE, b->wasted[i] / PAGE_SIZE, 0);
+	header->root_page_offset = root;
+	put_page(0, 1);
+	lsn = wal_commit();
+	tree_version++;
+	pthread_rwlock_unlock(&tree_lock);
+	wal_flush(lsn);
+	goto cleanup;
+
+done:
+	pthread_rwlock_unlock(&tree_lock);
+cleanup:
+	free(b->batch);
+	free(b->staging);
+	free(b->fixups);
+	free(b->wasted);
+	free(b);
+	return ret;
 }
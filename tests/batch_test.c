@@ -0,0 +1,208 @@
+/* Bulk loading and batches.
+ * Usage: batch_test <mode>
+ * The tree is bulk loaded, changed with single inserts and
+ * deletes, grown with insert_batch and read back with
+ * find_batch, and compared with a plain array of the keys
+ * that should be there.  With uring, find_batch reads the
+ * children of a node in one io_uring submission, and with
+ * lz the bulk loader writes its leaves compressed.
+ */
+#include "last_version.c"
+#include "tree_check.h"
+
+#define NUM_KEYS 30000
+#define BATCH 500
+
+char db_path[1024];
+char present[NUM_KEYS];
+int64_t num_present;
+int64_t next_bulk_key;
+
+void value_of(int64_t key, char * value){
+	memset(value, 0, VALUE_SIZE);
+	snprintf(value, VALUE_SIZE, "value %" PRId64, key);
+}
+
+// bulk_load에 3의 배수 키를 차례로 넘긴다
+int bulk_next(int64_t * key, char * value, void * arg){
+	(void)arg;
+	if(next_bulk_key >= NUM_KEYS)
+		return -1;
+	*key = next_bulk_key;
+	value_of(*key, value);
+	present[*key] = 1;
+	num_present++;
+	next_bulk_key += 3;
+	return 0;
+}
+
+// 중간에 키가 거꾸로 간다
+int unsorted_next(int64_t * key, char * value, void * arg){
+	int * n = (int*)arg;
+
+	if(*n == 1000)
+		return -1;
+	*key = *n == 500 ? 3 : *n * 2;
+	value_of(*key, value);
+	(*n)++;
+	return 0;
+}
+
+/* insert_batch into an empty tree with short strings that
+ * are not padded to VALUE_SIZE.  They end right before a
+ * guard page, so reading past them stops the test.
+ */
+void short_values(){
+	char * guard = (char*)mmap(NULL, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int64_t keys[2] = { 7, 5 };
+	char * values[2], * found;
+
+	CHECK(guard != MAP_FAILED && mprotect(guard + PAGE_SIZE, PAGE_SIZE, PROT_NONE) == 0, "guard page");
+	values[0] = guard + PAGE_SIZE - 2;
+	values[1] = guard + PAGE_SIZE - 5;
+	strcpy(values[0], "a");
+	strcpy(values[1], "bc");
+	CHECK(insert_batch(keys, values, 2) == 2, "insert_batch into an empty tree failed");
+	found = find(5);
+	CHECK(found != NULL && strcmp(found, "bc") == 0, "the first record of a batch into an empty tree is wrong");
+	free(found);
+	found = find(7);
+	CHECK(found != NULL && strcmp(found, "a") == 0, "the second record of a batch into an empty tree is wrong");
+	free(found);
+	CHECK(delete(5) == 0 && delete(7) == 0 && check_tree() == 0, "could not empty the tree again");
+	munmap(guard, 2 * PAGE_SIZE);
+}
+
+void check_count(){
+	CHECK(check_tree() == num_present, "tree holds a different number of records");
+}
+
+void check_values(){
+	char expected[VALUE_SIZE], * found;
+	int64_t key;
+
+	for(key = 0; key < NUM_KEYS; key++){
+		found = find(key);
+		CHECK((found != NULL) == present[key], "find %" PRId64, key);
+		value_of(key, expected);
+		CHECK(found == NULL || strcmp(found, expected) == 0, "find: key %" PRId64 " has a wrong value", key);
+		free(found);
+	}
+}
+
+// 불러온 트리도 보통 트리처럼 나뉘고 합쳐져야 한다
+void changes(){
+	char value[VALUE_SIZE];
+	int64_t key;
+	int i;
+
+	for(i = 0; i < NUM_KEYS / 2; i++){
+		key = rand() % NUM_KEYS;
+		value_of(key, value);
+		if(rand() % 2){
+			CHECK((insert(key, value) == 0) != present[key], "insert %" PRId64, key);
+			if(!present[key]){
+				present[key] = 1;
+				num_present++;
+			}
+		}
+		else{
+			CHECK((delete(key) == 0) == present[key], "delete %" PRId64, key);
+			if(present[key]){
+				present[key] = 0;
+				num_present--;
+			}
+		}
+	}
+	check_count();
+}
+
+void batches(){
+	int64_t keys[BATCH];
+	char * values[BATCH], * out[BATCH], buffers[BATCH][VALUE_SIZE], expected[VALUE_SIZE];
+	char seen[NUM_KEYS];
+	int i, round, inserted, expected_inserted, found, expected_found;
+
+	for(round = 0; round < 20; round++){
+		memset(seen, 0, sizeof(seen));
+		expected_inserted = 0;
+		for(i = 0; i < BATCH; i++){
+			keys[i] = rand() % NUM_KEYS;
+			if(i > 0 && rand() % 10 == 0)
+				keys[i] = keys[i - 1]; // 배치 안의 중복
+			values[i] = buffers[i];
+			value_of(keys[i], buffers[i]);
+			if(!present[keys[i]] && !seen[keys[i]])
+				expected_inserted++;
+			seen[keys[i]] = 1;
+		}
+		inserted = insert_batch(keys, values, BATCH);
+		CHECK(inserted == expected_inserted, "insert_batch inserted %d of %d new keys", inserted, expected_inserted);
+		for(i = 0; i < BATCH; i++)
+			if(!present[keys[i]]){
+				present[keys[i]] = 1;
+				num_present++;
+			}
+		check_count();
+
+		expected_found = 0;
+		for(i = 0; i < BATCH; i++){
+			keys[i] = rand() % NUM_KEYS;
+			out[i] = buffers[i];
+			expected_found += present[keys[i]];
+		}
+		found = find_batch(keys, BATCH, out);
+		CHECK(found == expected_found, "find_batch found %d of %d", found, expected_found);
+		for(i = 0; i < BATCH; i++){
+			CHECK((out[i] != NULL) == present[keys[i]], "find_batch: key %" PRId64, keys[i]);
+			value_of(keys[i], expected);
+			CHECK(out[i] == NULL || strcmp(out[i], expected) == 0, "find_batch: key %" PRId64 " has a wrong value", keys[i]);
+		}
+
+		for(i = 0; i < BATCH / 5; i++){ // 합쳐지기도 하게 조금 지운다
+			keys[0] = rand() % NUM_KEYS;
+			CHECK((delete(keys[0]) == 0) == present[keys[0]], "delete %" PRId64, keys[0]);
+			if(present[keys[0]]){
+				present[keys[0]] = 0;
+				num_present--;
+			}
+		}
+	}
+	check_count();
+	check_values();
+}
+
+int main(int argc, char ** argv){
+	int n = 0;
+
+	CHECK(argc == 2, "usage: batch_test <mode>");
+	check_configure(argv[1]);
+	snprintf(db_path, sizeof(db_path), "batch_%s_%d.db", argv[1], getpid());
+	check_remove_db(db_path);
+	leaf_order = 8;
+	internal_order = 8;
+	buffer_frames = 128;
+	srand(5);
+
+	CHECK(open_db(db_path) == 0, "open_db failed");
+	CHECK(bulk_load(unsorted_next, &n, 0.7) == -1, "bulk_load took unsorted keys");
+	CHECK(check_tree() == 0, "a failed bulk_load left records");
+	short_values();
+	CHECK(bulk_load(bulk_next, NULL, 0.7) == 0, "bulk_load failed");
+	check_count();
+	CHECK(bulk_load(bulk_next, NULL, 0.7) == -1, "bulk_load into a tree that is not empty");
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	check_count();
+	check_values();
+	changes();
+	batches();
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	check_count();
+	check_values();
+	close_db();
+	check_remove_db(db_path);
+	printf("batch_test %s: ok\n", argv[1]);
+	return 0;
+}
@@ -0,0 +1,203 @@
+/* Recovery after kill -9.
+ * Usage: crash_test kill [<mode>] | write_back
+ * A child process inserts and deletes random keys and tells
+ * the parent, through a pipe, which operation it starts and
+ * what it returned.  The parent kills it at a random moment,
+ * reopens the file and checks that the tree is whole and
+ * holds exactly the operations that returned, give or take
+ * the one that was running.
+ * With write_back the child changes two leaves in one
+ * operation, the second right after the log was flushed,
+ * writes both pages back and is killed before it commits:
+ * the log must have both updates, or recovery cannot undo
+ * the second one.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+
+ssize_t test_pwrite(int fd, const void * buf, size_t count, off_t offset);
+#define pwrite test_pwrite // 데이터 파일에 쓴 횟수를 센다
+#include "last_version.c"
+#undef pwrite
+#include "tree_check.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define NUM_KEYS 3000
+#define ROUNDS 8
+
+char db_path[1024];
+char present[NUM_KEYS];
+int kill_after_writes; // 0이 아니면 데이터 파일에 이만큼 쓰고 죽는다
+
+ssize_t test_pwrite(int file, const void * buf, size_t count, off_t offset){
+	ssize_t written = pwrite(file, buf, count, offset);
+
+	if(file == fd && kill_after_writes > 0 && --kill_after_writes == 0)
+		raise(SIGKILL);
+	return written;
+}
+
+void value_of(int64_t key, char * value){
+	int length = (int)(key % 90);
+
+	memset(value, 0, VALUE_SIZE);
+	snprintf(value, VALUE_SIZE, "%" PRId64 ":", key);
+	memset(value + strlen(value), 'a' + (int)(key & 15), length);
+}
+
+// 자식: 시작하는 연산 (op, key), 끝나면 (2, 결과)를 보낸다
+void run_child(int out, unsigned int seed){
+	char value[VALUE_SIZE];
+	int message[2];
+
+	srand(seed);
+	CHECK(open_db(db_path) == 0, "child: open_db failed");
+	while(1){
+		message[0] = rand() % 3 ? 1 : 0;
+		message[1] = rand() % NUM_KEYS;
+		CHECK(write(out, message, sizeof(message)) == sizeof(message), "child: pipe");
+		if(message[0]){
+			value_of(message[1], value);
+			message[1] = insert(message[1], value);
+		}
+		else
+			message[1] = delete(message[1]);
+		message[0] = 2;
+		CHECK(write(out, message, sizeof(message)) == sizeof(message), "child: pipe");
+	}
+}
+
+void crash_round(int round, int delay){
+	int channel[2], message[2], pending = -1, pending_insert = 0, i, has;
+	char value[VALUE_SIZE], * found;
+	int64_t count = 0;
+	pid_t pid;
+
+	CHECK(pipe(channel) == 0, "pipe");
+	pid = fork();
+	CHECK(pid >= 0, "fork");
+	if(pid == 0){
+		close(channel[0]);
+		run_child(channel[1], round * 7919 + 1);
+	}
+	close(channel[1]);
+	usleep(delay);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	while(read(channel[0], message, sizeof(message)) == sizeof(message)){
+		if(message[0] < 2){
+			pending_insert = message[0];
+			pending = message[1];
+		}
+		else{
+			if(message[1] == 0) // 넣었거나 지웠다
+				present[pending] = pending_insert;
+			pending = -1;
+		}
+	}
+	close(channel[0]);
+
+	CHECK(open_db(db_path) == 0, "round %d: recovery failed", round);
+	for(i = 0; i < NUM_KEYS; i++){
+		found = find(i);
+		has = found != NULL;
+		if(i == pending) // 도중에 죽은 연산은 어느 쪽이든 된다
+			present[i] = has;
+		CHECK(has == present[i], "round %d: key %d is %s", round, i, has ? "back" : "lost");
+		if(has){
+			value_of(i, value);
+			CHECK(strcmp(found, value) == 0, "round %d: key %d has a wrong value", round, i);
+			free(found);
+		}
+		count += has;
+	}
+	CHECK(check_tree() == count, "round %d: tree holds %" PRId64 " records", round, count);
+	close_db();
+}
+
+// 자식: 두 leaf의 첫 키를 지우고 커밋하기 전에 써 내보낸다
+void write_back_child(int64_t second_key){
+	int64_t offsets[2];
+	leaf_page * leaf;
+	int i;
+
+	CHECK(open_db(db_path) == 0, "child: open_db failed");
+	offsets[0] = find_leaf(0);
+	offsets[1] = find_leaf(second_key);
+	CHECK(offsets[0] != offsets[1], "child: both keys are in one leaf");
+	buf_flush_dirty(); // 이 두 페이지만 더러워지게
+
+	wal_begin();
+	for(i = 0; i < 2; i++){
+		leaf = get_page(offsets[i]);
+		leaf_remove_at(leaf, 0);
+		put_page(offsets[i], 1);
+		if(i == 0)
+			wal_flush(wal_tail_lsn()); // 두 번째 레코드는 디스크에 있는 로그 바로 뒤에서 시작한다
+	}
+	kill_after_writes = 2;
+	buf_flush_dirty();
+	_exit(0);
+}
+
+void write_back_round(int round){
+	int64_t second_key = NUM_KEYS / (ROUNDS + 1) * (round + 1);
+	char value[VALUE_SIZE], * found;
+	int status, i;
+	pid_t pid;
+
+	pid = fork();
+	CHECK(pid >= 0, "fork");
+	if(pid == 0)
+		write_back_child(second_key);
+	waitpid(pid, &status, 0);
+	CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL, "round %d: the child wrote back fewer pages", round);
+
+	CHECK(open_db(db_path) == 0, "round %d: recovery failed", round);
+	for(i = 0; i < NUM_KEYS; i++){
+		found = find(i);
+		CHECK(found != NULL, "round %d: key %d lost", round, i);
+		value_of(i, value);
+		CHECK(strcmp(found, value) == 0, "round %d: key %d has a wrong value", round, i);
+		free(found);
+	}
+	CHECK(check_tree() == NUM_KEYS, "round %d: tree holds a different number of records", round);
+	close_db();
+}
+
+int main(int argc, char ** argv){
+	char value[VALUE_SIZE];
+	int round, i, write_back;
+
+	write_back = argc == 2 && strcmp(argv[1], "write_back") == 0;
+	CHECK(write_back || (argc >= 2 && strcmp(argv[1], "kill") == 0), "usage: crash_test kill [<mode>] | write_back");
+	check_configure(argc > 2 ? argv[2] : "buffered");
+	snprintf(db_path, sizeof(db_path), "crash_%s_%d.db", argc > 2 ? argv[2] : argv[1], getpid());
+	check_remove_db(db_path);
+	leaf_order = 4;
+	internal_order = 4;
+	buffer_frames = 16; // 연산 도중에도 페이지가 밀려난다
+	checkpoint_interval = 1;
+	checkpoint_log_bytes = 300000;
+	srand(getpid());
+
+	if(write_back){
+		checkpoint_interval = 3600; // 체크포인터가 페이지를 먼저 쓰지 않게
+		CHECK(open_db(db_path) == 0, "open_db failed");
+		for(i = 0; i < NUM_KEYS; i++){
+			value_of(i, value);
+			CHECK(insert(i, value) == 0, "insert failed");
+		}
+		close_db();
+		for(round = 0; round < ROUNDS; round++)
+			write_back_round(round);
+	}
+	else
+		for(round = 0; round < ROUNDS; round++)
+			crash_round(round, 20000 + rand() % 300000);
+	check_remove_db(db_path);
+	printf("crash_test %s: ok\n", argv[1]);
+	return 0;
+}
@@ -0,0 +1,134 @@
+/* Range scans and cursors.
+ * Usage: scan_test <prefetch depth>
+ * Every third key is inserted, then ranges are scanned and
+ * walked with cursors and compared with a plain array of the
+ * keys that should be there, also while the callback itself
+ * changes the tree under the scan.  The cursors prefetch the
+ * given number of leaves ahead.
+ */
+#include "last_version.c"
+#include "tree_check.h"
+
+#define NUM_KEYS 30000
+
+char db_path[1024];
+char present[NUM_KEYS];
+int64_t num_present;
+
+void value_of(int64_t key, char * value){
+	memset(value, 0, VALUE_SIZE);
+	snprintf(value, VALUE_SIZE, "value %" PRId64, key);
+}
+
+void check_count(){
+	CHECK(check_tree() == num_present, "tree holds a different number of records");
+}
+
+typedef struct scan_state {
+	int64_t last_key;
+	int64_t count;
+	int64_t stop_after;
+	int modify;
+} scan_state;
+
+int scan_visit(int64_t key, char * value, void * arg){
+	scan_state * s = (scan_state*)arg;
+	char expected[VALUE_SIZE];
+	int64_t k;
+
+	CHECK(key > s->last_key, "scan: key %" PRId64 " after %" PRId64, key, s->last_key);
+	s->last_key = key;
+	s->count++;
+	if(s->modify){ // 훑는 도중에 트리를 바꿔도 순서는 지켜져야 한다
+		k = rand() % NUM_KEYS;
+		value_of(k, expected);
+		if(rand() % 2 ? insert(k, expected) == 0 : delete(k) == 0){
+			num_present += present[k] ? -1 : 1;
+			present[k] = !present[k];
+		}
+		return 0;
+	}
+	CHECK(key >= 0 && key < NUM_KEYS && present[key], "scan: key %" PRId64 " should not be there", key);
+	value_of(key, expected);
+	CHECK(strcmp(value, expected) == 0, "scan: key %" PRId64 " has a wrong value", key);
+	return s->count == s->stop_after;
+}
+
+void scans(){
+	scan_state s;
+	int64_t start, end, k, expected;
+	int i;
+
+	for(i = 0; i < 200; i++){
+		start = rand() % NUM_KEYS;
+		end = start + rand() % 3000;
+		for(expected = 0, k = start; k <= end && k < NUM_KEYS; k++)
+			expected += present[k];
+		memset(&s, 0, sizeof(s));
+		s.last_key = INT64_MIN;
+		s.stop_after = i % 4 == 0 ? 10 : -1;
+		if(s.stop_after > 0 && expected > s.stop_after)
+			expected = s.stop_after;
+		CHECK(scan(start, end, scan_visit, &s) == expected && s.count == expected,
+			"scan [%" PRId64 ", %" PRId64 "] passed %" PRId64 " records, expected %" PRId64, start, end, s.count, expected);
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.last_key = INT64_MIN;
+	s.modify = 1;
+	scan(INT64_MIN, INT64_MAX, scan_visit, &s);
+	check_count();
+}
+
+void cursors(){
+	int64_t start, k, key;
+	char value[VALUE_SIZE], expected_value[VALUE_SIZE];
+	cursor * c;
+
+	start = NUM_KEYS / 2;
+	c = open_cursor(start);
+	CHECK(c != NULL, "open_cursor failed");
+	for(k = start; k < NUM_KEYS; k++)
+		if(present[k]){
+			CHECK(cursor_next(c, &key, value) == 0 && key == k, "cursor: expected %" PRId64, k);
+			value_of(k, expected_value);
+			CHECK(strcmp(value, expected_value) == 0, "cursor: key %" PRId64 " has a wrong value", k);
+		}
+	CHECK(cursor_next(c, &key, NULL) == -1, "cursor does not end");
+	close_cursor(c);
+	c = open_cursor(NUM_KEYS + 5);
+	CHECK(cursor_next(c, NULL, NULL) == -1, "cursor past the last key returned a record");
+	close_cursor(c);
+}
+
+int main(int argc, char ** argv){
+	char value[VALUE_SIZE];
+	int64_t key;
+
+	CHECK(argc == 2, "usage: scan_test <prefetch depth>");
+	scan_prefetch_depth = atoi(argv[1]);
+	snprintf(db_path, sizeof(db_path), "scan_%s_%d.db", argv[1], getpid());
+	check_remove_db(db_path);
+	leaf_order = 8;
+	internal_order = 8;
+	buffer_frames = 128;
+	srand(5);
+
+	CHECK(open_db(db_path) == 0, "open_db failed");
+	for(key = 0; key < NUM_KEYS; key += 3){
+		value_of(key, value);
+		CHECK(insert(key, value) == 0, "insert %" PRId64 " failed", key);
+		present[key] = 1;
+		num_present++;
+	}
+	check_count();
+	scans();
+	cursors();
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	check_count();
+	close_db();
+	check_remove_db(db_path);
+	printf("scan_test %s: ok\n", argv[1]);
+	return 0;
+}
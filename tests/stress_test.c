@@ -0,0 +1,180 @@
+/* Readers and writers at the same time.
+ * Usage: stress_test <mode>
+ * The even keys are bulk loaded and never change; writer
+ * threads insert and delete the odd keys, each its own
+ * share of them, while reader threads look up the even
+ * keys one at a time, in batches and with cursors, and
+ * must always find them all, in order.  At the end every
+ * key must be as its writer left it, before and after a
+ * reopen.
+ */
+#include "last_version.c"
+#include "tree_check.h"
+
+#define NUM_KEYS 20000 // 짝수 키와 홀수 키 각각
+#define WRITERS 4
+#define READERS 3
+#define WRITER_OPS 3000
+
+char db_path[1024];
+char present[NUM_KEYS]; // 홀수 키 2j+1이 있는지, 맡은 writer만 바꾼다
+volatile int stop;
+int64_t next_bulk_key;
+
+void value_of(int64_t key, char * value){
+	memset(value, 0, VALUE_SIZE);
+	snprintf(value, VALUE_SIZE, "value %" PRId64, key);
+}
+
+int value_key_matches(const char * value, int64_t key){
+	char expected[VALUE_SIZE];
+
+	value_of(key, expected);
+	return strcmp(value, expected) == 0;
+}
+
+int bulk_next(int64_t * key, char * value, void * arg){
+	(void)arg;
+	if(next_bulk_key >= 2 * NUM_KEYS)
+		return -1;
+	*key = next_bulk_key;
+	value_of(*key, value);
+	next_bulk_key += 2;
+	return 0;
+}
+
+void reader_scan(int64_t start){
+	int64_t key, last = start - 1, want = start;
+	char value[VALUE_SIZE];
+	cursor * c = open_cursor(start);
+	int i;
+
+	CHECK(c != NULL, "open_cursor failed");
+	for(i = 0; i < 300 && want < 2 * NUM_KEYS && cursor_next(c, &key, value) == 0; i++){
+		CHECK(key > last, "cursor: key %" PRId64 " after %" PRId64, key, last);
+		CHECK(value_key_matches(value, key), "cursor: key %" PRId64 " has a wrong value", key);
+		last = key;
+		if(key % 2 == 0){
+			CHECK(key == want, "cursor skipped %" PRId64 ", came to %" PRId64, want, key);
+			want += 2;
+		}
+	}
+	close_cursor(c);
+}
+
+void reader_batch(int64_t start){
+	int64_t keys[64];
+	char buffers[64][VALUE_SIZE], * out[64];
+	int i;
+
+	for(i = 0; i < 64; i++){
+		keys[i] = ((start / 2 + i * 37) % NUM_KEYS) * 2;
+		out[i] = buffers[i];
+	}
+	CHECK(find_batch(keys, 64, out) == 64, "find_batch missed a key that is always there");
+	for(i = 0; i < 64; i++)
+		CHECK(out[i] != NULL && value_key_matches(out[i], keys[i]), "find_batch: key %" PRId64, keys[i]);
+}
+
+void * reader(void * arg){
+	unsigned int seed = (unsigned int)(long)arg * 7919 + 1;
+	int64_t key;
+	char * found;
+	long i;
+
+	for(i = 0; !stop; i++){
+		key = (rand_r(&seed) % NUM_KEYS) * 2;
+		if(i % 32 == 0)
+			reader_scan(key);
+		else if(i % 32 == 1)
+			reader_batch(key);
+		else{
+			found = find(key);
+			CHECK(found != NULL && value_key_matches(found, key), "find: key %" PRId64, key);
+			free(found);
+		}
+	}
+	return NULL;
+}
+
+void * writer(void * arg){
+	long id = (long)arg;
+	unsigned int seed = id * 104729 + 3;
+	char value[VALUE_SIZE], * found;
+	int64_t j, key;
+	int i, ret;
+
+	for(i = 0; i < WRITER_OPS; i++){
+		j = (rand_r(&seed) % (NUM_KEYS / WRITERS)) * WRITERS + id;
+		key = 2 * j + 1;
+		if(rand_r(&seed) % 2){
+			value_of(key, value);
+			ret = insert(key, value);
+			CHECK((ret == 0) == !present[j], "insert %" PRId64 " returned %d", key, ret);
+			present[j] = 1;
+		}
+		else{
+			ret = delete(key);
+			CHECK((ret == 0) == present[j], "delete %" PRId64 " returned %d", key, ret);
+			present[j] = 0;
+		}
+		if(i % 64 == 0){
+			found = find(key);
+			CHECK((found != NULL) == present[j], "find %" PRId64 " after a write", key);
+			free(found);
+		}
+	}
+	return NULL;
+}
+
+void check_contents(){
+	int64_t j, count = NUM_KEYS;
+	char * found;
+
+	for(j = 0; j < NUM_KEYS; j++){
+		found = find(2 * j);
+		CHECK(found != NULL, "key %" PRId64 " lost", 2 * j);
+		free(found);
+		found = find(2 * j + 1);
+		CHECK((found != NULL) == present[j], "key %" PRId64 " is %s", 2 * j + 1, found ? "back" : "lost");
+		CHECK(found == NULL || value_key_matches(found, 2 * j + 1), "key %" PRId64 " has a wrong value", 2 * j + 1);
+		free(found);
+		count += present[j];
+	}
+	CHECK(check_tree() == count, "tree holds a different number of records");
+}
+
+int main(int argc, char ** argv){
+	pthread_t writers[WRITERS], readers[READERS];
+	long i;
+
+	CHECK(argc == 2, "usage: stress_test <mode>");
+	check_configure(argv[1]);
+	snprintf(db_path, sizeof(db_path), "stress_%s_%d.db", argv[1], getpid());
+	check_remove_db(db_path);
+	leaf_order = 8;
+	internal_order = 8;
+	buffer_frames = 64;
+	checkpoint_log_bytes = 1000000;
+
+	CHECK(open_db(db_path) == 0, "open_db failed");
+	CHECK(bulk_load(bulk_next, NULL, 0.8) == 0, "bulk_load failed");
+	for(i = 0; i < WRITERS; i++)
+		pthread_create(&writers[i], NULL, writer, (void*)i);
+	for(i = 0; i < READERS; i++)
+		pthread_create(&readers[i], NULL, reader, (void*)i);
+	for(i = 0; i < WRITERS; i++)
+		pthread_join(writers[i], NULL);
+	stop = 1;
+	for(i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	check_contents();
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	check_contents();
+	close_db();
+	check_remove_db(db_path);
+	printf("stress_test %s: ok\n", argv[1]);
+	return 0;
+}
@@ -0,0 +1,250 @@
+/* White-box checks shared by the tests.
+ * A test includes last_version.c itself, so it can walk the
+ * pages: every node is checked against the key range its
+ * parent gives it, the leaves against the right sibling
+ * chain and their fill, every level against the B-link
+ * right links and high keys, slotted leaves against their
+ * heap, packed internal pages against their key encoding,
+ * and the free-space bitmap against the pages that the tree
+ * and its overflow chains use.  Any inconsistency stops the
+ * test with a message.
+ */
+#ifndef __TREE_CHECK_H__
+#define __TREE_CHECK_H__
+
+#include <stdarg.h>
+
+void check_fail(const char * fmt, ...){
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+	exit(EXIT_FAILURE);
+}
+
+#define CHECK(cond, ...) do{ if(!(cond)) check_fail(__VA_ARGS__); }while(0)
+
+/* Picks the storage and I/O path for the next open_db from
+ * a mode name given on the command line.
+ */
+void check_configure(const char * mode){
+	if(strcmp(mode, "mmap") == 0)
+		storage_mode = STORAGE_MMAP;
+	else if(strcmp(mode, "uring") == 0)
+		io_backend_type = IO_URING;
+	else if(strcmp(mode, "lz") == 0)
+		leaf_compression = 1;
+	else if(strcmp(mode, "optimistic") == 0)
+		optimistic_latching = 1;
+	else
+		CHECK(strcmp(mode, "buffered") == 0, "unknown mode %s", mode);
+}
+
+// 데이터 파일과 딸린 파일들을 지운다
+void check_remove_db(const char * path){
+	const char * suffixes[] = { "", ".wal", ".cold", ".cmap" };
+	char name[1024];
+	int i;
+
+	for(i = 0; i < 4; i++){
+		snprintf(name, sizeof(name), "%s%s", path, suffixes[i]);
+		unlink(name);
+	}
+}
+
+int64_t check_num_pages(){
+	header_page * header = get_page(0);
+	int64_t num_pages = header->num_pages;
+
+	put_page(0, 0);
+	return num_pages;
+}
+
+int check_page_free(int64_t offset){
+	int64_t page = offset / PAGE_SIZE, i = page % BITMAP_GROUP;
+	bitmap_page * map = get_page(bitmap_offset(page));
+	int is_free = !((map->bits[i / 64] >> (i % 64)) & 1);
+
+	put_page(bitmap_offset(page), 0);
+	return is_free;
+}
+
+// 비트맵의 빈 페이지 수를 세어 그룹 카운트, freepage_num과 맞춰 본다
+int64_t check_bitmap(){
+	int64_t num_pages = check_num_pages(), group, i, page, count, total = 0;
+	bitmap_page * map;
+	int used;
+
+	for(group = 0; group * BITMAP_GROUP <= num_pages; group++){
+		map = get_page((group * BITMAP_GROUP + 1) * PAGE_SIZE);
+		count = 0;
+		for(i = 0; i < BITMAP_GROUP; i++){
+			page = group * BITMAP_GROUP + i;
+			used = (map->bits[i / 64] >> (i % 64)) & 1;
+			CHECK(used || page <= num_pages, "bit clear past the end: page %" PRId64, page);
+			CHECK(used || (page != 0 && i != 1), "header or bitmap page %" PRId64 " is free", page);
+			count += !used;
+		}
+		CHECK(count == map->num_free, "bitmap group %" PRId64 " counts %" PRId64 " free, has %" PRId64, group, map->num_free, count);
+		total += count;
+		put_page((group * BITMAP_GROUP + 1) * PAGE_SIZE, 0);
+	}
+	CHECK(total == freepage_num, "freepage_num %d, bitmap %" PRId64, freepage_num, total);
+	return total;
+}
+
+#ifdef SLOTTED_LEAF_LAYOUT
+void check_slots(const leaf_page * leaf){
+	char map[PAGE_SIZE];
+	int i, j, offset, length, used = 0;
+
+	memset(map, 0, sizeof(map));
+	for(i = 0; i < leaf->num_keys; i++){
+		offset = leaf->slots[i].offset;
+		length = leaf->slots[i].length;
+		used += sizeof(leaf_slot) + length;
+		CHECK(length <= VALUE_SIZE, "slot %d: length %d", i, length);
+		CHECK(length == 0 || (offset >= 128 + leaf->num_keys * (int)sizeof(leaf_slot) &&
+			offset >= PAGE_SIZE - leaf->heap_bytes && offset + length <= PAGE_SIZE),
+			"slot %d: value at %d outside the heap", i, offset);
+		for(j = offset; j < offset + length; j++){
+			CHECK(!map[j], "slot %d overlaps another value", i);
+			map[j] = 1;
+		}
+	}
+	CHECK(used == leaf->used_bytes, "leaf uses %d bytes, says %d", used, leaf->used_bytes);
+	CHECK(used <= LEAF_SPACE, "leaf overflows: %d bytes", used);
+}
+#endif
+
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+void check_packed(const internal_page * page){
+	int64_t keys[INTERNAL_ORDER], offsets[INTERNAL_ORDER], base;
+	int i, n, bytes, shift;
+
+	n = internal_load(page, keys, offsets);
+	CHECK(n * (8 + page->key_bytes) <= INTERNAL_SPACE, "packed page overflows");
+	base = key_encoding(keys, n, &bytes, &shift);
+	CHECK(base == page->key_base && bytes == page->key_bytes && shift == page->key_shift,
+		"packed page has a stale key encoding");
+	for(i = 0; i <= n; i++)
+		CHECK(internal_lower_bound(page, i < n ? keys[i] : keys[n - 1] + 1) == i,
+			"packed lower bound wrong at %d", i);
+}
+#endif
+
+typedef struct tree_walk {
+	int64_t prev_key;
+	int64_t next_leaf; // 다음에 나와야 할 leaf, -1이면 끝이어야 한다
+	int64_t level_next[64]; // B-link: 레벨마다 다음에 나와야 할 노드
+	int leaf_depth;
+	int64_t nodes;
+	int64_t overflow_pages;
+} tree_walk;
+
+int64_t check_overflow_chain(int64_t offset){
+	int64_t count = 0, next;
+	overflow_page * page;
+
+	while(offset != 0){
+		CHECK(!check_page_free(offset), "overflow page %" PRId64 " is free", offset);
+		page = get_page(offset);
+		next = page->next_overflow_offset;
+		put_page(offset, 0);
+		offset = next;
+		count++;
+	}
+	return count;
+}
+
+int64_t check_node(tree_walk * w, int64_t offset, int64_t parent, int64_t low, int64_t high, int depth){
+	node_page * node = get_page(offset);
+	int64_t count = 0, right = node_right(node), child, child_low, child_high;
+	char value[VALUE_SIZE];
+	leaf_page * leaf;
+	internal_page * page;
+	int i;
+
+	CHECK(depth < 64, "tree deeper than 64");
+	CHECK(!check_page_free(offset), "tree page %" PRId64 " is free", offset);
+	CHECK(node->parent_page_offset == parent, "page %" PRId64 ": parent %" PRId64 ", expected %" PRId64, offset, node->parent_page_offset, parent);
+	CHECK(w->level_next[depth] == 0 || w->level_next[depth] == offset,
+		"depth %d: right link leads to %" PRId64 ", not %" PRId64, depth, w->level_next[depth], offset);
+	w->level_next[depth] = right ? right : -1;
+	CHECK(right == 0 || node->high_key == high, "page %" PRId64 ": high key %" PRId64 ", parent bound %" PRId64, offset, node->high_key, high);
+	CHECK(right != 0 || high == INT64_MAX, "page %" PRId64 " has no right link below bound %" PRId64, offset, high);
+	w->nodes++;
+
+	if(node->is_leaf){
+		leaf = (leaf_page*)node;
+		if(w->leaf_depth == -1)
+			w->leaf_depth = depth;
+		CHECK(w->leaf_depth == depth, "leaves at depths %d and %d", w->leaf_depth, depth);
+		CHECK(w->next_leaf == 0 || w->next_leaf == offset, "leaf chain leads to %" PRId64 ", not %" PRId64, w->next_leaf, offset);
+		w->next_leaf = leaf->right_sibling_offset ? leaf->right_sibling_offset : -1;
+		for(i = 0; i < leaf->num_keys; i++){
+			CHECK(LEAF_KEY(leaf, i) >= low && LEAF_KEY(leaf, i) < high && LEAF_KEY(leaf, i) > w->prev_key,
+				"leaf %" PRId64 ": key %" PRId64 " out of order", offset, LEAF_KEY(leaf, i));
+			w->prev_key = LEAF_KEY(leaf, i);
+			leaf_value(leaf, i, value);
+			if(is_overflow(value))
+				w->overflow_pages += check_overflow_chain(((overflow_stub*)value)->first_page_offset);
+		}
+		CHECK(parent == -1 || leaf->num_keys > 0, "leaf %" PRId64 " is empty", offset);
+#ifdef SLOTTED_LEAF_LAYOUT
+		check_slots(leaf); // 가변 길이라 나눠 가진 뒤에도 반이 안 될 수 있다
+#else
+		CHECK(parent == -1 || !leaf_underfull(leaf), "leaf %" PRId64 " underflows: %d keys", offset, leaf->num_keys);
+#endif
+		count = leaf->num_keys;
+		put_page(offset, 0);
+		return count;
+	}
+
+	page = (internal_page*)node;
+	CHECK(page->num_keys > 0, "internal page %" PRId64 " is empty", offset);
+	CHECK(parent == -1 || !internal_underfull(page), "internal page %" PRId64 " underflows: %d keys", offset, page->num_keys);
+#ifdef COMPRESSED_INTERNAL_LAYOUT
+	check_packed(page);
+#endif
+	for(i = -1; i < page->num_keys; i++){
+		child = i == -1 ? page->leftmost_offset : ENTRY_OFFSET(page, i);
+		child_low = i == -1 ? low : ENTRY_KEY(page, i);
+		child_high = i + 1 < page->num_keys ? ENTRY_KEY(page, i + 1) : high;
+		CHECK(child_low < child_high, "internal page %" PRId64 ": keys out of order at %d", offset, i);
+		count += check_node(w, child, offset, child_low, child_high, depth + 1);
+	}
+	put_page(offset, 0);
+	return count;
+}
+
+/* Checks the whole file and returns the number of records.
+ * Every page is either free, a bitmap page, the header, a
+ * tree node or part of an overflow chain.
+ */
+int64_t check_tree(){
+	header_page * header = get_page(0);
+	int64_t root = header->root_page_offset, free_pages, num_pages, count = 0;
+	tree_walk w;
+	int depth;
+
+	put_page(0, 0);
+	free_pages = check_bitmap();
+	num_pages = check_num_pages();
+	memset(&w, 0, sizeof(w));
+	w.prev_key = INT64_MIN;
+	w.leaf_depth = -1;
+	if(root != -1){
+		count = check_node(&w, root, -1, INT64_MIN, INT64_MAX, 0);
+		CHECK(w.next_leaf == -1, "last leaf has a right sibling");
+		for(depth = 0; depth < 64; depth++)
+			CHECK(w.level_next[depth] <= 0, "depth %d ends with a right link", depth);
+	}
+	CHECK(free_pages + num_pages / BITMAP_GROUP + 1 + w.nodes + w.overflow_pages == num_pages,
+		"pages leak: %" PRId64 " free, %" PRId64 " nodes, %" PRId64 " overflow, %" PRId64 " in all", free_pages, w.nodes, w.overflow_pages, num_pages);
+	return count;
+}
+
+#endif
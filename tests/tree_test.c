@@ -0,0 +1,157 @@
+/* Inserts, finds and deletes, through splits and merges.
+ * Usage: tree_test <mode>, mode being one of buffered, mmap,
+ * uring or lz (see check_configure).  Small orders make every
+ * few operations split or merge a node, and a small buffer
+ * pool makes them evict pages; the whole file is checked
+ * along the way, after a reopen, and once the tree is empty
+ * again.
+ */
+#include "last_version.c"
+#include "tree_check.h"
+
+#define NUM_KEYS 4000
+#define NUM_OPS 30000
+#define CHECK_EVERY 1499
+
+char db_path[1024];
+char present[NUM_KEYS];
+int64_t num_present;
+
+// 조밀한 키와 흩어진 키, 흩어진 쪽은 음수와 큰 간격을 섞는다
+int64_t key_of(int i, int sparse){
+	if(!sparse)
+		return i;
+	return ((int64_t)(i % 7) - 3) * (1LL << 40) + (int64_t)i * 7919;
+}
+
+// 값의 길이를 키마다 다르게 해서 가변 길이 leaf도 나뉘게 한다
+void value_of(int64_t key, char * value){
+	int length = (int)((key & 0x7fffffff) % 90);
+
+	memset(value, 0, VALUE_SIZE);
+	snprintf(value, VALUE_SIZE, "%" PRId64 ":", key);
+	memset(value + strlen(value), 'a' + (int)(key & 15), length);
+}
+
+void check_find(int i, int sparse){
+	char expected[VALUE_SIZE], * found = find(key_of(i, sparse));
+
+	CHECK((found != NULL) == present[i], "find %" PRId64 ": %s", key_of(i, sparse), found ? "found a deleted key" : "missing");
+	if(found != NULL){
+		value_of(key_of(i, sparse), expected);
+		CHECK(strcmp(found, expected) == 0, "find %" PRId64 ": wrong value", key_of(i, sparse));
+		free(found);
+	}
+}
+
+void check_all(int sparse){
+	int i;
+
+	CHECK(check_tree() == num_present, "tree holds a different number of records than were inserted");
+	for(i = 0; i < NUM_KEYS; i++)
+		check_find(i, sparse);
+}
+
+void random_ops(int sparse){
+	char value[VALUE_SIZE];
+	int i, k, ret;
+
+	for(i = 0; i < NUM_OPS; i++){
+		k = rand() % NUM_KEYS;
+		if(rand() % 3){
+			value_of(key_of(k, sparse), value);
+			ret = insert(key_of(k, sparse), value);
+			CHECK((ret == 0) != present[k], "insert %" PRId64 " returned %d", key_of(k, sparse), ret);
+			if(!present[k]){
+				present[k] = 1;
+				num_present++;
+			}
+		}
+		else{
+			ret = delete(key_of(k, sparse));
+			CHECK((ret == 0) == present[k], "delete %" PRId64 " returned %d", key_of(k, sparse), ret);
+			if(present[k]){
+				present[k] = 0;
+				num_present--;
+			}
+		}
+		if(i % CHECK_EVERY == 0)
+			check_all(sparse);
+	}
+	check_all(sparse);
+}
+
+void delete_all(int sparse){
+	int i;
+
+	for(i = 0; i < NUM_KEYS; i++)
+		if(present[i]){
+			CHECK(delete(key_of(i, sparse)) == 0, "delete %" PRId64 " failed", key_of(i, sparse));
+			present[i] = 0;
+			num_present--;
+		}
+	check_all(sparse);
+}
+
+/* Long values go to overflow chains; replacing and
+ * deleting them must give every page back.
+ */
+void long_values(){
+	char * value, * found;
+	int64_t length, lengths[] = { VALUE_SIZE, VALUE_SIZE + 1, OVERFLOW_DATA, 3 * OVERFLOW_DATA + 17, 20000 };
+	int i, j, n = sizeof(lengths) / sizeof(lengths[0]);
+
+	value = (char*)malloc(20000);
+	for(i = 0; i < 20000; i++)
+		value[i] = (char)(i * 7 + 1);
+	value[50] = 0; // NUL이 있어도 값의 일부
+
+	for(i = 0; i < n; i++){
+		CHECK(insert_value(-1000 - i, value, lengths[i]) == 0, "insert_value of %" PRId64 " bytes failed", lengths[i]);
+		CHECK(insert_value(-1000 - i, value, lengths[i]) != 0, "insert_value took a duplicate key");
+	}
+	CHECK(check_tree() == n, "long values: wrong count");
+	for(j = 0; j < 2; j++){
+		for(i = 0; i < n; i++){
+			found = find_value(-1000 - i, &length);
+			CHECK(found != NULL && length == lengths[i] && memcmp(found, value, length) == 0,
+				"find_value of %" PRId64 " bytes gave back something else", lengths[i]);
+			free(found);
+		}
+		close_db();
+		CHECK(open_db(db_path) == 0, "reopen failed");
+	}
+	for(i = 0; i < n; i++)
+		CHECK(delete(-1000 - i) == 0, "delete of a long value failed");
+	CHECK(check_tree() == 0, "long values: tree not empty");
+	free(value);
+}
+
+int main(int argc, char ** argv){
+	int sparse;
+
+	CHECK(argc == 2, "usage: tree_test <mode>");
+	check_configure(argv[1]);
+	snprintf(db_path, sizeof(db_path), "tree_%s_%d.db", argv[1], getpid());
+	check_remove_db(db_path);
+	leaf_order = 4;
+	internal_order = 4;
+	buffer_frames = 64;
+	srand(1);
+
+	CHECK(open_db(db_path) == 0, "open_db failed");
+	if(io_backend_type == IO_URING && io != &io_backends[IO_URING])
+		printf("io_uring is not available here, the test runs on pread\n");
+	long_values();
+	for(sparse = 0; sparse < 2; sparse++){
+		random_ops(sparse);
+		close_db();
+		CHECK(open_db(db_path) == 0, "reopen failed");
+		check_all(sparse);
+		delete_all(sparse);
+	}
+	close_db();
+	check_remove_db(db_path);
+	printf("tree_test %s: ok\n", argv[1]);
+	return 0;
+}
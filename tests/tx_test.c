@@ -0,0 +1,321 @@
+/* Transactions.
+ * Usage: tx_test basic | wait_die | transfer | crash
+ * basic checks that abort_tx puts every record back and that
+ * commit_tx keeps them, across a reopen.  wait_die makes a
+ * younger transaction die on a lock an older one holds and
+ * an older one wait for a younger one.  transfer moves money
+ * between accounts from several threads while an auditor
+ * adds them all up in one transaction; crash does the same
+ * in a child that is killed, and recovery must roll back the
+ * transfers that were cut short.  The total never changes.
+ */
+#include "last_version.c"
+#include "tree_check.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define ACCOUNTS 200
+#define START_BALANCE 1000
+#define THREADS 4
+#define TRANSFERS 1500
+#define CRASH_ROUNDS 6
+
+char db_path[1024];
+volatile int stop;
+
+long balance(int64_t account, int * ok){
+	char * value = find(account);
+	long b;
+
+	if(value == NULL){
+		*ok = 0;
+		return 0;
+	}
+	b = atol(value);
+	free(value);
+	return b;
+}
+
+int set_balance(int64_t account, long b){
+	char value[VALUE_SIZE];
+
+	snprintf(value, sizeof(value), "%ld", b);
+	if(delete(account) != 0)
+		return -1;
+	return insert(account, value);
+}
+
+long total(int * missing){
+	long sum = 0;
+	int64_t account;
+	int ok;
+
+	*missing = 0;
+	for(account = 0; account < ACCOUNTS; account++){
+		ok = 1;
+		sum += balance(account, &ok);
+		*missing += !ok;
+	}
+	return sum;
+}
+
+void check_total(const char * when){
+	int missing;
+	long sum = total(&missing);
+
+	CHECK(sum == (long)ACCOUNTS * START_BALANCE && missing == 0, "%s: total %ld, %d accounts missing", when, sum, missing);
+}
+
+void open_accounts(){
+	int64_t account;
+	char value[VALUE_SIZE];
+
+	check_remove_db(db_path);
+	CHECK(open_db(db_path) == 0, "open_db failed");
+	snprintf(value, sizeof(value), "%d", START_BALANCE);
+	for(account = 0; account < ACCOUNTS; account++)
+		CHECK(insert(account, value) == 0, "insert failed");
+}
+
+void basic(){
+	char * big, * found, * batch_values[3] = { "x", "y", "z" };
+	int64_t length, batch_keys[3] = { 6000, 7000, 7001 };
+	int ok = 1, i;
+
+	big = (char*)malloc(20000);
+	for(i = 0; i < 20000; i++)
+		big[i] = (char)(i * 7 + 1);
+	CHECK(insert_value(5000, big, 20000) == 0, "insert_value failed");
+
+	CHECK(begin_tx() == 0, "begin_tx failed");
+	CHECK(set_balance(1, 5) == 0 && delete(2) == 0 && insert(9999, "x") == 0, "writes in a transaction failed");
+	CHECK(delete(5000) == 0 && insert_value(5001, big, 9000) == 0, "long values in a transaction failed");
+	found = find(2);
+	CHECK(found == NULL && balance(1, &ok) == 5, "a transaction does not see its own writes");
+	CHECK(abort_tx() == 0, "abort_tx failed");
+
+	check_total("after abort");
+	found = find_value(5000, &length);
+	CHECK(found != NULL && length == 20000 && memcmp(found, big, length) == 0, "abort did not bring back a long value");
+	free(found);
+	CHECK(find(9999) == NULL && find(5001) == NULL, "abort left inserted records");
+
+	CHECK(begin_tx() == 0, "begin_tx failed");
+	CHECK(set_balance(1, 5) == 0 && delete(2) == 0 && insert(9999, "x") == 0, "writes in a transaction failed");
+	CHECK(commit_tx() == 0, "commit_tx failed");
+	CHECK(commit_tx() == -1 && abort_tx() == -1, "commit_tx or abort_tx without a transaction");
+	CHECK(begin_tx() == 0 && begin_tx() == -1, "begin_tx inside a transaction");
+	abort_tx();
+
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	found = find(9999);
+	CHECK(balance(1, &ok) == 5 && find(2) == NULL && found != NULL, "a committed transaction was lost");
+	free(found);
+	CHECK(check_tree() == ACCOUNTS - 1 + 2, "tree holds a different number of records");
+
+	// 로그에 못 남기는 값: 지우기는 실패하고 잠금을 남기지 않는다
+	big = (char*)realloc(big, TX_MAX_IMAGE + 1);
+	memset(big, 'h', TX_MAX_IMAGE + 1);
+	CHECK(insert_value(6000, big, TX_MAX_IMAGE + 1) == 0, "insert_value of a huge value failed");
+	CHECK(begin_tx() == 0, "begin_tx failed");
+	CHECK(delete(6000) == -1, "deleted a value too long to log");
+	CHECK(tx_current()->locks == NULL, "the failed delete kept its lock");
+	CHECK(set_balance(1, 6) == 0 && commit_tx() == 0, "the transaction did not go on after the failed delete");
+
+	// 배치는 건너뛰는 키의 값을 로그에 남기지 않는다
+	CHECK(begin_tx() == 0, "begin_tx failed");
+	CHECK(insert_batch(batch_keys, batch_values, 3) == 2, "insert_batch next to a value too long to log failed");
+	CHECK(tx_current()->num_undo == 2, "insert_batch logged a key it did not change");
+	CHECK(abort_tx() == 0 && tx_current()->locks == NULL, "abort_tx after insert_batch failed");
+	found = find_value(6000, &length);
+	CHECK(found != NULL && length == TX_MAX_IMAGE + 1 && memcmp(found, big, length) == 0, "insert_batch changed a key it skipped");
+	free(found);
+	CHECK(find(7000) == NULL && find(7001) == NULL, "abort left records of insert_batch");
+	CHECK(delete(6000) == 0, "delete outside of a transaction failed");
+	free(big);
+}
+
+// wait_die의 두 트랜잭션이 주고받는 상태
+pthread_mutex_t step_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t step_cond = PTHREAD_COND_INITIALIZER;
+int step;
+volatile int younger_committing;
+
+void wait_step(int s){
+	pthread_mutex_lock(&step_mutex);
+	while(step < s)
+		pthread_cond_wait(&step_cond, &step_mutex);
+	pthread_mutex_unlock(&step_mutex);
+}
+
+void next_step(int s){
+	pthread_mutex_lock(&step_mutex);
+	step = s;
+	pthread_cond_broadcast(&step_cond);
+	pthread_mutex_unlock(&step_mutex);
+}
+
+void * younger(void * arg){
+	(void)arg;
+	wait_step(1);
+	CHECK(begin_tx() == 0, "younger: begin_tx failed");
+	CHECK(set_balance(1, 0) == -1, "younger: wrote a record an older transaction holds");
+	CHECK(commit_tx() == -1, "younger: commit_tx after dying");
+
+	CHECK(begin_tx() == 0, "younger: begin_tx failed");
+	CHECK(set_balance(2, START_BALANCE + 10) == 0 && set_balance(3, START_BALANCE - 10) == 0, "younger: writes failed");
+	next_step(2);
+	usleep(100000); // 오래된 쪽이 기다리기 시작할 시간
+	younger_committing = 1;
+	CHECK(commit_tx() == 0, "younger: commit_tx failed");
+	return NULL;
+}
+
+void wait_die(){
+	pthread_t t;
+	int ok = 1;
+
+	pthread_create(&t, NULL, younger, NULL);
+	CHECK(begin_tx() == 0, "older: begin_tx failed");
+	CHECK(set_balance(1, START_BALANCE - 1) == 0, "older: write failed");
+	next_step(1);
+	wait_step(2);
+	CHECK(set_balance(2, balance(2, &ok) + 1) == 0 && ok, "older: write after waiting failed");
+	CHECK(younger_committing, "older did not wait for the younger transaction");
+	CHECK(commit_tx() == 0, "older: commit_tx failed");
+	pthread_join(t, NULL);
+	check_total("after wait-die");
+}
+
+/* Moves a random amount between two accounts.  Returns 0,
+ * 1 if the transaction died and should be tried again, or
+ * 2 if it was aborted on purpose.
+ */
+int transfer(unsigned int * seed){
+	int64_t from = rand_r(seed) % ACCOUNTS, to = rand_r(seed) % ACCOUNTS;
+	long amount = rand_r(seed) % 50, from_balance, to_balance;
+	int ok = 1;
+
+	if(from == to)
+		return 0;
+	CHECK(begin_tx() == 0, "begin_tx failed");
+	from_balance = balance(from, &ok);
+	to_balance = balance(to, &ok);
+	if(!ok || set_balance(from, from_balance - amount) != 0){
+		abort_tx();
+		return 1;
+	}
+	if(rand_r(seed) % 10 == 0){
+		CHECK(abort_tx() == 0, "abort_tx failed");
+		return 2;
+	}
+	if(set_balance(to, to_balance + amount) != 0){
+		abort_tx();
+		return 1;
+	}
+	return commit_tx() == 0 ? 0 : 1;
+}
+
+void * transfer_thread(void * arg){
+	unsigned int seed = (unsigned int)(long)arg * 7919 + 1;
+	int i;
+
+	for(i = 0; i < TRANSFERS && !stop; i++)
+		while(transfer(&seed) == 1) ;
+	return NULL;
+}
+
+// 한 트랜잭션 안에서 합을 본다: 직렬 가능하면 늘 같다
+void * auditor(void * arg){
+	int64_t account;
+	long sum;
+	int ok;
+
+	(void)arg;
+	while(!stop){
+		CHECK(begin_tx() == 0, "auditor: begin_tx failed");
+		ok = 1;
+		sum = 0;
+		for(account = 0; account < ACCOUNTS && ok; account++)
+			sum += balance(account, &ok);
+		if(!ok){
+			abort_tx();
+			continue;
+		}
+		commit_tx();
+		CHECK(sum == (long)ACCOUNTS * START_BALANCE, "auditor saw a total of %ld", sum);
+	}
+	return NULL;
+}
+
+void transfers(){
+	pthread_t threads[THREADS], audit;
+	long i;
+
+	pthread_create(&audit, NULL, auditor, NULL);
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, transfer_thread, (void*)i);
+	for(i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	stop = 1;
+	pthread_join(audit, NULL);
+	check_total("after the transfers");
+	close_db();
+	CHECK(open_db(db_path) == 0, "reopen failed");
+	check_total("after a reopen");
+}
+
+void crashes(){
+	pthread_t threads[THREADS];
+	int round;
+	long i;
+	pid_t pid;
+
+	checkpoint_log_bytes = 200000;
+	close_db();
+	for(round = 0; round < CRASH_ROUNDS; round++){
+		pid = fork();
+		CHECK(pid >= 0, "fork");
+		if(pid == 0){
+			CHECK(open_db(db_path) == 0, "child: open_db failed");
+			for(i = 0; i < THREADS; i++)
+				pthread_create(&threads[i], NULL, transfer_thread, (void*)(i + round * 100));
+			for(i = 0; i < THREADS; i++)
+				pthread_join(threads[i], NULL);
+			_exit(0);
+		}
+		usleep(20000 + rand() % 200000);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		CHECK(open_db(db_path) == 0, "round %d: recovery failed", round);
+		check_total("after recovery");
+		CHECK(check_tree() == ACCOUNTS, "round %d: tree holds a different number of records", round);
+		close_db();
+	}
+	CHECK(open_db(db_path) == 0, "open_db failed");
+}
+
+int main(int argc, char ** argv){
+	CHECK(argc == 2, "usage: tx_test basic | wait_die | transfer | crash");
+	snprintf(db_path, sizeof(db_path), "tx_%s_%d.db", argv[1], getpid());
+	leaf_order = 4;
+	internal_order = 4;
+	srand(getpid());
+
+	open_accounts();
+	if(strcmp(argv[1], "basic") == 0)
+		basic();
+	else if(strcmp(argv[1], "wait_die") == 0)
+		wait_die();
+	else if(strcmp(argv[1], "transfer") == 0)
+		transfers();
+	else if(strcmp(argv[1], "crash") == 0)
+		crashes();
+	else
+		check_fail("unknown test %s", argv[1]);
+	close_db();
+	check_remove_db(db_path);
+	printf("tx_test %s: ok\n", argv[1]);
+	return 0;
+}